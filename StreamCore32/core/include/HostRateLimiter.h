@@ -0,0 +1,88 @@
+#pragma once
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "HTTPClient.h"
+
+// Process-wide request pacing keyed by host (radio metadata, Qobuz API,
+// Spotify storage-resolve / token endpoints). Each host gets a token bucket
+// and a cap on requests in flight. Limits tighten from Retry-After,
+// X-RateLimit-* and 429/503 answers and recover slowly on success.
+// Background callers are refused rather than queued when a host is busy;
+// Interactive callers are served before Normal ones waiting on the same host.
+class HostRateLimiter {
+ public:
+  enum class Priority : uint8_t { Background = 0, Normal = 1, Interactive = 2 };
+
+  struct Limits {
+    float ratePerSec = 4.0f;
+    uint8_t burst = 4;
+    uint8_t maxConcurrent = 2;
+  };
+
+  struct Stats {
+    uint32_t granted = 0;
+    uint32_t throttled = 0;  // granted after waiting
+    uint32_t deferred = 0;   // refused instead of waiting
+    uint32_t learned = 0;    // limits adjusted from a response
+  };
+
+  // Holds one in-flight slot of a host until destroyed.
+  class Permit {
+   public:
+    Permit() = default;
+    Permit(Permit&& o) noexcept { *this = std::move(o); }
+    Permit& operator=(Permit&& o) noexcept;
+    ~Permit();
+    explicit operator bool() const { return owner_ != nullptr; }
+
+   private:
+    friend class HostRateLimiter;
+    Permit(HostRateLimiter* owner, std::string host)
+        : owner_(owner), host_(std::move(host)) {}
+    HostRateLimiter* owner_ = nullptr;
+    std::string host_;
+  };
+
+  static constexpr uint32_t kDefaultWaitMs = 15000;
+  static constexpr float kMinRate = 0.1f;
+  static constexpr uint32_t kMaxBlockSec = 600;
+
+  static HostRateLimiter& shared();
+
+  void setLimits(const std::string& host, const Limits& limits);
+
+  // Empty permit when the request should not be made now: a Background
+  // caller would have to wait, or the wait would exceed maxWaitMs.
+  Permit acquire(const std::string& url, Priority prio = Priority::Normal,
+                 uint32_t maxWaitMs = kDefaultWaitMs);
+  // Feeds status and rate-limit headers of a response back into the host.
+  void observe(const std::string& url, bell::HTTPClient::Response& resp);
+
+  Stats stats();
+
+ private:
+  struct Bucket {
+    Limits limits;
+    float rate = 0;
+    float tokens = 0;
+    uint32_t refillAt = 0;
+    uint32_t blockedUntil = 0;
+    uint8_t inFlight = 0;
+    uint8_t waiting[3] = {0, 0, 0};
+  };
+
+  static std::string hostKey(const std::string& url);
+  static uint32_t nowMs();
+  Bucket& bucketLocked(const std::string& host, uint32_t now);
+  void release(const std::string& host);
+
+  std::mutex mu_;
+  std::condition_variable cv_;
+  std::map<std::string, Limits> limits_;
+  std::map<std::string, Bucket> hosts_;
+  Stats stats_{};
+};
@@ -0,0 +1,64 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+
+#include "EspRandomEngine.h"
+
+// Delay policy for reopening a dropped stream.
+// The first drop after audio was flowing over a cleanly closed connection is
+// retried at once (server restarts, load balancer idle cuts). After that the
+// delay doubles from kBaseMs up to kMaxMs with "equal jitter": half of the
+// window is fixed, the other half random, so devices behind the same outage
+// do not come back in lockstep. Streaming for kStableMs wipes the history.
+class ReconnectPolicy {
+ public:
+  static constexpr uint32_t kBaseMs = 250;
+  static constexpr uint32_t kMaxMs = 30000;
+  static constexpr uint32_t kStableMs = 60000;
+  // consecutive attempts without audio before a caller should give up
+  static constexpr uint8_t kMaxFailures = 10;
+
+  // Audio arrived on the current connection.
+  void streaming(uint32_t nowMs) {
+    if (streaming_)
+      return;
+    streaming_ = true;
+    since_ = nowMs;
+    failures_ = 0;
+  }
+
+  // The connection ended or could not be opened; returns the wait before the
+  // next attempt.
+  uint32_t next(uint32_t nowMs, bool cleanEof) {
+    if (streaming_ && nowMs - since_ >= kStableMs)
+      attempts_ = 0;
+    const bool immediate = cleanEof && streaming_ && attempts_ == 0;
+    if (!streaming_ && failures_ < 255)
+      failures_++;
+    streaming_ = false;
+    const uint8_t n = attempts_;
+    if (attempts_ < 255)
+      attempts_++;
+    if (immediate)
+      return 0;
+    uint32_t window =
+        std::min<uint32_t>(kMaxMs, kBaseMs << std::min<uint8_t>(n, 8));
+    return window / 2 + rng_() % (window / 2 + 1);
+  }
+
+  void reset() {
+    attempts_ = 0;
+    failures_ = 0;
+    streaming_ = false;
+  }
+
+  bool exhausted() const { return failures_ >= kMaxFailures; }
+  uint8_t attempts() const { return attempts_; }
+
+ private:
+  streamcore::esp_random_engine rng_;
+  uint32_t since_ = 0;
+  uint8_t attempts_ = 0;
+  uint8_t failures_ = 0;
+  bool streaming_ = false;
+};
@@ -2,6 +2,7 @@
 #include <algorithm>
 #include <atomic>
 #include <cctype>
+#include <chrono>
 #include <cstdint>
 #include <functional>
 #include <limits>
@@ -17,6 +18,7 @@
 #include "BellTask.h"
 #include "HTTPClient.h"
 #include "Logger.h"
+#include "ReconnectPolicy.h"
 #include "StreamCoreFile.h"
 
 class StreamBase : public bell::Task {
@@ -70,9 +72,13 @@ class StreamBase : public bell::Task {
     (void)tid;
     if (!displayName.empty())
       emitMeta(displayName, "");
-    auto resp = bell::HTTPClient::get(uri);  // uses SocketStream under the hood
-    if (!resp || resp->contentLength() ==
-                     0) {  // len may be 0 for live streams; still ok
+    bell::HTTPClient::Headers hdrs;
+    if (resumeAt_ > 0)
+      hdrs.push_back(bell::HTTPClient::RangeHeader::open(resumeAt_));
+    auto resp =
+        bell::HTTPClient::get(uri, hdrs);  // uses SocketStream under the hood
+    // len is 0 for live streams, only a missing or error response fails
+    if (!resp || resp->status() >= 400) {
       reportError("DLNA: failed to open " + uri);
       return nullptr;
     }
@@ -87,6 +93,9 @@ class StreamBase : public bell::Task {
   void runTask() override {
 
     isRunning_.store(true);
+    uint32_t tid = 0;
+    bool reconnecting = false;
+    std::string openedUri;
 
     while (isRunning_.load()) {
       if (wantStop_.load()) {
@@ -105,32 +114,52 @@ class StreamBase : public bell::Task {
         uri = targetUri_;
         name = displayName_;
       }
+      // a play() during the reconnect wait wins over the reconnect
+      if (uri != openedUri)
+        reconnecting = false;
+      openedUri = uri;
       wantRestart_.store(false);
       if (uri.empty()) {
         sleepMs(100);
         continue;
       }
 
-      // Bump track id so the sink treats this as a fresh stream and soft-stops previous
-
-      const uint32_t tid = audio_->makeUniqueTrackId();
+      // A reconnect keeps the track id so the sink plays out what it has
+      // buffered instead of being cut; anything else is a fresh stream.
+      if (!reconnecting || tid == 0) {
+        tid = audio_->makeUniqueTrackId();
+        resumeAt_ = 0;
+        reconnect_.reset();
+      }
+      reconnecting = false;
       if (onState_)
         onState_(true);
-      auto resp = open(targetUri_, name, tid);
-      if (resp == nullptr) {
-        isRunning_.store(false);
-        break;
+      auto resp = open(uri, name, tid);
+      if (resp != nullptr && resumeAt_ > 0 && resp->status() != 206) {
+        // range ignored: a live source resumes at its live edge, a file
+        // would replay from the start, so restart that as a new track
+        if (resp->contentLength() > 0) {
+          if (feed_)
+            feed_->feedCommand(AudioControl::SKIP, 0);
+          tid = audio_->makeUniqueTrackId();
+        }
+        resumeAt_ = 0;
       }
+      const size_t total = (resp != nullptr && resp->contentLength() > 0)
+                               ? resumeAt_ + resp->contentLength()
+                               : 0;
       const size_t CHUNK = 1024;
       uint8_t buf[CHUNK];
-      int ret = 0;
-      while (!wantStop_.load()) {
+      int ret = -1;
+      while (resp != nullptr && !wantStop_.load()) {
         ret = read(resp->stream(), buf, 1024, tid);
         if (ret <= 0) {
           BELL_LOG(debug, "Qobuz", "read %d bytes", ret);
           break;
         } else
           BELL_LOG(debug, "Qobuz", "read %d bytes", ret);
+        reconnect_.streaming(nowMs());
+        resumeAt_ += (size_t)ret;
         uint16_t written = 0;
         while (written < ret && !wantStop_.load()) {
           uint16_t ret_ =
@@ -144,7 +173,7 @@ class StreamBase : public bell::Task {
       if (onState_)
         onState_(false);
 
-      if (wantStop_.load()) {
+      if (wantStop_.load() || (resp == nullptr && reconnect_.exhausted())) {
         // final cleanup
         if (feed_) {
           feed_->feedCommand(AudioControl::FLUSH, 0);
@@ -153,11 +182,19 @@ class StreamBase : public bell::Task {
         wantStop_.store(false);
         isRunning_.store(false);
         break;
-      } else {
+      }
+      // the whole body arrived; a clean close short of it is a drop
+      if (ret == 0 && total > 0 && resumeAt_ >= total) {
         if (feed_)
           feed_->feedCommand(AudioControl::SKIP, 0);
-        sleepMs(reconnectDelayMs_);
-        wantRestart_.store(ret < 0);  // reconnect only on unexpected end
+        continue;  // idle until the next play()
+      }
+      const uint32_t delay = reconnect_.next(nowMs(), ret == 0);
+      BELL_LOG(info, "StreamBase", "reconnect %u in %u ms",
+               (unsigned)reconnect_.attempts(), (unsigned)delay);
+      if (waitReconnect(delay)) {
+        reconnecting = true;
+        wantRestart_.store(true);
       }
     }
   }
@@ -181,6 +218,23 @@ class StreamBase : public bell::Task {
     std::this_thread::sleep_for(std::chrono::milliseconds(ms));
 #endif
   }
+  // Sleeps in short slices; false if stop() or play() was called meanwhile.
+  bool waitReconnect(uint32_t ms) {
+    while (ms) {
+      if (wantStop_.load() || wantRestart_.load())
+        return false;
+      uint32_t s = std::min<uint32_t>(ms, 50);
+      sleepMs(s);
+      ms -= s;
+    }
+    return !wantStop_.load() && !wantRestart_.load();
+  }
+  // monotonic, wraps after ~49 days; compare with unsigned subtraction
+  static uint32_t nowMs() {
+    return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
 
  public:
   // utils
@@ -250,6 +304,7 @@ class StreamBase : public bell::Task {
   ErrorCb onError_;
   StateCb onState_;
 
-  const uint32_t reconnectDelayMs_ = 1500;
+  ReconnectPolicy reconnect_;
+  size_t resumeAt_ = 0;  // bytes of the current resource already fed
   static constexpr const char* ua_ = "StreamCore32/StreamBase (ESP32)";
 };
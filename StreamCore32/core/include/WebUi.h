@@ -23,7 +23,8 @@ static const char* TEXT_JS = R"delim(
 return;if(!radioState.items||radioState.items.length===0){tbody.innerHTML=`<tr><td colspan="4">No stations found. Try another search.</td></tr>`;return}
 tbody.innerHTML=radioState.items.map((st)=>{const infoParts=[];if(st.genre)
 infoParts.push(st.genre);if(st.country)
-infoParts.push(st.country);const info=infoParts.join(" · ")||"";const fav=st.favorite?"★":"☆";return ` <tr data-url="${st.url || ""}" data-name="${st.name || ""}"> <td> <button class="btn small star-btn" data-action="radio-favorite" data-fav="${st.favorite ? "1" : "0"}"> ${fav}</button></td> <td>${st.name || ""}</td> <td>${info}</td> <td class="radio-actions"> <button class="btn small" data-action="radio-play">Play</button> <button class="btn small ghost" data-action="radio-save">Save</button> </td> </tr>`}).join("")}
+infoParts.push(st.country);const h=st.health;if(h)
+infoParts.push(h.score+"% reliable"+(h.score<60?" ⚠":""));const tip=h?`${h.sessions} sessions, ${h.failures} failed, ${h.reconnects} drops, ${h.underruns} stalls, connect ${h.connectMs} ms, first audio ${h.firstAudioMs} ms, ${h.throughput}% of bitrate, ${h.minutes} min`:"";const info=infoParts.join(" · ")||"";const fav=st.favorite?"★":"☆";return ` <tr data-url="${st.url || ""}" data-name="${st.name || ""}"> <td> <button class="btn small star-btn" data-action="radio-favorite" data-fav="${st.favorite ? "1" : "0"}"> ${fav}</button></td> <td>${st.name || ""}</td> <td title="${tip}">${info}</td> <td class="radio-actions"> <button class="btn small" data-action="radio-play">Play</button> <button class="btn small ghost" data-action="radio-save">Save</button> </td> </tr>`}).join("")}
 const rootStyle=getComputedStyle(document.documentElement);const rangeTrackColor=(rootStyle.getPropertyValue("--range-track")||"#c6c6c6").trim();const rangeThumbColor=(rootStyle.getPropertyValue("--range-thumb")||"#2e7da4").trim();function styleRange(input){const min=Number(input.min)||0;const max=Number(input.max)||100;const val=Number(input.value);const span=max-min||1;const pct=((val-min)*100)/span;input.style.background=`linear-gradient(to right, ${rangeThumbColor} 0%, ${rangeThumbColor} ${pct}%, ${rangeTrackColor} ${pct}%, ${rangeTrackColor} 100%)`}
 function initAllRanges(){document.querySelectorAll('input[type="range"]').forEach((r)=>{styleRange(r);r.addEventListener("input",()=>styleRange(r))})}
 function initNav(){const navLinks=document.querySelectorAll(".nav-link");const pages=document.querySelectorAll(".page");navLinks.forEach((btn)=>{btn.addEventListener("click",()=>{const pageId="page-"+btn.dataset.page;wsSend({type:"page",page:pageId});navLinks.forEach((b)=>b.classList.remove("active"));btn.classList.add("active");pages.forEach((p)=>{p.classList.toggle("active",p.id===pageId)})})})}
@@ -53,7 +54,7 @@ if(!url)
 url=await fetchCoverFromWikipedia(artist,releaseTitle);return url}
 function handleWsMessage(msg){if(!msg||typeof msg!=="object")
 return;switch(msg.type){case "playback":updatePlayback(msg);break;case "radio":msg.stations.forEach((item)=>{item.favorite=!0});for(var i=0;i<radioState.items.length;i++){if(radioState.items[i].favorite){radioState.items.splice(i,1)}}
-msg.stations.concat(radioState.items);radioState.items=msg.stations;renderRadioStations();break;case "settings":break;case "debug":const log_box=document.getElementById("page-debug");if(log_box){var elem=log_box.querySelectorAll(".info-row");if(msg.heap){elem[1].children[1].textContent=msg.heap+" kB"}
+msg.stations.sort((a,b)=>(b.health?b.health.score:50)-(a.health?a.health.score:50));msg.stations.concat(radioState.items);radioState.items=msg.stations;renderRadioStations();break;case "settings":break;case "debug":const log_box=document.getElementById("page-debug");if(log_box){var elem=log_box.querySelectorAll(".info-row");if(msg.heap){elem[1].children[1].textContent=msg.heap+" kB"}
 if(msg.rssi){elem[0].children[1].textContent=msg.rssi+" dBm"}
 if(msg.tasks){elem[2].removeChild(elem[2].lastChild);var new_table=document.createElement("table");new_table.innerHTML=`<thead><tr><th class="td-or">Thread</th><th>State</th><th>free</th><th>Prio</th></tr></thead>`
 var td5=document.createElement("tbody");for(var i=0;i<msg.tasks.length;i++){var tr=document.createElement("tr");var td1=document.createElement("td");td1.classList.add("td-or");var td2=document.createElement("td");td1.textContent=msg.tasks[i].task;td2.textContent=msg.tasks[i].state;var td3=document.createElement("td");td3.textContent=msg.tasks[i].stack;var td4=document.createElement("td");td4.textContent=msg.tasks[i].priority;tr.appendChild(td1);tr.appendChild(td2);tr.appendChild(td3);tr.appendChild(td4);td5.appendChild(tr)}
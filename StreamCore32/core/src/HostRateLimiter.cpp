@@ -0,0 +1,221 @@
+#include "HostRateLimiter.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <ctime>
+
+#include "Logger.h"
+
+namespace {
+uint32_t parseUint(std::string_view sv, bool* present) {
+  uint32_t v = 0;
+  size_t i = 0;
+  while (i < sv.size() && sv[i] == ' ')
+    ++i;
+  *present = i < sv.size() && sv[i] >= '0' && sv[i] <= '9';
+  for (; i < sv.size() && sv[i] >= '0' && sv[i] <= '9'; ++i) {
+    v = v * 10 + (uint32_t)(sv[i] - '0');
+    if (v > 100000000u)
+      break;
+  }
+  return v;
+}
+std::string_view header(bell::HTTPClient::Response& r, const char* name,
+                        const char* lower) {
+  auto v = r.header(name);
+  return v.empty() ? r.header(lower) : v;
+}
+}  // namespace
+
+HostRateLimiter& HostRateLimiter::shared() {
+  static HostRateLimiter limiter;
+  return limiter;
+}
+
+HostRateLimiter::Permit& HostRateLimiter::Permit::operator=(
+    Permit&& o) noexcept {
+  if (this != &o) {
+    if (owner_)
+      owner_->release(host_);
+    owner_ = o.owner_;
+    host_ = std::move(o.host_);
+    o.owner_ = nullptr;
+  }
+  return *this;
+}
+
+HostRateLimiter::Permit::~Permit() {
+  if (owner_)
+    owner_->release(host_);
+}
+
+std::string HostRateLimiter::hostKey(const std::string& url) {
+  auto p = url.find("://");
+  size_t start = (p == std::string::npos) ? 0 : p + 3;
+  size_t end = url.find_first_of("/?#", start);
+  std::string host = url.substr(
+      start, (end == std::string::npos) ? std::string::npos : end - start);
+  for (char& c : host)
+    c = (char)std::tolower((unsigned char)c);
+  return host;
+}
+
+uint32_t HostRateLimiter::nowMs() {
+  return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void HostRateLimiter::setLimits(const std::string& host, const Limits& limits) {
+  std::lock_guard<std::mutex> lk(mu_);
+  limits_[host] = limits;
+  auto it = hosts_.find(host);
+  if (it != hosts_.end()) {
+    it->second.limits = limits;
+    it->second.rate = std::min(it->second.rate, limits.ratePerSec);
+  }
+}
+
+HostRateLimiter::Bucket& HostRateLimiter::bucketLocked(const std::string& host,
+                                                       uint32_t now) {
+  auto it = hosts_.find(host);
+  if (it == hosts_.end()) {
+    Bucket b;
+    auto l = limits_.find(host);
+    if (l != limits_.end())
+      b.limits = l->second;
+    b.rate = b.limits.ratePerSec;
+    b.tokens = b.limits.burst;
+    b.refillAt = now;
+    it = hosts_.emplace(host, b).first;
+  }
+  Bucket& b = it->second;
+  float add = (float)(now - b.refillAt) * b.rate / 1000.0f;
+  b.tokens = std::min<float>(b.limits.burst, b.tokens + add);
+  b.refillAt = now;
+  return b;
+}
+
+HostRateLimiter::Permit HostRateLimiter::acquire(const std::string& url,
+                                                 Priority prio,
+                                                 uint32_t maxWaitMs) {
+  const std::string host = hostKey(url);
+  const uint8_t p = (uint8_t)prio;
+  const uint32_t start = nowMs();
+  bool waited = false;
+  std::unique_lock<std::mutex> lk(mu_);
+  bucketLocked(host, start).waiting[p]++;
+  for (;;) {
+    const uint32_t now = nowMs();
+    Bucket& b = bucketLocked(host, now);
+    bool outranked = false;
+    for (uint8_t q = p + 1; q < 3; ++q)
+      outranked = outranked || b.waiting[q] > 0;
+
+    uint32_t waitMs = 0;
+    if ((int32_t)(b.blockedUntil - now) > 0)
+      waitMs = b.blockedUntil - now;
+    else if (b.inFlight >= b.limits.maxConcurrent)
+      waitMs = 250;  // woken by release()
+    else if (b.tokens < 1.0f)
+      waitMs = (uint32_t)((1.0f - b.tokens) * 1000.0f / b.rate) + 1;
+    else if (outranked)
+      waitMs = 25;
+
+    if (waitMs == 0) {
+      b.tokens -= 1.0f;
+      b.inFlight++;
+      b.waiting[p]--;
+      stats_.granted++;
+      if (waited)
+        stats_.throttled++;
+      return Permit(this, host);
+    }
+    if (prio == Priority::Background || now - start + waitMs > maxWaitMs) {
+      b.waiting[p]--;
+      stats_.deferred++;
+      cv_.notify_all();  // lower priorities may have been held back by us
+      SC32_LOG(debug, "rate limit: deferred %s (wait %ums)", host.c_str(),
+               (unsigned)waitMs);
+      return Permit();
+    }
+    waited = true;
+    cv_.wait_for(lk,
+                 std::chrono::milliseconds(std::min<uint32_t>(waitMs, 250)));
+  }
+}
+
+void HostRateLimiter::release(const std::string& host) {
+  std::lock_guard<std::mutex> lk(mu_);
+  auto it = hosts_.find(host);
+  if (it != hosts_.end() && it->second.inFlight > 0)
+    it->second.inFlight--;
+  cv_.notify_all();
+}
+
+void HostRateLimiter::observe(const std::string& url,
+                              bell::HTTPClient::Response& resp) {
+  const int status = resp.status();
+  bool hasRetry = false, hasRemaining = false, hasReset = false;
+  uint32_t retry =
+      parseUint(header(resp, "Retry-After", "retry-after"), &hasRetry);
+  uint32_t remaining = parseUint(
+      header(resp, "X-RateLimit-Remaining", "x-ratelimit-remaining"),
+      &hasRemaining);
+  if (!hasRemaining)
+    remaining = parseUint(
+        header(resp, "X-Rate-Limit-Remaining", "x-rate-limit-remaining"),
+        &hasRemaining);
+  uint32_t reset =
+      parseUint(header(resp, "X-RateLimit-Reset", "x-ratelimit-reset"),
+                &hasReset);
+  if (!hasReset)
+    reset = parseUint(
+        header(resp, "X-Rate-Limit-Reset", "x-rate-limit-reset"), &hasReset);
+  // some servers send the reset as an epoch timestamp
+  if (hasReset && reset > 1000000000u) {
+    std::time_t t = std::time(nullptr);
+    reset = (t > 0 && (uint32_t)t < reset) ? reset - (uint32_t)t : 1;
+  }
+
+  const std::string host = hostKey(url);
+  const uint32_t now = nowMs();
+  std::lock_guard<std::mutex> lk(mu_);
+  Bucket& b = bucketLocked(host, now);
+  uint32_t blockSec = 0;
+  if (hasRetry)
+    blockSec = std::max<uint32_t>(retry, 1);
+  else if (hasRemaining && remaining == 0)
+    blockSec = std::max<uint32_t>(reset, 1);
+  else if (hasRemaining && hasReset && reset > 0) {
+    // spread what is left of the window evenly over it
+    float r = std::max(kMinRate, std::min(b.limits.ratePerSec,
+                                          (float)remaining / (float)reset));
+    if (r != b.rate) {
+      b.rate = r;
+      stats_.learned++;
+    }
+  }
+
+  if (status == 429 || status == 503) {
+    b.rate = std::max(kMinRate, b.rate / 2);
+    b.tokens = 0;
+    if (blockSec == 0)
+      blockSec = 1;
+  } else if (status >= 200 && status < 400 && !hasRemaining &&
+             b.rate < b.limits.ratePerSec) {
+    b.rate = std::min(b.limits.ratePerSec, b.rate + kMinRate);
+  }
+  if (blockSec > 0) {
+    blockSec = std::min(blockSec, kMaxBlockSec);
+    b.blockedUntil = now + blockSec * 1000u;
+    stats_.learned++;
+    SC32_LOG(info, "rate limit: %s backs off for %us (status %d)",
+             host.c_str(), (unsigned)blockSec, status);
+  }
+}
+
+HostRateLimiter::Stats HostRateLimiter::stats() {
+  std::lock_guard<std::mutex> lk(mu_);
+  return stats_;
+}
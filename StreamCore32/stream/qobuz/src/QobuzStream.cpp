@@ -7,6 +7,7 @@
 #include <string>
 #include <vector>
 #include "HTTPClient.h"
+#include "HostRateLimiter.h"
 #include "QobuzSign.h"
 #include "TLSSocket.h"
 #include "URLParser.h"
@@ -241,9 +242,15 @@ std::unique_ptr<bell::HTTPClient::Response> QobuzStream::qobuzGet(
       url += "&request_sig=" + sig;
     }
   }
+  // pacing only: callers always expect a response
+  auto permit = HostRateLimiter::shared().acquire(url);
   std::unique_ptr<bell::HTTPClient::Response> qobuzResponse =
       std::make_unique<bell::HTTPClient::Response>();
   qobuzResponse->get(url, headers, false);
+  HostRateLimiter::shared().observe(url, *qobuzResponse);
+  // the connection stays open until the body is read, keep the slot for it;
+  // callers get the buffered body
+  qobuzResponse->body();
   return qobuzResponse;
 }
 std::unique_ptr<bell::HTTPClient::Response> QobuzStream::qobuzPost(
@@ -271,9 +278,12 @@ std::unique_ptr<bell::HTTPClient::Response> QobuzStream::qobuzPost(
     body_ = std::vector<uint8_t>(temp.begin(), temp.end());
   }
   std::string body_str = std::string(body_.begin(), body_.end());
+  auto permit = HostRateLimiter::shared().acquire(url);
   std::unique_ptr<bell::HTTPClient::Response> qobuzResponse =
       std::make_unique<bell::HTTPClient::Response>();
   qobuzResponse->post(url, headers, body_);
+  HostRateLimiter::shared().observe(url, *qobuzResponse);
+  qobuzResponse->body();  // read under the permit, as in qobuzGet
   return qobuzResponse;
 }
 
@@ -1,16 +1,38 @@
 #pragma once
 
-#include <atomic>      // or std::atomic
-#include <functional>  // for function
-#include <memory>      // for shared_ptr
-#include <string>      // for string
+#include <atomic>              // or std::atomic
+#include <condition_variable>  // for condition_variable
+#include <cstdint>             // for uint32_t
+#include <functional>          // for function
+#include <memory>              // for shared_ptr
+#include <mutex>               // for mutex
+#include <string>              // for string
+
+#include "BellTask.h"  // for Task
 
 namespace spotify {
 struct Context;
 
-class AccessKeyFetcher {
+/**
+ * @brief Holds the login5 access token and renews it ahead of expiry.
+ *
+ * A task refreshes the token once REFRESH_PERCENT of its lifetime has
+ * passed, so storage-resolve and the other token users find a valid one
+ * and do not wait on an HTTPS round trip. Concurrent refreshes collapse
+ * into one, later callers wait for the request already in flight.
+ */
+class AccessKeyFetcher : public bell::Task {
  public:
+  struct Stats {
+    uint32_t refreshes = 0;      // tokens received
+    uint32_t failures = 0;       // refreshes that ended without a token
+    uint32_t waits = 0;          // getAccessKey() calls that had to wait
+    uint32_t lastLatencyMs = 0;  // duration of the last refresh
+    uint32_t maxLatencyMs = 0;
+  };
+
   AccessKeyFetcher(std::shared_ptr<spotify::Context> ctx);
+  ~AccessKeyFetcher();
 
   /**
   * @brief Checks if key is expired
@@ -20,21 +42,41 @@ class AccessKeyFetcher {
 
   /**
   * @brief Fetches a new access key
-  * @remark In case the key is expired, this function blocks until a refresh is done.
+  * @remark Blocks only when no valid key is held, until a refresh is done.
   * @returns access key
   */
   std::string getAccessKey();
 
   /**
-  * @brief Forces a refresh of the access key
+  * @brief Forces a refresh of the access key, or waits for the one in flight
   */
   void updateAccessKey();
 
+  Stats stats();
+
  private:
+  // Share of the token lifetime after which it is renewed
+  const int REFRESH_PERCENT = 50;
+  // Treated as expired this long before the service says
+  const int EXPIRY_MARGIN_MS = 60 * 1000;
+  // Delay before trying again after a failed refresh
+  const int RETRY_MS = 30 * 1000;
+
   std::shared_ptr<spotify::Context> ctx;
 
-  std::atomic<bool> keyPending = false;
+  std::mutex keyMutex;
+  std::condition_variable keyChanged;
+  bool keyPending = false;
   std::string accessKey;
-  long long int expiresAt;
+  long long int expiresAt = 0;
+  long long int refreshAt = 0;
+  Stats counters;
+
+  std::atomic<bool> wantStop = false;
+  std::atomic<bool> isRunning = false;
+
+  bool expiredLocked();
+  bool fetchAccessKey(std::string* key, int* expiresIn);
+  void runTask() override;
 };
 }  // namespace spotify
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>  // for size_t
+#include <cstdint>  // for uint8_t, uint64_t
+#include <vector>   // for vector
+
+#include "mbedtls/aes.h"  // for mbedtls_aes_context
+
+namespace spotify {
+
+/**
+ * @brief AES-CTR keystream over a whole file, addressed by byte offset.
+ *
+ * The key schedule is set up once and the 128-bit counter lives in place:
+ * sequential calls just continue the keystream, a jump to another offset is
+ * a fixed-width add onto the IV. Goes through mbedtls, which uses the AES
+ * peripheral on ESP32 when CONFIG_MBEDTLS_HARDWARE_AES is set.
+ */
+class AesCtr {
+ public:
+  AesCtr(const std::vector<uint8_t>& key, const uint8_t (&iv)[16]);
+  ~AesCtr();
+  AesCtr(const AesCtr&) = delete;
+  AesCtr& operator=(const AesCtr&) = delete;
+
+  /**
+   * @brief False when the key is not 128, 192 or 256 bits long
+   */
+  bool valid() const { return keyValid; }
+
+  /**
+   * @brief En- or decrypts nbytes at file offset pos in place
+   */
+  void xcrypt(uint8_t* buffer, size_t nbytes, size_t pos);
+
+ private:
+  mbedtls_aes_context aes;
+  uint8_t iv[16];
+  uint8_t counter[16];
+  uint8_t streamBlock[16];
+  size_t blockOffset = 0;
+  size_t position = 0;
+  bool keyValid = false;
+
+  void seek(size_t pos);
+};
+}  // namespace spotify
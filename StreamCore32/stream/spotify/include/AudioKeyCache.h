@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstddef>        // for size_t
+#include <cstdint>        // for uint8_t, uint32_t
+#include <list>           // for list
+#include <memory>         // for shared_ptr
+#include <mutex>          // for mutex, scoped_lock
+#include <string>         // for string
+#include <unordered_map>  // for unordered_map
+#include <utility>        // for pair
+#include <vector>         // for vector
+
+#include "StreamCoreFile.h"  // for StreamCoreFile, Record
+
+namespace spotify {
+
+/**
+ * @brief Keeps audio keys by (track gid, file id), so replays skip the key
+ * request.
+ *
+ * Keys do not change for a given file, so a track heard before goes from
+ * KEY_REQUIRED straight to CDN_REQUIRED. Bounded by entry count, least
+ * recently used first. With a store (the target passes an AES-GCM
+ * SecureStore) the keys survive reboots. The store shares the small NVS
+ * partition with the credentials, so the record is a single field of packed
+ * gid | file id | key entries, ENTRY_SIZE bytes each, least recently used
+ * first; DEFAULT_CAPACITY of them stay within one NVS page once encoded.
+ */
+class AudioKeyCache {
+ public:
+  struct Stats {
+    uint32_t fetchesAvoided = 0;  // key requests answered from the cache
+    uint32_t fetches = 0;         // key requests that went to the AP
+    uint32_t evictions = 0;
+    uint32_t entries = 0;
+  };
+
+  static const size_t DEFAULT_CAPACITY = 32;
+
+  static AudioKeyCache& shared();
+
+  /**
+   * @brief Persists keys to store, loading what is there already.
+   */
+  void open(std::shared_ptr<StreamCoreFile> store,
+            size_t capacity = DEFAULT_CAPACITY) {
+    std::scoped_lock lock(cacheMutex);
+    this->keyStore = store;
+    this->capacity = capacity;
+    loadLocked();
+  }
+
+  bool load(const std::vector<uint8_t>& gid, const std::vector<uint8_t>& fileId,
+            std::vector<uint8_t>* key);
+  void store(const std::vector<uint8_t>& gid, const std::vector<uint8_t>& fileId,
+             const std::vector<uint8_t>& key);
+
+  /**
+   * @brief Drops a key the CDN data did not decrypt with.
+   */
+  void invalidate(const std::vector<uint8_t>& gid,
+                  const std::vector<uint8_t>& fileId);
+
+  /**
+   * @brief Writes new keys back once SAVE_EVERY of them piled up.
+   */
+  void flush(bool force = false);
+
+  Stats stats();
+
+ private:
+  // Record holding every key, and its only field
+  static constexpr const char* RECORD = "audio_keys";
+  static constexpr const char* FIELD = "k";
+  static const size_t GID_SIZE = 16;
+  static const size_t FILE_ID_SIZE = 20;
+  static const size_t KEY_SIZE = 16;
+  static const size_t ENTRY_SIZE = GID_SIZE + FILE_ID_SIZE + KEY_SIZE;
+  // New keys between two writes of the record
+  static const int SAVE_EVERY = 4;
+
+  // Raw gid and file id bytes -> key
+  typedef std::pair<std::string, std::vector<uint8_t>> Item;
+
+  std::mutex cacheMutex;
+  std::shared_ptr<StreamCoreFile> keyStore;
+  size_t capacity = DEFAULT_CAPACITY;
+  std::list<Item> lru;  // most recently used first
+  std::unordered_map<std::string, std::list<Item>::iterator> index;
+  int unsaved = 0;
+  Stats counters;
+
+  static std::string keyOf(const std::vector<uint8_t>& gid,
+                           const std::vector<uint8_t>& fileId);
+  void insertLocked(const std::string& name, const std::vector<uint8_t>& key);
+  void loadLocked();
+  void saveLocked();
+};
+}  // namespace spotify
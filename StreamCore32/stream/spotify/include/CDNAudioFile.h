@@ -2,12 +2,14 @@
 
 #include <cstddef>  // for size_t
 #include <cstdint>  // for uint8_t
+#include <map>      // for map
 #include <memory>   // for shared_ptr, unique_ptr
 #include <string>   // for string
 #include <vector>   // for vector
 
-#include "Crypto.h"      // for Crypto
-#include "HTTPClient.h"  // for HTTPClient
+#include "AesCtr.h"        // for AesCtr
+#include "CDNReadAhead.h"  // for CDNReadAhead
+#include "HTTPClient.h"    // for HTTPClient
 
 namespace bell {
 class WrappedSemaphore;
@@ -19,13 +21,21 @@ class AccessKeyFetcher;
 class CDNAudioFile {
 
  public:
-  CDNAudioFile(const std::string& cdnUrl, const std::vector<uint8_t>& audioKey);
+  /**
+    * @param fileId keys the header cache, may be empty
+    */
+  CDNAudioFile(const std::string& cdnUrl, const std::vector<uint8_t>& audioKey,
+               const std::vector<uint8_t>& fileId = {});
+  ~CDNAudioFile();
 
 #ifndef CONFIG_BELL_NOCODEC
   /**
-    * @brief Opens connection to the provided cdn url, and fetches track metadata.
+    * @brief Opens connection to the provided cdn url, fetches track metadata
+    * (or takes it from OggHeaderCache) and starts reading ahead.
+    *
+    * @returns false when the header or footer could not be fetched
     */
-  void openStream();
+  bool openStream();
 
   /**
     * @brief Read and decrypt part of the cdn stream
@@ -56,6 +66,17 @@ class CDNAudioFile {
     */
   long readBytes(uint8_t* dst, size_t bytes);
 
+  /**
+    * @brief Moves to the start of the Ogg page where playback of ms begins,
+    * searching the file with range requests where the index has gaps
+    *
+    * @param ms wanted position
+    * @param landedMs position playback will actually resume at
+    *
+    * @returns false when the stream could not be searched
+    */
+  bool seekMs(uint32_t ms, uint32_t* landedMs);
+
 #endif
   /**
     * @brief Returns current position in CDN stream
@@ -82,21 +103,28 @@ class CDNAudioFile {
   const int SEEK_MARGIN_SIZE = 1024 * 4;
 
   const int HTTP_BUFFER_SIZE = 1024 * 12;
+  // Read-ahead windows start at this size and share the memory cap
+  const int READ_AHEAD_MIN_WINDOW = 1024 * 8;
+  const int READ_AHEAD_MEMORY = 1024 * 64;
   const int SPOTIFY_OPUS_HEADER = 167;
   std::unique_ptr<bell::HTTPClient::Response> response;
 #ifndef CONFIG_BELL_NOCODEC
   // Used to store opus metadata, speeds up read
   std::vector<uint8_t> header = std::vector<uint8_t>(OPUS_HEADER_SIZE);
   std::vector<uint8_t> footer;
-#endif
+#else
   // General purpose buffer to read data
   std::vector<uint8_t> httpBuffer = std::vector<uint8_t>(HTTP_BUFFER_SIZE);
+#endif
 
   // AES IV for decrypting the audio stream
-  const std::vector<uint8_t> audioAESIV = {0x72, 0xe0, 0x67, 0xfb, 0xdd, 0xcb,
-                                           0xcf, 0x77, 0xeb, 0xe8, 0xbc, 0x64,
-                                           0x3f, 0x63, 0x0d, 0x93};
-  std::unique_ptr<Crypto> crypto;
+  static constexpr uint8_t audioAESIV[16] = {0x72, 0xe0, 0x67, 0xfb,
+                                              0xdd, 0xcb, 0xcf, 0x77,
+                                              0xeb, 0xe8, 0xbc, 0x64,
+                                              0x3f, 0x63, 0x0d, 0x93};
+  std::unique_ptr<AesCtr> cipher;
+  size_t decryptBytes = 0;
+  uint64_t decryptUs = 0;
 
   size_t position = 0;
   size_t totalFileSize = 0;
@@ -107,7 +135,58 @@ class CDNAudioFile {
 
   std::string cdnUrl;
   std::vector<uint8_t> audioKey;
+  std::vector<uint8_t> fileId;
 
   void decrypt(uint8_t* dst, size_t nbytes, size_t pos);
+
+  /**
+    * @brief Switches to the next cached url of the file on 403/404
+    *
+    * @returns true when the request should be repeated
+    */
+  bool failover(int status);
+
+  /**
+    * @brief Replaces the response with an open-ended range from pos
+    *
+    * @returns false when no url of the file answered with a 2xx
+    */
+  bool openRange(size_t pos);
+  uint32_t requestCount = 0;
+
+#ifndef CONFIG_BELL_NOCODEC
+  // Open-ended range the read-ahead keeps streaming from
+  size_t streamPosition = 0;
+  size_t bytesFetched = 0;
+  uint32_t fetchMs = 0;
+  // Header and footer came from the network, store them on close
+  bool cacheHeaders = false;
+
+  // Fetches audio between header and footer, destroyed first
+  std::unique_ptr<CDNReadAhead> readAhead;
+  bool fetchHeaders(size_t* footerStart);
+  size_t fetchWindow(size_t pos, size_t len, uint8_t* out);
+#else
+  const int SEEK_INDEX_SPACING = 1024 * 32;
+  const size_t SEEK_INDEX_MAX = 256;
+  const int SEEK_MAX_PROBES = 12;
+
+  struct OggPage {
+    size_t offset;
+    size_t size;
+    int64_t granule;  // -1 when no packet ends on the page
+  };
+
+  // File offset -> granule position of pages seen so far, sparse
+  std::map<size_t, int64_t> seekIndex;
+  uint32_t sampleRate = 0;
+  uint32_t streamSerial = 0;
+  size_t audioStart = 0;
+
+  std::vector<OggPage> scanPages(const uint8_t* data, size_t len,
+                                 size_t offset);
+  void indexPages(const std::vector<OggPage>& pages);
+  bool probePages(size_t from, std::vector<OggPage>* pages);
+#endif
 };
 }  // namespace spotify
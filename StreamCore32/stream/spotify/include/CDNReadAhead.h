@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>              // for atomic
+#include <chrono>              // for steady_clock
+#include <condition_variable>  // for condition_variable
+#include <cstddef>             // for size_t
+#include <cstdint>             // for uint8_t, uint32_t
+#include <functional>          // for function
+#include <mutex>               // for mutex
+#include <vector>              // for vector
+
+#include "BellTask.h"  // for Task
+
+namespace spotify {
+
+/**
+ * @brief Keeps a few range windows of a CDN file in flight ahead of the
+ * decoder.
+ *
+ * A worker task fills windows sequentially from the last read position.
+ * Windows arrive already decrypted, so read() is a plain copy unless the
+ * decoder catches up with the network. Moving outside the planned range
+ * (a seek) drops every window; a fetch still in flight is discarded when it
+ * lands.
+ *
+ * Window size follows the link: it starts small after every (re)start so the
+ * first audio lands quickly, then doubles per window while playback stays
+ * sequential, bounded by what the measured throughput delivers within
+ * MAX_FETCH_MS and by the memory given to the constructor.
+ */
+class CDNReadAhead : public bell::Task {
+ public:
+  /**
+   * @brief Fetches and decrypts [pos, pos + len) of the file into out.
+   * @returns number of bytes stored, 0 on failure
+   */
+  typedef std::function<size_t(size_t pos, size_t len, uint8_t* out)> Fetch;
+
+  struct Stats {
+    uint32_t windows = 0;    // windows fetched
+    uint32_t cancelled = 0;  // windows dropped by a seek
+    uint32_t stalls = 0;     // reads that had to wait for the network
+    uint32_t stallMs = 0;    // total time spent waiting in read()
+    uint32_t busyMs = 0;     // time spent inside fetch
+    uint32_t uptimeMs = 0;   // time since the worker started
+    size_t peakWindow = 0;   // largest window fetched
+    size_t avgAhead = 0;     // mean bytes buffered past each read
+  };
+
+  static const int WINDOW_COUNT = 2;
+  // Longest a single window should take to arrive
+  static const uint32_t MAX_FETCH_MS = 1000;
+
+  /**
+   * @param fetch called from the worker task
+   * @param minWindow smallest range request, multiple of 16
+   * @param memory cap for all windows together
+   * @param start file offset of the first window
+   * @param end file offset where read-ahead stops
+   */
+  CDNReadAhead(Fetch fetch, size_t minWindow, size_t memory, size_t start,
+               size_t end);
+  ~CDNReadAhead();
+
+  /**
+   * @brief Copies file data at pos, waiting for it when it is not here yet.
+   *
+   * @returns bytes copied, at most up to the end of one window; 0 when the
+   * window could not be fetched
+   */
+  size_t read(size_t pos, uint8_t* dst, size_t bytes);
+
+  /**
+   * @brief Drops all windows and continues reading ahead from pos.
+   */
+  void restart(size_t pos);
+
+  /**
+   * @brief True when pos is buffered or already being fetched.
+   */
+  bool covers(size_t pos);
+
+  Stats stats();
+
+ private:
+  enum class WindowState { EMPTY, LOADING, READY, FAILED };
+
+  struct Window {
+    std::vector<uint8_t> data;
+    size_t pos = 0;
+    size_t len = 0;
+    uint32_t generation = 0;
+    WindowState state = WindowState::EMPTY;
+  };
+
+  Fetch fetch;
+  size_t minWindow;
+  size_t maxWindow;
+  size_t windowSize;        // size of the next window
+  float bytesPerMs = 0;     // smoothed fetch throughput
+  size_t end;
+  std::chrono::steady_clock::time_point startedAt;
+
+  std::mutex dataMutex;
+  std::condition_variable dataReady;
+  Window windows[WINDOW_COUNT];
+  size_t nextPosition = 0;  // start of the next window to fetch
+  size_t readPosition = 0;  // last position handed to read()
+  uint32_t generation = 0;  // bumped on every restart()
+  Stats counters;
+  uint64_t aheadSum = 0;
+  uint32_t aheadSamples = 0;
+
+  std::atomic<bool> wantStop = false;
+  std::atomic<bool> isRunning = false;
+
+  Window* findLocked(size_t pos);
+  size_t bufferedLocked(size_t pos);
+  void restartLocked(size_t pos);
+  void resizeLocked(size_t got, uint32_t ms);
+  void runTask() override;
+};
+}  // namespace spotify
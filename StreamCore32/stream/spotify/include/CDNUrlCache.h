@@ -0,0 +1,94 @@
+#pragma once
+
+#include <chrono>   // for steady_clock
+#include <cstddef>  // for size_t
+#include <cstdint>  // for uint8_t, uint32_t
+#include <map>      // for map
+#include <mutex>    // for mutex
+#include <string>   // for string
+#include <utility>  // for pair
+#include <vector>   // for vector
+
+namespace spotify {
+
+/**
+ * @brief Keeps storage-resolve answers by file id until their urls expire.
+ *
+ * A file resolved minutes ago, a replay or a track queued twice, reuses the
+ * urls instead of another storage-resolve call. Each url carries its own
+ * expiry, taken from its token when the clock is set, else from the ttl of
+ * the answer. TrackQueue renews entries of queued tracks in the background
+ * once they get close to expiring, and CDNAudioFile moves on to the next url
+ * when the CDN answers 403/404.
+ */
+class CDNUrlCache {
+ public:
+  struct Stats {
+    uint32_t resolves = 0;   // storage-resolve calls answered
+    uint32_t reused = 0;     // storage-resolve calls avoided
+    uint32_t refreshes = 0;  // resolves made ahead of expiry
+    uint32_t failovers = 0;  // urls dropped after a 403/404
+    uint32_t resolvesPerHour = 0;
+  };
+
+  // A url handed out must outlive a track
+  static constexpr uint32_t MIN_VALID_S = 10 * 60;
+  // Entries with less left than this are renewed while the queue is idle
+  static constexpr uint32_t REFRESH_BEFORE_S = 20 * 60;
+  static constexpr uint32_t REFRESH_RETRY_S = 60;
+  // When neither the url nor the answer says
+  static constexpr uint32_t DEFAULT_TTL_S = 30 * 60;
+  static constexpr size_t MAX_ENTRIES = 32;
+
+  static CDNUrlCache& shared();
+
+  /**
+   * @param ttlS ttl of the storage-resolve answer, 0 if it had none
+   */
+  void store(const std::vector<uint8_t>& fileId,
+             const std::vector<std::string>& urls, uint32_t ttlS,
+             bool refresh = false);
+
+  /**
+   * @brief First url of fileId valid for at least MIN_VALID_S.
+   */
+  bool load(const std::vector<uint8_t>& fileId, std::string* url);
+
+  /**
+   * @brief True when fileId is cached, runs out within REFRESH_BEFORE_S and
+   * was not claimed in the last REFRESH_RETRY_S.
+   */
+  bool claimRefresh(const std::vector<uint8_t>& fileId);
+
+  /**
+   * @brief Drops failedUrl and hands out the next valid url, if any.
+   */
+  bool failover(const std::vector<uint8_t>& fileId,
+                const std::string& failedUrl, std::string* next);
+
+  void noteReused();
+  Stats stats();
+
+  /**
+   * @brief Reads the expiry out of the token of url.
+   * @returns false when url has none or the clock is not set
+   */
+  static bool secondsLeft(const std::string& url, uint32_t* left);
+
+ private:
+  typedef std::chrono::steady_clock::time_point TimePoint;
+
+  struct Entry {
+    std::vector<std::pair<std::string, TimePoint>> urls;  // in CDN order
+    TimePoint lastUsed;
+    TimePoint refreshClaimed;
+  };
+
+  std::mutex cacheMutex;
+  std::map<std::string, Entry> entries;
+  TimePoint firstResolve;
+  Stats counters;
+
+  void evictLocked();
+};
+}  // namespace spotify
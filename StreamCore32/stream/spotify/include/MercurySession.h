@@ -1,7 +1,6 @@
 #pragma once
 
 #include <atomic>  // for atomic
-#include <condition_variable>
 #include <cstdint>  // for uint8_t, uint64_t, uint32_t
 #include <deque>
 #include <functional>     // for function
@@ -14,7 +13,9 @@
 
 #include "BellTask.h"             // for Task
 #include "Packet.h"               // for Packet
+#include "PacketQueue.h"          // for PacketQueue
 #include "Session.h"              // for Session
+#include "TimeoutWheel.h"         // for TimeoutWheel
 #include "protobuf/mercury.pb.h"  // for Header
 
 namespace bell {
@@ -30,14 +31,21 @@ class MercurySession : public bell::Task, public spotify::Session {
   ~MercurySession();
   typedef std::vector<std::vector<uint8_t>> DataParts;
 
+  enum class ResponseError : uint8_t {
+    NONE,
+    FAILED,   // rejected, malformed or the connection was lost
+    TIMEOUT,  // no answer before the deadline, retries included
+  };
+
   struct Response {
     Header mercuryHeader = Header_init_default;
     DataParts parts;
     uint64_t sequenceId;
     bool fail = true;
+    ResponseError error = ResponseError::FAILED;
   };
   typedef std::function<void(const Response)> ResponseCallback;
-  typedef std::function<void(bool, const std::vector<uint8_t>&)>
+  typedef std::function<void(ResponseError, const std::vector<uint8_t>&)>
       AudioKeyCallback;
   typedef std::function<void()> ConnectionEstabilishedCallback;
 
@@ -73,12 +81,37 @@ class MercurySession : public bell::Task, public spotify::Session {
 
   void handlePacket();
 
+  spotify::PacketQueue::Stats dispatchStats() {
+    return this->packetQueue.stats();
+  }
+
+  struct DecodeStats {
+    uint32_t frames = 0;         // frames decoded
+    uint32_t partialFrames = 0;  // frames continuing an earlier one
+    uint32_t copiedBytes = 0;    // payload copied out of packet buffers
+    uint32_t adoptedBytes = 0;   // payload left in its packet buffer
+    uint32_t avgDecodeUs = 0;
+  };
+
+  DecodeStats decodeStats();
+
+  struct TimeoutStats {
+    uint32_t timeouts = 0;          // requests failed with TIMEOUT
+    uint32_t retries = 0;           // requests sent again after a deadline
+    uint32_t lateResponses = 0;     // answers to requests already timed out
+    uint32_t audioKeyTimeouts = 0;  // audio key requests failed with TIMEOUT
+    uint32_t pending = 0;           // deadlines armed
+  };
+
+  TimeoutStats timeoutStats();
+
   void addSubscriptionListener(const std::string& uri,
                                ResponseCallback subscription);
 
   uint64_t executeSubscription(RequestType type, const std::string& uri,
                                ResponseCallback callback,
-                               ResponseCallback subscription, DataParts& parts);
+                               ResponseCallback subscription, DataParts& parts,
+                               const char* contentType = nullptr);
   uint64_t executeSubscription(RequestType type, const std::string& uri,
                                ResponseCallback callback,
                                ResponseCallback subscription) {
@@ -96,6 +129,13 @@ class MercurySession : public bell::Task, public spotify::Session {
     return this->executeSubscription(type, uri, callback, nullptr, parts);
   }
 
+  uint64_t execute(RequestType type, const std::string& uri,
+                   ResponseCallback callback, DataParts& parts,
+                   const char* contentType) {
+    return this->executeSubscription(type, uri, callback, nullptr, parts,
+                                     contentType);
+  }
+
   void unregister(uint64_t sequenceId);
 
   void unregisterAudioKey(uint32_t sequenceId);
@@ -116,20 +156,50 @@ class MercurySession : public bell::Task, public spotify::Session {
 
  private:
   const int PING_TIMEOUT_MS = 2 * 60 * 1000 + 5000;
+  // Dispatch latency is logged once per this many packets
+  const uint32_t DISPATCH_LOG_EVERY = 256;
+  // TrackQueue retries failed audio keys itself, so there is no retry here
+  const uint32_t AUDIO_KEY_TIMEOUT_MS = 4000;
+  // Ids of expired requests remembered to tell late answers from unknown ones
+  const size_t EXPIRED_HISTORY = 16;
 
   std::shared_ptr<spotify::TimeProvider> timeProvider;
   Header tempMercuryHeader = {};
   ConnectionEstabilishedCallback connectionReadyCallback = nullptr;
 
-  std::deque<spotify::Packet> packetQueue;
+  // Filled by the session task, drained by handlePacket()
+  spotify::PacketQueue packetQueue;
 
   void runTask() override;
-  std::unordered_map<uint16_t, ResponseCallback> callbacks;
+  struct PendingRequest {
+    ResponseCallback callback;
+    std::string uri;
+    uint8_t command;
+    std::vector<uint8_t> packet;  // kept while retries are left
+    uint8_t retriesLeft = 0;
+    uint32_t timeoutMs = 0;
+  };
+
+  std::unordered_map<uint16_t, PendingRequest> callbacks;
   std::deque<Response> partials;
+  struct {
+    std::atomic<uint32_t> frames = 0;
+    std::atomic<uint32_t> partialFrames = 0;
+    std::atomic<uint32_t> copiedBytes = 0;
+    std::atomic<uint32_t> adoptedBytes = 0;
+    std::atomic<uint64_t> decodeUs = 0;
+  } decodeCounters;
   std::unordered_map<std::string, ResponseCallback> subscriptions;
   std::unordered_map<uint32_t, AudioKeyCallback> audioKeyCallbacks;
   std::shared_ptr<bell::WrappedSemaphore> responseSemaphore;
 
+  // Deadlines, advanced by handlePacket()
+  spotify::TimeoutWheel requestTimeouts;
+  spotify::TimeoutWheel audioKeyTimeouts;
+  std::deque<uint16_t> expiredRequests;
+  std::deque<uint32_t> expiredAudioKeys;
+  TimeoutStats timeoutCounters;
+
   uint16_t sequenceId = 1;
   uint32_t audioKeySequence = 1;
 
@@ -137,19 +207,25 @@ class MercurySession : public bell::Task, public spotify::Session {
   unsigned long long lastPingTimestamp = -1;
   std::string countryCode = "";
 
-  std::mutex queueMutex;
   std::mutex callbackMutex;
   std::mutex isRunningMutex;
-  std::condition_variable queueCV;  // For synchronization with waits
   std::atomic<bool> isRunning = false;
   std::atomic<bool> executeEstabilishedCallback = false;
   std::atomic<bool> connection_lost = false;
 
   void failAllPending();
+  void expireRequests();
+  void noteLateLocked(uint16_t sequenceId);
 
   void handleReconnection();
   bool processPackets();
-  MercurySession::Response decodeResponse(const std::vector<uint8_t>& data);
+  /**
+   * @brief Decodes a SEND/SUB/UNSUB/SUBRES frame, merging it into the
+   * response it continues.
+   * @remark May take over the buffer of data for the last part.
+   * @returns the completed response, fail is set while frames are missing
+   */
+  MercurySession::Response decodeResponse(std::vector<uint8_t>& data);
   std::vector<uint8_t> prepareSequenceIdPayload(
       uint64_t sequenceId, const std::vector<uint8_t>& headerBytes,
       const DataParts& payload);
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>     // for uint32_t, uint64_t
+#include <functional>  // for function
+#include <map>         // for map
+#include <memory>      // for shared_ptr
+#include <mutex>       // for mutex
+#include <set>         // for set
+#include <string>      // for string
+#include <vector>      // for vector
+
+namespace spotify {
+class MercurySession;
+
+/**
+ * @brief Collects metadata lookups and sends them as Mercury multi-gets.
+ *
+ * TrackQueue queues a lookup per track while it walks the preloaded tracks
+ * and flushes once per pass, so a freshly loaded context costs one round
+ * trip per MAX_BATCH tracks instead of one per track. The same uri asked for
+ * twice shares a request. Entries the batch reply does not answer, and every
+ * lookup once the AP rejected a batch, go out as plain GETs.
+ */
+class MetadataBatcher {
+ public:
+  typedef std::function<void(bool success, const std::vector<uint8_t>& data)>
+      Callback;
+
+  struct Stats {
+    uint32_t lookups = 0;       // distinct uris requested
+    uint32_t roundTrips = 0;    // Mercury requests sent
+    uint32_t deduplicated = 0;  // lookups served by a request already queued
+    uint32_t fallbacks = 0;     // single GETs after a batch left them out
+  };
+
+  static const size_t MAX_BATCH = 32;
+
+  MetadataBatcher(std::shared_ptr<MercurySession> session);
+  ~MetadataBatcher();
+
+  /**
+   * @brief Queues a lookup of a hm://metadata/3/track|episode/... uri.
+   * @returns id to cancel() the callback with
+   */
+  uint32_t request(const std::string& uri, Callback callback);
+  void cancel(uint32_t id);
+
+  /**
+   * @brief Sends everything queued since the last flush.
+   */
+  void flush();
+
+  Stats stats();
+
+ private:
+  struct Waiter {
+    uint32_t id;
+    Callback callback;
+  };
+
+  std::shared_ptr<MercurySession> session;
+  std::mutex batchMutex;
+  std::map<std::string, std::vector<Waiter>> queued;
+  std::map<std::string, std::vector<Waiter>> inFlight;
+  std::set<uint64_t> pendingRequests;  // Mercury sequence ids
+  // Answered before execute() returned their id, see trackRequest()
+  std::set<uint64_t> answeredEarly;
+  uint32_t nextId = 1;
+  bool batchingRejected = false;
+  Stats counters;
+
+  void sendSingle(const std::string& uri);
+  void sendBatch(const std::string& batchUri,
+                 const std::vector<std::string>& uris);
+  void deliver(const std::string& uri, bool success,
+               const std::vector<uint8_t>& data);
+  void trackRequest(uint64_t sequenceId);
+  void finishRequest(uint64_t sequenceId);
+};
+}  // namespace spotify
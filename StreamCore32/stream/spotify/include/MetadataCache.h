@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstddef>        // for size_t
+#include <cstdint>        // for uint8_t, uint32_t
+#include <list>           // for list
+#include <mutex>          // for mutex
+#include <string>         // for string
+#include <unordered_map>  // for unordered_map
+#include <utility>        // for pair
+#include <vector>         // for vector
+
+#include "protobuf/metadata.pb.h"  // for Track, Episode
+
+namespace spotify {
+
+/**
+ * @brief Keeps the parts of Track/Episode metadata playback needs, by gid.
+ *
+ * A QueuedTrack that finds its gid here skips the Mercury lookup and the
+ * protobuf decode. Country lists are cut down to the account's country when
+ * the entry is made, the full lists would fill the budget with a handful of
+ * tracks; an entry made for another country is a miss. invalidate() drops an
+ * entry the service no longer agrees with. Bounded by a byte budget, least
+ * recently used first. Memory only until open() names a directory on flash,
+ * which flush() writes from the track queue task, never from a Mercury
+ * callback.
+ */
+class MetadataCache {
+ public:
+  struct Restriction {
+    bool allowed;  // countries lists where playing is allowed, else forbidden
+    std::string countries;  // the entry's country when listed, else empty
+  };
+
+  // The track itself or one of its alternatives
+  struct Candidate {
+    std::vector<uint8_t> gid;
+    std::vector<Restriction> restrictions;
+    std::vector<std::pair<uint8_t, std::vector<uint8_t>>> files;  // format, id
+  };
+
+  struct Entry {
+    bool episode = false;
+    std::string country;  // restrictions were reduced to this one
+    std::string name, artist, album, imageUrl;
+    uint32_t duration = 0, number = 0, discNumber = 0;
+    std::vector<Candidate> candidates;  // alternatives after the track
+  };
+
+  struct Stats {
+    uint32_t hits = 0;
+    uint32_t misses = 0;
+    uint32_t evictions = 0;
+    uint32_t entries = 0;
+    size_t bytes = 0;
+  };
+
+  static const size_t DEFAULT_BUDGET = 24 * 1024;
+
+  static MetadataCache& shared();
+
+  /**
+   * @brief Persists entries to dir/metadata, loading what is there already.
+   */
+  bool open(const std::string& dir, size_t budget = DEFAULT_BUDGET);
+
+  bool load(const std::vector<uint8_t>& gid, const std::string& country,
+            Entry* out);
+  void store(const std::vector<uint8_t>& gid, const Entry& entry);
+
+  /**
+   * @brief Drops gid, or everything when gid is empty.
+   */
+  void invalidate(const std::vector<uint8_t>& gid = {});
+
+  /**
+   * @brief Writes the file once SAVE_EVERY changes piled up. Blocks on flash.
+   */
+  void flush(bool force = false);
+
+  Stats stats();
+
+  static Entry fromTrack(const Track& track, const std::string& country);
+  static Entry fromEpisode(const Episode& episode,
+                           const std::string& country);
+
+  /**
+   * @brief Same rules as the service: the first list present decides.
+   */
+  static bool isRestricted(const Candidate& candidate, const char* country);
+
+ private:
+  // Stores between two writes of the file
+  static const int SAVE_EVERY = 8;
+
+  typedef std::pair<std::string, Entry> Item;
+
+  std::mutex cacheMutex;
+  std::string path;
+  size_t budget = DEFAULT_BUDGET;
+  std::list<Item> lru;  // most recently used first
+  std::unordered_map<std::string, std::list<Item>::iterator> index;
+  int unsaved = 0;
+  Stats counters;
+
+  static size_t sizeOf(const Entry& entry);
+  void insertLocked(const std::string& key, const Entry& entry);
+  void eraseLocked(std::unordered_map<std::string,
+                                      std::list<Item>::iterator>::iterator it);
+  void writeFile(const std::list<Item>& items);
+  void readFile();
+};
+}  // namespace spotify
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>  // for size_t
+#include <cstdint>  // for uint8_t, uint32_t
+#include <list>     // for list
+#include <mutex>    // for mutex
+#include <string>   // for string
+#include <vector>   // for vector
+
+namespace spotify {
+
+/**
+ * @brief Keeps the decrypted header and footer of recently played files.
+ *
+ * CDNAudioFile prefetches both before vorbis can start. With an entry here
+ * the decoder sets up from flash and only the audio after the header has to
+ * come from the network. One file per entry in a directory (a SPIFFS mount
+ * on ESP32), plus an index holding the LRU order. Disabled until open().
+ *
+ * Nothing touches flash on the playback path: store() only queues the entry
+ * and a hit reorders the LRU in memory. flush() writes queued entries, and
+ * the index with them, from a task that can afford to block.
+ */
+class OggHeaderCache {
+ public:
+  struct Entry {
+    size_t fileSize = 0;     // encrypted file size reported by the CDN
+    size_t footerStart = 0;  // file offset of footer[0]
+    std::vector<uint8_t> header;
+    std::vector<uint8_t> footer;
+  };
+
+  struct Stats {
+    uint32_t hits = 0;
+    uint32_t misses = 0;
+    uint32_t evictions = 0;
+    uint32_t entries = 0;
+  };
+
+  static OggHeaderCache& shared();
+
+  /**
+   * @brief Starts using dir, which has to exist already.
+   * @param maxEntries files kept before the least recently used is removed
+   */
+  bool open(const std::string& dir, size_t maxEntries = 32);
+  bool enabled();
+
+  bool load(const std::vector<uint8_t>& fileId, Entry* out);
+
+  /**
+   * @brief Queues entry for the next flush(), dropping the oldest queued one
+   * past MAX_PENDING.
+   */
+  void store(const std::vector<uint8_t>& fileId, Entry entry);
+
+  /**
+   * @brief Writes queued entries and the index. Blocks on flash.
+   */
+  void flush();
+
+  Stats stats();
+
+ private:
+  // Queued entries hold about 20 KB of RAM each until written
+  static const size_t MAX_PENDING = 2;
+
+  struct Pending {
+    std::string key;
+    std::vector<uint8_t> fileId;
+    Entry entry;
+  };
+
+  std::mutex cacheMutex;
+  std::string dir;
+  size_t maxEntries = 0;
+  std::list<std::string> lru;  // most recently used first
+  std::list<Pending> pending;  // oldest first
+  bool indexDirty = false;     // an entry was added or dropped since saved
+  Stats counters;
+
+  static std::string keyFor(const std::vector<uint8_t>& fileId);
+  std::string pathFor(const std::string& key);
+  void touchLocked(const std::string& key);
+  bool writeEntry(const Pending& item);
+  void saveIndexLocked();
+};
+}  // namespace spotify
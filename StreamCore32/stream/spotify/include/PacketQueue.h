@@ -0,0 +1,66 @@
+#pragma once
+
+#include <array>    // for array
+#include <atomic>   // for atomic
+#include <chrono>   // for steady_clock
+#include <cstddef>  // for size_t
+#include <cstdint>  // for uint32_t, uint64_t
+
+#include "Packet.h"  // for Packet
+
+namespace spotify {
+
+/**
+ * @brief Bounded lock-free queue of received packets, many producers and
+ * one consumer.
+ *
+ * Slots are allocated once, packets move in and out by swapping buffers, so
+ * nothing is allocated per packet. Each slot carries a sequence number
+ * (Vyukov's bounded queue), producers only contend on a compare-and-swap of
+ * the write position and the consumer takes no lock.
+ */
+class PacketQueue {
+ public:
+  struct Stats {
+    uint32_t dispatched = 0;    // packets popped
+    uint32_t full = 0;          // pushes refused for lack of a free slot
+    uint32_t avgLatencyUs = 0;  // push to pop
+    uint32_t maxLatencyUs = 0;
+  };
+
+  // Power of two
+  static constexpr size_t CAPACITY = 32;
+
+  PacketQueue();
+
+  /**
+   * @brief Moves packet into a free slot, leaving packet.data empty.
+   * @returns false when the queue is full, packet is untouched then
+   */
+  bool push(Packet& packet);
+
+  /**
+   * @brief Moves the oldest packet into out. Consumer side only.
+   * @returns false when the queue is empty
+   */
+  bool pop(Packet& out);
+
+  Stats stats();
+
+ private:
+  struct Slot {
+    std::atomic<size_t> sequence;
+    Packet packet;
+    std::chrono::steady_clock::time_point queuedAt;
+  };
+
+  std::array<Slot, CAPACITY> slots;
+  std::atomic<size_t> writePosition = 0;
+  size_t readPosition = 0;  // touched by the consumer only
+
+  std::atomic<uint32_t> dispatched = 0;
+  std::atomic<uint32_t> full = 0;
+  std::atomic<uint32_t> maxLatencyUs = 0;
+  std::atomic<uint64_t> latencySumUs = 0;
+};
+}  // namespace spotify
@@ -9,17 +9,26 @@
 #include <unistd.h>  // for size_t
 #endif
 #include <atomic>
-#include <cstdint>     // for uint8_t
-#include <functional>  // for function
+#include <cstdint>           // for uint8_t
+#include <functional>        // for function
+#include <initializer_list>  // for initializer_list
 #include <mutex>
-#include <string>  // for string
-#include <vector>  // for vector
+#include <string>   // for string
+#include <utility>  // for pair
+#include <vector>   // for vector
 
 typedef std::function<bool()> timeoutCallback;
 
 namespace spotify {
 class PlainConnection {
  public:
+  struct IoStats {
+    uint32_t recvCalls = 0;  // recv() calls that returned data
+    uint32_t sendCalls = 0;  // send()/sendmsg() calls that wrote data
+  };
+
+  typedef std::pair<const uint8_t*, size_t> Block;
+
   PlainConnection();
   ~PlainConnection();
 
@@ -36,13 +45,42 @@ class PlainConnection {
                                         const std::vector<uint8_t>& data);
   std::vector<uint8_t> recvPacket();
 
+  /**
+   * @brief Reads exactly size bytes, from what earlier reads pulled in first.
+   */
   void readBlock(uint8_t* dst, size_t size);
+
+  /**
+   * @brief Hands out the next size bytes in place, size <= READ_BUFFER_SIZE.
+   * @remark Valid until the next read.
+   */
+  uint8_t* readSpan(size_t size);
+
   size_t writeBlock(const std::vector<uint8_t>& data);
 
+  /**
+   * @brief Sends the blocks back to back in one sendmsg() where possible.
+   */
+  size_t writeBlocks(std::initializer_list<Block> blocks);
+
+  // Summed over all connections of this run
+  static IoStats ioStats();
+
  private:
+  // A recv() takes whatever is available up to this, so the header, body and
+  // mac of a small packet, and often the next header, come in one call
+  static constexpr size_t READ_BUFFER_SIZE = 4096;
+  static constexpr size_t MAX_WRITE_BLOCKS = 4;
+
   int apSock;
+  std::vector<uint8_t> readBuffer;
+  size_t readStart = 0;
+  size_t readEnd = 0;
   std::atomic<bool> isWriting = false;
   std::mutex writeMutex;
+
+  size_t recvSome(uint8_t* dst, size_t size);
+  void checkWriteError(ssize_t sent);
 };
 }  // namespace spotify
 
@@ -1,34 +1,76 @@
 #ifndef SHANNON_H
 #define SHANNON_H
 
+#include <cstddef>  // for size_t
 #include <cstdint>  // for uint32_t, uint8_t
 #include <vector>   // for vector
 
+/**
+ * Shannon stream cipher and MAC, word at a time.
+ *
+ * The registers are rings indexed from a moving origin, so a cycle writes
+ * one word instead of shifting sixteen. Whole words of the buffer are loaded
+ * and stored as 32-bit little-endian values in place; only the bytes before
+ * and after them go through the byte path. The pointer API is what the
+ * connection uses, the vector API forwards to it.
+ */
 class Shannon {
  public:
   static constexpr unsigned int N = 16;
 
-  void key(const std::vector<uint8_t>& key);     /* set key */
-  void nonce(const std::vector<uint8_t>& nonce); /* set Init Vector */
-  void stream(std::vector<uint8_t>& buf);        /* stream cipher */
-  void maconly(std::vector<uint8_t>& buf);       /* accumulate MAC */
-  void encrypt(std::vector<uint8_t>& buf);       /* encrypt + MAC */
-  void decrypt(std::vector<uint8_t>& buf);       /* finalize + MAC */
-  void finish(std::vector<uint8_t>& buf);        /* finalise MAC */
+  void key(const uint8_t* key, size_t len);     /* set key */
+  void nonce(const uint8_t* nonce, size_t len); /* set Init Vector */
+  void nonce(uint32_t counter);                 /* set big-endian counter IV */
+  void stream(uint8_t* buf, size_t len);        /* stream cipher */
+  void maconly(const uint8_t* buf, size_t len); /* accumulate MAC */
+  void encrypt(uint8_t* buf, size_t len);       /* encrypt + MAC */
+  void decrypt(uint8_t* buf, size_t len);       /* decrypt + MAC */
+  void finish(uint8_t* buf, size_t len);        /* finalise MAC */
+  /* encrypt + finalise MAC in one pass, mac may follow buf */
+  void seal(uint8_t* buf, size_t len, uint8_t* mac, size_t macLen);
+
+  void key(const std::vector<uint8_t>& key) {
+    this->key(key.data(), key.size());
+  }
+  void nonce(const std::vector<uint8_t>& nonce) {
+    this->nonce(nonce.data(), nonce.size());
+  }
+  void stream(std::vector<uint8_t>& buf) {
+    this->stream(buf.data(), buf.size());
+  }
+  void maconly(std::vector<uint8_t>& buf) {
+    this->maconly(buf.data(), buf.size());
+  }
+  void encrypt(std::vector<uint8_t>& buf) {
+    this->encrypt(buf.data(), buf.size());
+  }
+  void decrypt(std::vector<uint8_t>& buf) {
+    this->decrypt(buf.data(), buf.size());
+  }
+  void finish(std::vector<uint8_t>& buf) {
+    this->finish(buf.data(), buf.size());
+  }
 
  private:
   static constexpr unsigned int FOLD = Shannon::N;
   static constexpr unsigned int INITKONST = 0x6996c53a;
   static constexpr unsigned int KEYP = 13;
+  // Rings, logical word i of R sits at R[(r + i) % N]
   uint32_t R[Shannon::N];
   uint32_t CRC[Shannon::N];
   uint32_t initR[Shannon::N];
+  unsigned int r = 0;
+  unsigned int c = 0;
   uint32_t konst;
   uint32_t sbuf;
   uint32_t mbuf;
   int nbuf;
   static uint32_t sbox1(uint32_t w);
   static uint32_t sbox2(uint32_t w);
+  uint32_t& reg(unsigned int i) { return this->R[(this->r + i) & (N - 1)]; }
+  uint32_t& crc(unsigned int i) {
+    return this->CRC[(this->c + i) & (N - 1)];
+  }
   void cycle();
   void crcfunc(uint32_t i);
   void macfunc(uint32_t i);
@@ -37,7 +79,7 @@ class Shannon {
   void reloadState();
   void genkonst();
   void diffuse();
-  void loadKey(const std::vector<uint8_t>& key);
+  void loadKey(const uint8_t* key, size_t keylen);
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -17,12 +17,20 @@ class PlainConnection;
 #define MAC_SIZE 4
 namespace spotify {
 class ShannonConnection {
+ public:
+  struct CipherStats {
+    uint64_t bytes = 0;   // ciphered both ways, MACs included
+    uint64_t busyUs = 0;  // spent in the cipher
+    uint32_t packetsIn = 0;
+    uint32_t packetsOut = 0;
+  };
+
  private:
   std::unique_ptr<Shannon> sendCipher;
   std::unique_ptr<Shannon> recvCipher;
   uint32_t sendNonce = 0;
   uint32_t recvNonce = 0;
-  std::vector<uint8_t> cipherPacket(uint8_t cmd, std::vector<uint8_t>& data);
+  static void countCipher(size_t bytes, uint64_t busyUs);
   std::mutex writeMutex;
   std::mutex readMutex;
 
@@ -32,9 +40,15 @@ class ShannonConnection {
   void wrapConnection(std::shared_ptr<PlainConnection> conn,
                       std::vector<uint8_t>& sendKey,
                       std::vector<uint8_t>& recvKey);
+  /**
+   * @brief Encrypts data in place and sends it as one packet.
+   */
   void sendPacket(uint8_t cmd, std::vector<uint8_t>& data);
   std::shared_ptr<PlainConnection> conn;
   Packet recvPacket();
+
+  // Summed over all connections of this run
+  static CipherStats cipherStats();
 };
 }  // namespace spotify
 
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <array>    // for array
+#include <chrono>   // for steady_clock
+#include <cstddef>  // for size_t
+#include <cstdint>  // for uint32_t, uint64_t
+#include <mutex>    // for mutex
+#include <vector>   // for vector
+
+namespace spotify {
+
+/**
+ * @brief Hashed timing wheel of request deadlines.
+ *
+ * Scheduling and expiry cost O(1) per timer whatever the number in flight,
+ * deadlines are rounded up to TICK_MS. Timers are not cancelled: the owner
+ * looks the key up when it expires, a request answered in the meantime is
+ * simply no longer there.
+ */
+class TimeoutWheel {
+ public:
+  static constexpr uint32_t TICK_MS = 100;
+  // Power of two, one turn covers SLOTS * TICK_MS
+  static constexpr size_t SLOTS = 64;
+
+  TimeoutWheel();
+
+  /**
+   * @brief Arms a timer for key, never expiring before timeoutMs.
+   */
+  void schedule(uint64_t key, uint32_t timeoutMs);
+
+  /**
+   * @brief Advances the wheel to now, appending expired keys to expired.
+   */
+  void advance(std::vector<uint64_t>& expired);
+
+  // Timers armed and not expired yet
+  size_t size();
+
+ private:
+  struct Timer {
+    uint64_t key;
+    uint32_t rounds;  // full turns left before it expires
+  };
+
+  std::mutex wheelMutex;
+  std::array<std::vector<Timer>, SLOTS> slots;
+  size_t cursor = 0;
+  size_t timers = 0;
+  std::chrono::steady_clock::time_point lastTick;
+};
+}  // namespace spotify
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <atomic>              // for atomic
+#include <chrono>              // for steady_clock
+#include <condition_variable>  // for condition_variable
+#include <cstddef>             // for size_t
+#include <cstdint>             // for uint8_t, uint32_t
+#include <functional>          // for function
+#include <mutex>               // for mutex
+#include <vector>              // for vector
+
+#include "BellTask.h"  // for Task
+
+namespace spotify {
+
+/**
+ * @brief Runs the decoder of one track on its own task, ahead of playback.
+ *
+ * PCM lands in a ring the player drains into the sink, so a network stall
+ * only becomes audible once the ring has run dry. Fetching and decryption
+ * happen below the decode callback (CDNReadAhead), this is the stage after.
+ * Seeks are queued for the decoder task, which owns the decoder state once
+ * the constructor returns. With a prepare step the decoder can also be set
+ * up on that task, so opening a track does not hold up the caller.
+ */
+class TrackDecoder : public bell::Task {
+ public:
+  /**
+   * @brief Decodes up to len bytes of PCM into out.
+   * @returns bytes decoded, 0 at the end of the track, < 0 on errors
+   */
+  typedef std::function<long(uint8_t* out, size_t len)> Decode;
+  typedef std::function<void(size_t ms)> Seek;
+  /**
+   * @brief Sets up the decoder before the first decode call.
+   * @returns false when the track cannot be decoded
+   */
+  typedef std::function<bool()> Prepare;
+
+  struct Stats {
+    uint32_t stalls = 0;    // reads that found the ring empty mid-track
+    uint32_t stallMs = 0;   // time those reads waited for the decoder
+    uint32_t busyMs = 0;    // time spent inside decode
+    uint32_t uptimeMs = 0;  // time since the decoder task started
+    size_t capacity = 0;    // ring size in bytes
+    size_t minDepth = 0;    // lowest fill seen by a read once audio flowed
+    size_t avgDepth = 0;    // mean fill seen by reads
+  };
+
+  static const size_t CHUNK_SIZE = 1024 * 4;
+
+  /**
+   * @param decode called from the decoder task only
+   * @param seek called from the decoder task only
+   * @param capacity ring size in bytes
+   * @param prepare optional, called from the decoder task before decoding
+   */
+  TrackDecoder(Decode decode, Seek seek, size_t capacity,
+               Prepare prepare = nullptr);
+  ~TrackDecoder();
+
+  /**
+   * @brief Copies buffered PCM, waiting up to timeoutMs for the decoder.
+   * @returns bytes copied, 0 when nothing arrived in time or at the end
+   */
+  size_t read(uint8_t* dst, size_t len, uint32_t timeoutMs);
+
+  /**
+   * @brief Drops buffered PCM and decodes from ms on.
+   */
+  void seek(size_t ms);
+
+  /**
+   * @brief True once the decoder reached the end and the ring is drained
+   */
+  bool finished();
+
+  /**
+   * @brief True once the decoder failed and the ring is drained
+   */
+  bool failed();
+
+  Stats stats();
+
+ private:
+  Decode decode;
+  Seek seekDecoder;
+  Prepare prepare;
+  std::chrono::steady_clock::time_point startedAt;
+
+  std::mutex ringMutex;
+  std::condition_variable ringChanged;
+  std::vector<uint8_t> ring;
+  size_t readIndex = 0;
+  size_t fill = 0;
+  uint32_t generation = 0;  // bumped on every seek()
+  bool seekPending = false;
+  size_t seekMs = 0;
+  bool primed = false;      // PCM has been handed out since the last seek
+  bool done = false;        // decoder returned its last value
+  long status = 0;          // that last value
+  bool unprepared = false;  // prepare failed, the task is gone
+  Stats counters;
+  uint64_t depthSum = 0;
+  uint32_t depthSamples = 0;
+
+  std::atomic<bool> wantStop = false;
+  std::atomic<bool> isRunning = false;
+
+  void runTask() override;
+};
+}  // namespace spotify
@@ -11,6 +11,9 @@
 
 #include "BellTask.h"  // for Task
 #include "CDNAudioFile.h"
+#ifndef CONFIG_BELL_NOCODEC
+#include "TrackDecoder.h"  // for TrackDecoder
+#endif
 
 namespace bell {
 class WrappedSemaphore;
@@ -61,13 +64,6 @@ class TrackPlayer : bell::Task {
   void resetState(bool paused = false);
   std::function<size_t(uint8_t*, size_t, size_t, bool)> dataCallback = nullptr;
   SeekableCallback headerSize;
-#ifndef CONFIG_BELL_NOCODEC
-  // Vorbis codec callbacks
-  size_t _vorbisRead(void* ptr, size_t size, size_t nmemb);
-  size_t _vorbisClose();
-  int _vorbisSeek(int64_t offset, int whence);
-  long _vorbisTell();
-#endif
 
   void stop();
   void start();
@@ -93,10 +89,33 @@ class TrackPlayer : bell::Task {
   std::mutex dataOutMutex;
 
 #ifndef CONFIG_BELL_NOCODEC
+  // One track's stream and decoder, kept together so the next track can be
+  // opened while the current one is still playing
+  struct DecodingTrack {
+    std::shared_ptr<QueuedTrack> track;
+    std::shared_ptr<CDNAudioFile> file;
+    OggVorbis_File vorbisFile = {};
+    int currentSection = 0;
+    bool vorbisOpen = false;
+    std::unique_ptr<TrackDecoder> decoder;
+    ~DecodingTrack();
+  };
+
   // Vorbis related
-  OggVorbis_File vorbisFile;
   ov_callbacks vorbisCallbacks;
-  int currentSection;
+
+  // PCM buffered between the decoder task and the sink
+  const int PCM_RING_MS = 250;
+  // Spotify serves 44.1 kHz stereo, 16-bit once decoded
+  const int PCM_BYTES_PER_MS = 176;
+  // How long before the end of a track the next one gets opened
+  const int PREOPEN_MS = 5000;
+  std::unique_ptr<DecodingTrack> playing;
+  std::unique_ptr<DecodingTrack> upcoming;
+
+  bool openVorbis(DecodingTrack* stream);
+  void startDecoder(DecodingTrack* stream, bool openFirst);
+  void prepareNext(std::shared_ptr<QueuedTrack> track);
 #endif
 
   std::vector<uint8_t> pcmBuffer = std::vector<uint8_t>(1024 * 4);
@@ -2,13 +2,17 @@
 
 #include <stddef.h>  // for size_t
 #include <atomic>
+#include <chrono>  // for steady_clock
 #include <deque>
 #include <functional>
+#include <memory>  // for enable_shared_from_this
 #include <mutex>
 #include <utility>  // for pair
 
 #include "BellTask.h"
-#include "EventManager.h"  // for TrackMetrics
+#include "EventManager.h"     // for TrackMetrics
+#include "MetadataBatcher.h"  // for MetadataBatcher
+#include "MetadataCache.h"    // for MetadataCache
 #include "TrackReference.h"
 #include "Utils.h"
 
@@ -26,11 +30,11 @@ struct TrackInfo {
   std::string name, album, artist, imageUrl, trackId, provider,
       page_instance_id, interaction_id, decision_id;
   uint32_t duration, number, discNumber;
-  void loadPbTrack(Track* pbTrack, const std::vector<uint8_t>& gid);
-  void loadPbEpisode(Episode* pbEpisode, const std::vector<uint8_t>& gid);
+  void loadCached(const MetadataCache::Entry& entry,
+                  const std::vector<uint8_t>& gid);
 };
 
-class QueuedTrack {
+class QueuedTrack : public std::enable_shared_from_this<QueuedTrack> {
  public:
   QueuedTrack(player_proto_connect_ProvidedTrack& ref,
               std::shared_ptr<spotify::Context> ctx,
@@ -61,7 +65,9 @@ class QueuedTrack {
   uint32_t requestedPosition;
   AudioFormat audioFormat;
   bool loading = false;
-  uint8_t retries = 0;
+  uint8_t retries = 0;  // failed audio key requests for this format
+  // A failed audio key request is not repeated before this
+  std::chrono::steady_clock::time_point retryAt;
 
   // PB data
   Track pbTrack = Track_init_zero;
@@ -74,13 +80,17 @@ class QueuedTrack {
   // Will return nullptr if the track is not ready
   std::shared_ptr<spotify::CDNAudioFile> getAudioFile();
 
+  // The audio did not decrypt, forget the cached key
+  void dropCachedAudioKey();
+
   void cancelLoading();
   // --- Steps ---
   void stepLoadMetadata(
       Track* pbTrack, Episode* pbEpisode, std::mutex& trackListMutex,
-      std::shared_ptr<bell::WrappedSemaphore> updateSemaphore);
+      std::shared_ptr<bell::WrappedSemaphore> updateSemaphore,
+      std::shared_ptr<MetadataBatcher> batcher);
 
-  bool stepParseMetadata(Track* pbTrack, Episode* pbEpisode);
+  bool stepParseMetadata(const MetadataCache::Entry& entry);
 
   void stepLoadAudioFile(
       std::mutex& trackListMutex,
@@ -88,18 +98,34 @@ class QueuedTrack {
 
   void stepLoadCDNUrl(const std::string& accessKey);
 
+  /**
+   * @brief Renews the CDN urls of a READY track about to see them expire.
+   * @returns true when storage-resolve was asked
+   */
+  bool refreshCDNUrl(const std::string& accessKey);
+
  private:
+  // Key requests per format before a lower one is tried, the wait doubles
+  // from KEY_RETRY_BACKOFF_MS after each
+  static const uint8_t MAX_KEY_RETRIES = 3;
+  static const int KEY_RETRY_BACKOFF_MS = 500;
+
   std::shared_ptr<spotify::Context> ctx;
   std::shared_ptr<bell::WrappedSemaphore> playableSemaphore;
 
-  uint64_t pendingMercuryRequest = 0;
+  std::shared_ptr<MetadataBatcher> metadataBatcher;
+  uint32_t pendingMetadataRequest = 0;
   uint32_t pendingAudioKeyRequest = 0;
+  std::chrono::steady_clock::time_point queuedAt;
 
   std::vector<uint8_t> trackId, fileId, audioKey;
   std::string cdnUrl;
   std::pair<SpotifyFileType, std::vector<uint8_t>> gid = {
       SpotifyFileType::UNKNOWN,
       {}};
+
+  // Asks storage-resolve for fileId and caches the answer
+  bool resolveCDNUrl(const std::string& accessKey, bool refresh);
 };
 
 class TrackQueue : public bell::Task {
@@ -127,11 +153,19 @@ class TrackQueue : public bell::Task {
  private:
   std::shared_ptr<spotify::Context> ctx;
   std::shared_ptr<bell::WrappedSemaphore> processSemaphore;
+  std::shared_ptr<MetadataBatcher> metadataBatcher;
 
   std::atomic<bool> isRunning = false;
 
   std::string accessKey;
 
-  bool processTrack(std::shared_ptr<QueuedTrack> track);
+  // Tracks waiting on an audio key reply at the same time, metadata lookups
+  // are bounded by MetadataBatcher::MAX_BATCH per request instead
+  const int MAX_IN_FLIGHT = 4;
+
+  bool processTrack(std::shared_ptr<QueuedTrack> track, int& inFlight);
+  void refreshCDNUrls();
+  // A track that backed off after a failed key request may ask again
+  bool keyRetryDue();
 };
 }  // namespace spotify
\ No newline at end of file
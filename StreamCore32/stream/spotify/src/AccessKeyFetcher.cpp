@@ -1,5 +1,8 @@
 #include "AccessKeyFetcher.h"
 
+#include <algorithm>         // for max, min
+#include <chrono>            // for steady_clock, milliseconds
+#include <cstdlib>           // for free
 #include <cstring>           // for strrchr
 #include <initializer_list>  // for initializer_list
 #include <map>               // for operator!=, operator==
@@ -7,7 +10,9 @@
 #include <vector>            // for vector
 
 #include "BellLogger.h"  // for AbstractLogger
+#include "BellUtils.h"   // for BELL_SLEEP_MS
 #include "HTTPClient.h"
+#include "HostRateLimiter.h"
 #include "Logger.h"            // for SC32_LOG
 #include "MercurySession.h"    // for MercurySession, MercurySession::Res...
 #include "NanoPBExtensions.h"  // for bell::nanopb::encode...
@@ -36,9 +41,27 @@ static std::string SCOPES =
     "recently-played";  // Required access scopes
 
 AccessKeyFetcher::AccessKeyFetcher(std::shared_ptr<spotify::Context> ctx)
-    : ctx(ctx) {}
+    : bell::Task("spotify_token", 1024 * 12, 0, 1), ctx(ctx) {
+  // The first token is fetched right away, before anyone asks for it
+  isRunning = true;
+  startTask();
+}
+
+AccessKeyFetcher::~AccessKeyFetcher() {
+  wantStop = true;
+  keyChanged.notify_all();
+  // A login5 request in flight has to return first
+  while (isRunning) {
+    BELL_SLEEP_MS(10);
+  }
+}
 
 bool AccessKeyFetcher::isExpired() {
+  std::scoped_lock lock(keyMutex);
+  return expiredLocked();
+}
+
+bool AccessKeyFetcher::expiredLocked() {
   if (accessKey.empty()) {
     return true;
   }
@@ -51,28 +74,96 @@ bool AccessKeyFetcher::isExpired() {
 }
 
 std::string AccessKeyFetcher::getAccessKey() {
-  if (!isExpired()) {
-    return accessKey;
+  {
+    std::scoped_lock lock(keyMutex);
+    if (!expiredLocked()) {
+      return accessKey;
+    }
+    counters.waits++;
   }
 
   updateAccessKey();
 
+  std::scoped_lock lock(keyMutex);
   return accessKey;
 }
 
 void AccessKeyFetcher::updateAccessKey() {
+  std::unique_lock lock(keyMutex);
   if (keyPending) {
-    // Already pending refresh request
+    // Already pending refresh request, its result is ours too
+    keyChanged.wait(lock, [this] { return !keyPending; });
     return;
   }
-
   keyPending = true;
+  lock.unlock();
+
+  auto start = std::chrono::steady_clock::now();
+  std::string key;
+  int expiresIn = 0;
+  bool success = fetchAccessKey(&key, &expiresIn);
+  uint32_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+
+  lock.lock();
+  keyPending = false;
+  long long int now = ctx->timeProvider->getSyncedTimestamp();
+  if (success) {
+    accessKey = key;
+    expiresAt = now + expiresIn * 1000LL - EXPIRY_MARGIN_MS;
+    refreshAt = now + expiresIn * 10LL * REFRESH_PERCENT;
+    counters.refreshes++;
+    counters.lastLatencyMs = ms;
+    counters.maxLatencyMs = std::max(counters.maxLatencyMs, ms);
+  } else {
+    // The old token may still be good for a while
+    refreshAt = now + RETRY_MS;
+    counters.failures++;
+  }
+  SC32_LOG(info,
+           "Access token refresh took %u ms (%u refreshes, %u failures, %u "
+           "waits)",
+           (unsigned)ms, (unsigned)counters.refreshes,
+           (unsigned)counters.failures, (unsigned)counters.waits);
+  keyChanged.notify_all();
+}
+
+AccessKeyFetcher::Stats AccessKeyFetcher::stats() {
+  std::scoped_lock lock(keyMutex);
+  return counters;
+}
 
+void AccessKeyFetcher::runTask() {
+  {
+    std::unique_lock lock(keyMutex);
+    while (!wantStop) {
+      long long int wait =
+          refreshAt - (long long int)ctx->timeProvider->getSyncedTimestamp();
+      if (wait > 0 || keyPending) {
+        // Woken early on shutdown, rechecked every minute as the synced
+        // clock may jump
+        keyChanged.wait_for(lock, std::chrono::milliseconds(std::min(
+                                      std::max(wait, 1000LL), 60 * 1000LL)));
+        continue;
+      }
+      lock.unlock();
+      updateAccessKey();
+      lock.lock();
+    }
+  }
+  isRunning = false;
+}
+
+bool AccessKeyFetcher::fetchAccessKey(std::string* key, int* expiresIn) {
   // Prepare a protobuf login request
   static LoginRequest loginRequest = LoginRequest_init_zero;
   static LoginResponse loginResponse = LoginResponse_init_zero;
 
-  // Assign necessary request fields
+  // Assign necessary request fields, replacing those of the last refresh
+  free(loginRequest.client_info.client_id);
+  free(loginRequest.client_info.device_id);
+  free(loginRequest.login_method.stored_credential.username);
   loginRequest.client_info.client_id = strdup(CLIENT_ID.c_str());  // CLIENT_ID;
 
   loginRequest.client_info.device_id =
@@ -93,13 +184,16 @@ void AccessKeyFetcher::updateAccessKey() {
 
   do {
     auto encodedRequest = pbEncode(LoginRequest_fields, &loginRequest);
-    SC32_LOG(info, "Access token expired, fetching new one... %d",
-             encodedRequest.size());
+    SC32_LOG(info, "Fetching access token... %d", encodedRequest.size());
 
     // Perform a login5 request, containing the encoded protobuf data
+    const std::string loginUrl = "https://login5.spotify.com/v3/login";
+    auto permit = HostRateLimiter::shared().acquire(
+        loginUrl, HostRateLimiter::Priority::Interactive);
     auto response = bell::HTTPClient::post(
-        "https://login5.spotify.com/v3/login",
-        {{"Content-Type", "application/x-protobuf"}}, encodedRequest);
+        loginUrl, {{"Content-Type", "application/x-protobuf"}},
+        encodedRequest);
+    HostRateLimiter::shared().observe(loginUrl, *response);
 
     auto responseBytes = response->bytes();
 
@@ -111,17 +205,14 @@ void AccessKeyFetcher::updateAccessKey() {
       SC32_LOG(info, "Access token sucessfully fetched");
       success = true;
 
-      accessKey = std::string(loginResponse.response.ok.access_token);
+      *key = std::string(loginResponse.response.ok.access_token);
 
-      // Expire in ~30 minutes
-      int expiresIn = 3600 / 2;
+      // Tokens last an hour unless the response says otherwise
+      *expiresIn = 3600;
 
       if (loginResponse.response.ok.has_access_token_expires_in) {
-        int expiresIn = loginResponse.response.ok.access_token_expires_in / 2;
+        *expiresIn = loginResponse.response.ok.access_token_expires_in;
       }
-
-      this->expiresAt =
-          ctx->timeProvider->getSyncedTimestamp() + (expiresIn * 1000);
     } else {
       SC32_LOG(error, "Failed to fetch access token");
     }
@@ -132,5 +223,5 @@ void AccessKeyFetcher::updateAccessKey() {
     retryCount--;
   } while (retryCount >= 0 && !success);
 
-  keyPending = false;
+  return success;
 }
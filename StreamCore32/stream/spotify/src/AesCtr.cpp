@@ -0,0 +1,54 @@
+#include "AesCtr.h"
+
+#include <string.h>  // for memcpy
+
+using namespace spotify;
+
+AesCtr::AesCtr(const std::vector<uint8_t>& key, const uint8_t (&iv)[16]) {
+  mbedtls_aes_init(&aes);
+  memcpy(this->iv, iv, sizeof(this->iv));
+  if (key.size() == 16 || key.size() == 24 || key.size() == 32) {
+    keyValid = mbedtls_aes_setkey_enc(&aes, key.data(), key.size() * 8) == 0;
+  }
+  seek(0);
+}
+
+AesCtr::~AesCtr() {
+  mbedtls_aes_free(&aes);
+}
+
+void AesCtr::seek(size_t pos) {
+  // counter = iv + pos / 16, big endian
+  uint64_t add = pos / 16;
+  unsigned carry = 0;
+  for (int i = 15; i >= 0; i--) {
+    unsigned sum = iv[i] + (unsigned)(add & 0xff) + carry;
+    counter[i] = (uint8_t)sum;
+    carry = sum >> 8;
+    add >>= 8;
+  }
+
+  blockOffset = pos % 16;
+  if (blockOffset != 0) {
+    // Start inside a block: produce its keystream, mbedtls continues from it
+    mbedtls_aes_crypt_ecb(&aes, MBEDTLS_AES_ENCRYPT, counter, streamBlock);
+    for (int i = 15; i >= 0; i--) {
+      if (++counter[i] != 0) {
+        break;
+      }
+    }
+  }
+  position = pos;
+}
+
+void AesCtr::xcrypt(uint8_t* buffer, size_t nbytes, size_t pos) {
+  if (!keyValid || nbytes == 0) {
+    return;
+  }
+  if (pos != position) {
+    seek(pos);
+  }
+  mbedtls_aes_crypt_ctr(&aes, nbytes, &blockOffset, counter, streamBlock,
+                        buffer, buffer);
+  position += nbytes;
+}
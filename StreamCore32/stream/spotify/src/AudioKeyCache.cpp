@@ -0,0 +1,135 @@
+#include "AudioKeyCache.h"
+
+#include "Logger.h"  // for SC32_LOG
+
+using namespace spotify;
+
+AudioKeyCache& AudioKeyCache::shared() {
+  static AudioKeyCache cache;
+  return cache;
+}
+
+std::string AudioKeyCache::keyOf(const std::vector<uint8_t>& gid,
+                                 const std::vector<uint8_t>& fileId) {
+  std::string name(gid.begin(), gid.end());
+  name.append(fileId.begin(), fileId.end());
+  return name;
+}
+
+bool AudioKeyCache::load(const std::vector<uint8_t>& gid,
+                         const std::vector<uint8_t>& fileId,
+                         std::vector<uint8_t>* key) {
+  std::scoped_lock lock(cacheMutex);
+  auto it = index.find(keyOf(gid, fileId));
+  if (it == index.end()) {
+    counters.fetches++;
+    return false;
+  }
+  // Move to the front, saved with the next new key
+  lru.splice(lru.begin(), lru, it->second);
+  *key = it->second->second;
+  counters.fetchesAvoided++;
+  return true;
+}
+
+void AudioKeyCache::store(const std::vector<uint8_t>& gid,
+                          const std::vector<uint8_t>& fileId,
+                          const std::vector<uint8_t>& key) {
+  std::scoped_lock lock(cacheMutex);
+  insertLocked(keyOf(gid, fileId), key);
+  unsaved++;
+}
+
+void AudioKeyCache::invalidate(const std::vector<uint8_t>& gid,
+                               const std::vector<uint8_t>& fileId) {
+  std::scoped_lock lock(cacheMutex);
+  auto it = index.find(keyOf(gid, fileId));
+  if (it == index.end()) {
+    return;
+  }
+  lru.erase(it->second);
+  index.erase(it);
+  counters.entries = lru.size();
+  // Not worth a write of its own, it goes with the next new key
+  unsaved++;
+}
+
+void AudioKeyCache::flush(bool force) {
+  std::scoped_lock lock(cacheMutex);
+  if (unsaved == 0 || (!force && unsaved < SAVE_EVERY)) {
+    return;
+  }
+  saveLocked();
+}
+
+AudioKeyCache::Stats AudioKeyCache::stats() {
+  std::scoped_lock lock(cacheMutex);
+  return counters;
+}
+
+void AudioKeyCache::insertLocked(const std::string& name,
+                                 const std::vector<uint8_t>& key) {
+  auto existing = index.find(name);
+  if (existing != index.end()) {
+    lru.erase(existing->second);
+    index.erase(existing);
+  }
+  lru.emplace_front(name, key);
+  index[name] = lru.begin();
+  while (lru.size() > capacity) {
+    index.erase(lru.back().first);
+    lru.pop_back();
+    counters.evictions++;
+  }
+  counters.entries = lru.size();
+}
+
+void AudioKeyCache::loadLocked() {
+  if (keyStore == nullptr) {
+    return;
+  }
+  Record record;
+  if (keyStore->load(RECORD, &record) != 0) {
+    // Nothing saved yet
+    return;
+  }
+  // Least recently used first, inserting moves each to the front. Records
+  // of the older layout have no such field and are replaced on the next save.
+  for (auto& field : record.fields) {
+    if (field.name != FIELD) {
+      continue;
+    }
+    auto& packed = field.value;
+    for (size_t at = 0; at + ENTRY_SIZE <= packed.size(); at += ENTRY_SIZE) {
+      auto entry = packed.begin() + at;
+      auto key = entry + GID_SIZE + FILE_ID_SIZE;
+      insertLocked(std::string(entry, key),
+                   std::vector<uint8_t>(key, key + KEY_SIZE));
+    }
+  }
+  SC32_LOG(info, "Audio key cache: %u keys", (unsigned)counters.entries);
+}
+
+void AudioKeyCache::saveLocked() {
+  unsaved = 0;
+  if (keyStore == nullptr) {
+    return;
+  }
+  std::vector<uint8_t> packed;
+  packed.reserve(lru.size() * ENTRY_SIZE);
+  for (auto item = lru.rbegin(); item != lru.rend(); item++) {
+    // Ids of another length stay in memory only
+    if (item->first.size() != GID_SIZE + FILE_ID_SIZE ||
+        item->second.size() != KEY_SIZE) {
+      continue;
+    }
+    packed.insert(packed.end(), item->first.begin(), item->first.end());
+    packed.insert(packed.end(), item->second.begin(), item->second.end());
+  }
+  Record record;
+  record.userkey = RECORD;
+  record.fields.push_back(Field(FIELD, packed));
+  if (keyStore->save(record, true) != 0) {
+    SC32_LOG(error, "Audio key cache: save failed");
+  }
+}
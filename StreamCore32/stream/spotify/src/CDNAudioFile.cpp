@@ -1,19 +1,23 @@
 #include "CDNAudioFile.h"
 
 #include <string.h>          // for memcpy
+#include <algorithm>         // for min, max
+#include <chrono>            // for steady_clock, milliseconds
 #include <functional>        // for __base
 #include <initializer_list>  // for initializer_list
+#include <iterator>          // for prev
 #include <map>               // for operator!=, operator==
 #include <string_view>       // for string_view
 #include <type_traits>       // for remove_extent_t
 
 #include "AccessKeyFetcher.h"  // for AccessKeyFetcher
 #include "BellLogger.h"        // for AbstractLogger
-#include "Crypto.h"
+#include "CDNUrlCache.h"       // for CDNUrlCache
 #include "Logger.h"            // for SC32_LOG
+#include "OggHeaderCache.h"    // for OggHeaderCache
 #include "Packet.h"            // for spotify
 #include "SocketStream.h"      // for SocketStream
-#include "Utils.h"             // for bigNumAdd, bytesToHexString, string...
+#include "Utils.h"             // for bytesToHexString, string...
 #include "WrappedSemaphore.h"  // for WrappedSemaphore
 #ifdef BELL_ONLY_CJSON
 #include "cJSON.h"
@@ -25,9 +29,78 @@
 using namespace spotify;
 
 CDNAudioFile::CDNAudioFile(const std::string& cdnUrl,
-                           const std::vector<uint8_t>& audioKey)
-    : cdnUrl(cdnUrl), audioKey(audioKey) {
-  this->crypto = std::make_unique<Crypto>();
+                           const std::vector<uint8_t>& audioKey,
+                           const std::vector<uint8_t>& fileId)
+    : cdnUrl(cdnUrl), audioKey(audioKey), fileId(fileId) {
+  this->cipher = std::make_unique<AesCtr>(audioKey, audioAESIV);
+}
+
+CDNAudioFile::~CDNAudioFile() {
+#ifndef CONFIG_BELL_NOCODEC
+  if (this->readAhead) {
+    auto stats = this->readAhead->stats();
+    // Stop the worker before the buffers and cipher it uses go away
+    this->readAhead.reset();
+    SC32_LOG(info,
+             "CDN read-ahead: %u windows (peak %u KB, avg %u KB ahead), "
+             "%u cancelled, %u stalls (%u ms), link busy %u%%",
+             (unsigned)stats.windows, (unsigned)(stats.peakWindow / 1024),
+             (unsigned)(stats.avgAhead / 1024), (unsigned)stats.cancelled,
+             (unsigned)stats.stalls, (unsigned)stats.stallMs,
+             stats.uptimeMs ? (unsigned)((uint64_t)stats.busyMs * 100 /
+                                         stats.uptimeMs)
+                            : 0u);
+  }
+  SC32_LOG(info, "CDN stream: %u requests, %u KB at %u KB/s",
+           (unsigned)this->requestCount, (unsigned)(this->bytesFetched / 1024),
+           this->fetchMs ? (unsigned)((uint64_t)this->bytesFetched * 1000 /
+                                     1024 / this->fetchMs)
+                         : 0u);
+
+  if (this->cacheHeaders) {
+    OggHeaderCache::Entry entry;
+    entry.fileSize = this->totalFileSize + SPOTIFY_OPUS_HEADER;
+    entry.footerStart = entry.fileSize - this->footer.size();
+    entry.header = std::move(this->header);
+    entry.footer = std::move(this->footer);
+    // Only queued, the track queue task writes it to flash
+    OggHeaderCache::shared().store(this->fileId, std::move(entry));
+  }
+#endif
+  SC32_LOG(info, "CDN decrypt: %u KB at %u KB/s",
+           (unsigned)(this->decryptBytes / 1024),
+           this->decryptUs ? (unsigned)((uint64_t)this->decryptBytes *
+                                        1000000 / 1024 / this->decryptUs)
+                           : 0u);
+}
+
+bool CDNAudioFile::failover(int status) {
+  // Expired, or this CDN lost the file; the other urls may still work
+  if ((status != 403 && status != 404) || this->fileId.empty()) {
+    return false;
+  }
+  SC32_LOG(info, "CDN answered %d, trying the next url", status);
+  return CDNUrlCache::shared().failover(this->fileId, this->cdnUrl,
+                                        &this->cdnUrl);
+}
+
+bool CDNAudioFile::openRange(size_t pos) {
+  if (this->response) {
+    // Open-ended body, draining would download the rest of the file
+    this->response->stream().close();
+    this->response.reset();
+  }
+  do {
+    this->response = bell::HTTPClient::get(
+        this->cdnUrl, {bell::HTTPClient::RangeHeader::open(pos)}, false);
+    this->requestCount++;
+  } while (this->failover(this->response->status()));
+  if (!this->response->stream().isOpen() || this->response->status() < 200 ||
+      this->response->status() >= 300) {
+    this->response.reset();
+    return false;
+  }
+  return true;
 }
 
 size_t CDNAudioFile::getPosition() {
@@ -44,19 +117,54 @@ void CDNAudioFile::seek(size_t newPos) {
   * @brief Opens connection to the provided cdn url, and fetches track metadata.
   */
 bool CDNAudioFile::openStream() {
-  // Open connection, read first 128 bytes
-  auto resp = bell::HTTPClient::get(
-      this->cdnUrl,
-      {bell::HTTPClient::RangeHeader::range(0, OPUS_HEADER_SIZE - 1)}, false);
-  if (!resp->stream().isOpen() || resp->httpCode() != 200) {
+  if (!this->cipher->valid()) {
+    SC32_LOG(error, "Invalid AES key length");
     return false;
   }
-  size_t got = resp->stream().readExact((char*)header.data(), OPUS_HEADER_SIZE);
-  resp->stream().close();
+
+  size_t footerStartLocation = 0;
+  OggHeaderCache::Entry cached;
+  if (OggHeaderCache::shared().load(this->fileId, &cached) &&
+      cached.header.size() == (size_t)OPUS_HEADER_SIZE &&
+      cached.fileSize > cached.footerStart &&
+      cached.footer.size() == cached.fileSize - cached.footerStart) {
+    // Played recently: vorbis sets up from flash, the read-ahead connects
+    // on its own once audio past the header is needed
+    this->header = std::move(cached.header);
+    this->footer = std::move(cached.footer);
+    this->totalFileSize = cached.fileSize - SPOTIFY_OPUS_HEADER;
+    footerStartLocation = cached.footerStart;
+    SC32_LOG(info, "Track header from cache");
+  } else if (!this->fetchHeaders(&footerStartLocation)) {
+    return false;
+  }
+  this->position = 0;
+
+  // Everything between header and footer streams through the read-ahead,
+  // starting right behind the prefetched header
+  this->readAhead = std::make_unique<CDNReadAhead>(
+      [this](size_t pos, size_t len, uint8_t* out) {
+        return this->fetchWindow(pos, len, out);
+      },
+      READ_AHEAD_MIN_WINDOW, READ_AHEAD_MEMORY, OPUS_HEADER_SIZE,
+      footerStartLocation);
+
+  return true;
+}
+
+bool CDNAudioFile::fetchHeaders(size_t* footerStart) {
+  // Open an open-ended range, read the header and keep streaming from there
+  if (!this->openRange(0)) {
+    return false;
+  }
+  size_t got =
+      response->stream().readExact((char*)header.data(), OPUS_HEADER_SIZE);
   if (got != OPUS_HEADER_SIZE) {
+    this->response.reset();
     return false;
   }
-  this->totalFileSize = resp->totalLength() - SPOTIFY_OPUS_HEADER;
+  this->streamPosition = OPUS_HEADER_SIZE;
+  this->totalFileSize = response->totalLength() - SPOTIFY_OPUS_HEADER;
 
   this->decrypt(header.data(), OPUS_HEADER_SIZE, 0);
 
@@ -65,10 +173,19 @@ bool CDNAudioFile::openStream() {
       (this->totalFileSize - OPUS_FOOTER_PREFFERED + SPOTIFY_OPUS_HEADER) -
       (this->totalFileSize - OPUS_FOOTER_PREFFERED + SPOTIFY_OPUS_HEADER) % 16;
 
+  // Vorbis looks at the end of the file before playing, fetch it on the side
   this->footer = std::vector<uint8_t>(
       this->totalFileSize - footerStartLocation + SPOTIFY_OPUS_HEADER);
-  if (!resp->get(cdnUrl, {bell::HTTPClient::RangeHeader::last(footer.size())},
-                 false)) {
+  std::unique_ptr<bell::HTTPClient::Response> resp;
+  do {
+    resp = bell::HTTPClient::get(
+        this->cdnUrl, {bell::HTTPClient::RangeHeader::last(footer.size())},
+        false);
+    this->requestCount++;
+  } while (this->failover(resp->status()));
+  // An error body must not end up decrypted in the header cache
+  if (!resp->stream().isOpen() || resp->status() < 200 ||
+      resp->status() >= 300) {
     return false;
   }
 
@@ -78,13 +195,45 @@ bool CDNAudioFile::openStream() {
     return false;
   }
   this->decrypt(footer.data(), footer.size(), footerStartLocation);
-  this->position = 0;
-  this->lastRequestPosition = 0;
-  this->lastRequestCapacity = 0;
 
+  // Cached when the file closes, not while playback waits on us
+  this->cacheHeaders = true;
+  *footerStart = footerStartLocation;
   return true;
 }
 
+size_t CDNAudioFile::fetchWindow(size_t pos, size_t len, uint8_t* out) {
+  auto start = std::chrono::steady_clock::now();
+
+  // Windows come in order, only a seek needs a new range
+  bool reused =
+      response && response->stream().isOpen() && pos == streamPosition;
+  if (!reused && !this->openRange(pos)) {
+    return 0;
+  }
+
+  size_t got = response->stream().readExact((char*)out, len);
+  if (got != len && reused && this->openRange(pos + got)) {
+    // The CDN drops idle connections, while paused for example; a fresh
+    // range picks up where the old body stopped
+    got += response->stream().readExact((char*)out + got, len - got);
+  }
+  this->streamPosition = pos + got;
+  if (got != len && response) {
+    response->stream().close();
+    response.reset();
+  }
+
+  this->bytesFetched += got;
+  this->fetchMs += std::chrono::duration_cast<std::chrono::milliseconds>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+
+  // Decrypt here, on the read-ahead task, instead of in the decoder's path
+  this->decrypt(out, got, pos);
+  return got;
+}
+
 size_t CDNAudioFile::readBytes(uint8_t* dst, size_t bytes) {
   size_t offsetPosition = position + SPOTIFY_OPUS_HEADER;
   size_t actualFileSize = this->totalFileSize + SPOTIFY_OPUS_HEADER;
@@ -118,50 +267,24 @@ size_t CDNAudioFile::readBytes(uint8_t* dst, size_t bytes) {
     return toReadBytes;
   }
 
-  // Data not in the headers. Make sense of whats going on.
-  // Position in bounds :)
-  if (offsetPosition >= this->lastRequestPosition &&
-      offsetPosition < this->lastRequestPosition + this->lastRequestCapacity) {
-    size_t toRead = bytes;
-
-    if ((toRead + offsetPosition) >
-        this->lastRequestPosition + lastRequestCapacity) {
-      toRead = this->lastRequestPosition + lastRequestCapacity - offsetPosition;
-    }
-
-    memcpy(dst, this->httpBuffer.data() + offsetPosition - lastRequestPosition,
-           toRead);
-    position += toRead;
-
-    return toRead;
-  } else {
-    size_t requestPosition = (offsetPosition) - ((offsetPosition) % 16);
-    if (this->enableRequestMargin && requestPosition > SEEK_MARGIN_SIZE) {
-      requestPosition = (offsetPosition - SEEK_MARGIN_SIZE) -
-                        ((offsetPosition - SEEK_MARGIN_SIZE) % 16);
-      this->enableRequestMargin = false;
-    }
+  if (!this->readAhead) {
+    return 0;
+  }
 
-    if (!resp->get(
-            cdnUrl,
-            {bell::HTTPClient::RangeHeader::range(
-                requestPosition, requestPosition + HTTP_BUFFER_SIZE - 1)},
-            false)) {
-      return 0;
+  // Data not in the headers. After a seek, start reading ahead a bit before
+  // the target, vorbis tends to step back while looking for a page.
+  if (this->enableRequestMargin) {
+    this->enableRequestMargin = false;
+    if (!this->readAhead->covers(offsetPosition)) {
+      this->readAhead->restart(offsetPosition > SEEK_MARGIN_SIZE
+                                   ? offsetPosition - SEEK_MARGIN_SIZE
+                                   : offsetPosition);
     }
-    this->lastRequestPosition = requestPosition;
-    this->lastRequestCapacity = resp->contentLength();
-
-    size_t readBytes = resp->stream().readExact((char*)this->httpBuffer.data(),
-                                                lastRequestCapacity);
-    resp->stream().close();
-    this->decrypt(this->httpBuffer.data(), readBytes,
-                  this->lastRequestPosition);
-
-    return readBytes(dst, bytes);
   }
 
-  return bytes;
+  size_t got = this->readAhead->read(offsetPosition, dst, bytes);
+  position += got;
+  return got;
 }
 
 #else
@@ -174,9 +297,13 @@ size_t CDNAudioFile::readBytes(uint8_t* dst, size_t bytes) {
 uint8_t* CDNAudioFile::openStream(ssize_t& header_size) {
 
   // Open connection, fill first buffer
-  auto resp = bell::HTTPClient::get(
-      this->cdnUrl,
-      {bell::HTTPClient::RangeHeader::range(0, HTTP_BUFFER_SIZE - 1)}, false);
+  std::unique_ptr<bell::HTTPClient::Response> resp;
+  do {
+    resp = bell::HTTPClient::get(
+        this->cdnUrl,
+        {bell::HTTPClient::RangeHeader::range(0, HTTP_BUFFER_SIZE - 1)},
+        false);
+  } while (this->failover(resp->status()));
   if (!resp->stream().isOpen() || resp->status() < 200 ||
       resp->status() >= 300) {
     return nullptr;
@@ -191,9 +318,216 @@ uint8_t* CDNAudioFile::openStream(ssize_t& header_size) {
   this->decrypt(this->httpBuffer.data(), got, this->lastRequestPosition);
   this->position = getHeader();
   header_size = this->position;
+
+  // The identification header gives the rate granule positions count in
+  auto pages = scanPages(httpBuffer.data(), got, 0);
+  if (!pages.empty()) {
+    const uint8_t* page = httpBuffer.data() + pages[0].offset;
+    size_t packet = 27 + page[26];
+    if (pages[0].offset + packet + 16 <= got &&
+        memcmp(page + packet, "\x01vorbis", 7) == 0) {
+      memcpy(&this->sampleRate, page + packet + 12, 4);
+    }
+  }
+  this->audioStart = this->position;
+  indexPages(pages);
+
   return &httpBuffer[0];
 }
 
+std::vector<CDNAudioFile::OggPage> CDNAudioFile::scanPages(const uint8_t* data,
+                                                          size_t len,
+                                                          size_t offset) {
+  std::vector<OggPage> pages;
+  size_t i = 0;
+  while (i + 27 <= len) {
+    const uint8_t* p = data + i;
+    uint32_t serial;
+    memcpy(&serial, p + 14, 4);
+    // Audio bytes can look like a capture pattern, the stream serial and
+    // version byte weed most of those out
+    if (memcmp(p, "OggS", 4) != 0 || p[4] != 0 ||
+        (streamSerial != 0 && serial != streamSerial) ||
+        i + 27 + p[26] > len) {
+      i++;
+      continue;
+    }
+    size_t size = 27 + p[26];
+    for (int seg = 0; seg < p[26]; seg++) {
+      size += p[27 + seg];
+    }
+    if (streamSerial == 0) {
+      streamSerial = serial;
+    }
+    int64_t granule;
+    memcpy(&granule, p + 6, 8);
+    pages.push_back({offset + i, size, granule});
+    // Pages chain, continue right behind this one
+    i += size;
+  }
+  return pages;
+}
+
+void CDNAudioFile::indexPages(const std::vector<OggPage>& pages) {
+  for (auto& page : pages) {
+    if (page.granule < 0 || seekIndex.size() >= SEEK_INDEX_MAX) {
+      continue;
+    }
+    // Keep the index sparse
+    auto next = seekIndex.lower_bound(page.offset);
+    if (next != seekIndex.end() &&
+        next->first - page.offset < (size_t)SEEK_INDEX_SPACING) {
+      continue;
+    }
+    if (next != seekIndex.begin() &&
+        page.offset - std::prev(next)->first < (size_t)SEEK_INDEX_SPACING) {
+      continue;
+    }
+    seekIndex[page.offset] = page.granule;
+  }
+}
+
+ssize_t CDNAudioFile::readRangeToBuffer(size_t requestPosition, size_t length,
+                                        uint8_t* outBuffer) {
+  if (requestPosition >= this->totalFileSize) {
+    return -1;
+  }
+  length = std::min(length, this->totalFileSize - requestPosition);
+  std::unique_ptr<bell::HTTPClient::Response> resp;
+  do {
+    resp = bell::HTTPClient::get(
+        cdnUrl,
+        {bell::HTTPClient::RangeHeader::range(requestPosition,
+                                              requestPosition + length - 1)},
+        false);
+  } while (this->failover(resp->status()));
+  if (!resp->stream().isOpen() || resp->status() < 200 ||
+      resp->status() >= 300) {
+    return -1;
+  }
+  size_t got = resp->stream().readExact(
+      (char*)outBuffer, std::min<size_t>(length, resp->contentLength()));
+  resp->stream().close();
+  this->decrypt(outBuffer, got, requestPosition);
+  return (ssize_t)got;
+}
+
+bool CDNAudioFile::probePages(size_t from, std::vector<OggPage>* pages) {
+  ssize_t got = readRangeToBuffer(from, HTTP_BUFFER_SIZE, httpBuffer.data());
+  if (got <= 0) {
+    return false;
+  }
+  *pages = scanPages(httpBuffer.data(), got, from);
+  indexPages(*pages);
+  return true;
+}
+
+bool CDNAudioFile::seekMs(uint32_t ms, uint32_t* landedMs) {
+  if (this->sampleRate == 0 || this->totalFileSize == 0) {
+    return false;
+  }
+  const int64_t target = (int64_t)ms * sampleRate / 1000;
+  int requests = 0;
+  std::vector<OggPage> pages;
+
+  // Bracket the target with what the index knows already
+  size_t lo = audioStart, hi = totalFileSize;
+  int64_t loGranule = 0, hiGranule = -1;
+  for (auto& [offset, granule] : seekIndex) {
+    if (granule <= target && offset >= lo) {
+      lo = offset;
+      loGranule = granule;
+    } else if (granule > target && offset < hi) {
+      hi = offset;
+      hiGranule = granule;
+      break;
+    }
+  }
+
+  auto narrow = [&]() {
+    bool narrowed = false;
+    for (auto& page : pages) {
+      if (page.granule < 0 || page.offset <= lo || page.offset >= hi) {
+        continue;
+      }
+      narrowed = true;
+      if (page.granule <= target) {
+        lo = page.offset;
+        loGranule = page.granule;
+      } else {
+        hi = page.offset;
+        hiGranule = page.granule;
+        break;
+      }
+    }
+    return narrowed;
+  };
+
+  // The last page carries the length of the track
+  if (hiGranule < 0 && totalFileSize - lo > (size_t)HTTP_BUFFER_SIZE &&
+      probePages(totalFileSize - HTTP_BUFFER_SIZE, &pages)) {
+    requests++;
+    narrow();
+  }
+
+  // Interpolate between the bracket ends, then refine with what the probe
+  // finds until the rest fits into a single walk
+  while (hi - lo > (size_t)HTTP_BUFFER_SIZE && requests < SEEK_MAX_PROBES) {
+    size_t probe = lo + (hi - lo) / 2;
+    if (hiGranule > loGranule) {
+      probe = lo + (size_t)((double)(target - loGranule) /
+                            (double)(hiGranule - loGranule) * (hi - lo));
+    }
+    probe = std::min(std::max(probe, lo + 1), hi - HTTP_BUFFER_SIZE / 2);
+    if (!probePages(probe, &pages)) {
+      return false;
+    }
+    requests++;
+    if (!narrow()) {
+      // Nothing usable in the probe, close in from above
+      hi = probe;
+    }
+  }
+
+  // Walk page by page from lo: resume behind the last page ending at or
+  // before the target
+  size_t landing = lo;
+  int64_t landedGranule = 0;
+  size_t walk = lo;
+  bool done = false;
+  while (!done && walk < totalFileSize && requests < SEEK_MAX_PROBES + 4) {
+    if (!probePages(walk, &pages) || pages.empty() ||
+        pages[0].offset != walk) {
+      break;
+    }
+    requests++;
+    for (auto& page : pages) {
+      if (page.offset + page.size > walk + HTTP_BUFFER_SIZE) {
+        break;  // incomplete, next round starts here
+      }
+      if (page.granule > target) {
+        done = true;
+        break;
+      }
+      if (page.granule >= 0) {
+        landing = page.offset + page.size;
+        landedGranule = page.granule;
+      }
+      walk = page.offset + page.size;
+    }
+    if (walk == pages[0].offset) {
+      break;  // page larger than a probe
+    }
+  }
+
+  this->position = landing;
+  this->enableRequestMargin = true;
+  *landedMs = (uint32_t)(landedGranule * 1000 / sampleRate);
+  SC32_LOG(info, "Seek to %u ms landed at %u ms after %d requests",
+           (unsigned)ms, (unsigned)*landedMs, requests);
+  return true;
+}
+
 /**
  * @brief Finds the position of the first audio frame in the HTTP response.
  *
@@ -244,15 +578,23 @@ long CDNAudioFile::readBytes(uint8_t* dst, size_t bytes) {
   bytes = bytes - bytes % 16;
   if (this->enableRequestMargin) {
     if (response) {
-      response->drainBody();
+      // Open-ended body, draining would download the rest of the file
       response->stream().close();
       response.reset();
     }
     this->enableRequestMargin = false;
   }
   if (!response || !response->stream().isOpen()) {
-    response = bell::HTTPClient::get(
-        cdnUrl, {bell::HTTPClient::RangeHeader::open(requestPosition)}, false);
+    if (!this->openRange(requestPosition)) {
+      return -1;
+    }
+    // Seeks land on page boundaries, drop what precedes it in the block
+    uint8_t skip[16];
+    size_t toSkip = position - requestPosition;
+    if (toSkip && response->readExact(skip, toSkip) != toSkip) {
+      response.reset();
+      return -1;
+    }
   }
   size_t got = response->readExact(dst, bytes);
   if (got != bytes) {
@@ -261,6 +603,7 @@ long CDNAudioFile::readBytes(uint8_t* dst, size_t bytes) {
     response.reset();
   }
   this->decrypt(dst, got, this->position);
+  indexPages(scanPages(dst, got, this->position));
   this->position += got;
   return (long)got;
 }
@@ -271,10 +614,15 @@ size_t CDNAudioFile::getSize() {
 }
 
 void CDNAudioFile::decrypt(uint8_t* dst, size_t nbytes, size_t pos) {
-  if (audioKey.size() != 16 && audioKey.size() != 24 && audioKey.size() != 32) {
+  if (!this->cipher->valid()) {
     throw std::runtime_error("Invalid AES key length");
   }
-  auto calculatedIV = bigNumAdd(audioAESIV, pos / 16);
+  auto start = std::chrono::steady_clock::now();
+
+  this->cipher->xcrypt(dst, nbytes, pos);
 
-  this->crypto->aesCTRXcrypt(this->audioKey, calculatedIV, dst, nbytes);
+  this->decryptBytes += nbytes;
+  this->decryptUs += std::chrono::duration_cast<std::chrono::microseconds>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
 }
\ No newline at end of file
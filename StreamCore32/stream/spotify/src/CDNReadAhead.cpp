@@ -0,0 +1,225 @@
+#include "CDNReadAhead.h"
+
+#include <string.h>   // for memcpy
+#include <algorithm>  // for min
+#include <chrono>     // for steady_clock, milliseconds
+
+#include "BellUtils.h"  // for BELL_SLEEP_MS
+
+using namespace spotify;
+
+CDNReadAhead::CDNReadAhead(Fetch fetch, size_t minWindow, size_t memory,
+                           size_t start, size_t end)
+    : bell::Task("spotify_readahead", 1024 * 12, 4, 1),
+      fetch(fetch),
+      minWindow(minWindow),
+      maxWindow(std::max(minWindow, (memory / WINDOW_COUNT) & ~(size_t)15)),
+      windowSize(minWindow),
+      end(end),
+      startedAt(std::chrono::steady_clock::now()) {
+  nextPosition = start - (start % 16);
+  readPosition = start;
+  isRunning = true;
+  startTask();
+}
+
+CDNReadAhead::~CDNReadAhead() {
+  wantStop = true;
+  dataReady.notify_all();
+  // A fetch in flight has to land before the windows go away
+  while (isRunning) {
+    BELL_SLEEP_MS(10);
+  }
+}
+
+CDNReadAhead::Window* CDNReadAhead::findLocked(size_t pos) {
+  for (auto& window : windows) {
+    if (window.state != WindowState::EMPTY &&
+        window.generation == generation && pos >= window.pos &&
+        pos < window.pos + window.len) {
+      return &window;
+    }
+  }
+  return nullptr;
+}
+
+size_t CDNReadAhead::bufferedLocked(size_t pos) {
+  size_t buffered = 0;
+  for (auto& window : windows) {
+    if (window.state == WindowState::READY &&
+        window.generation == generation && window.pos + window.len > pos) {
+      buffered += window.pos + window.len - std::max(window.pos, pos);
+    }
+  }
+  return buffered;
+}
+
+void CDNReadAhead::restartLocked(size_t pos) {
+  generation++;
+  for (auto& window : windows) {
+    // Loading windows are dropped by the worker once their fetch returns
+    if (window.state == WindowState::LOADING) {
+      continue;
+    }
+    if (window.state == WindowState::READY &&
+        window.pos + window.len > readPosition) {
+      counters.cancelled++;
+    }
+    window.state = WindowState::EMPTY;
+  }
+  nextPosition = pos - (pos % 16);
+  // Whatever comes after a seek is needed right away
+  windowSize = minWindow;
+}
+
+void CDNReadAhead::resizeLocked(size_t got, uint32_t ms) {
+  float rate = (float)got / std::max<uint32_t>(ms, 1);
+  bytesPerMs = bytesPerMs > 0 ? (bytesPerMs * 3 + rate) / 4 : rate;
+
+  if (ms > MAX_FETCH_MS) {
+    windowSize = std::max(minWindow, windowSize / 2);
+  } else {
+    size_t affordable = (size_t)(bytesPerMs * MAX_FETCH_MS);
+    windowSize = std::max(
+        minWindow, std::min({windowSize * 2, affordable, maxWindow}));
+  }
+  windowSize -= windowSize % 16;
+}
+
+void CDNReadAhead::restart(size_t pos) {
+  {
+    std::scoped_lock lock(dataMutex);
+    restartLocked(pos);
+  }
+  dataReady.notify_all();
+}
+
+bool CDNReadAhead::covers(size_t pos) {
+  std::scoped_lock lock(dataMutex);
+  return findLocked(pos) != nullptr ||
+         (pos >= nextPosition && pos - nextPosition < windowSize);
+}
+
+size_t CDNReadAhead::read(size_t pos, uint8_t* dst, size_t bytes) {
+  if (pos >= end || bytes == 0) {
+    return 0;
+  }
+
+  auto waitStart = std::chrono::steady_clock::now();
+  bool stalled = false;
+  size_t got = 0;
+
+  std::unique_lock lock(dataMutex);
+  readPosition = pos;
+  while (!wantStop) {
+    Window* window = findLocked(pos);
+    if (window != nullptr && window->state == WindowState::READY) {
+      got = std::min(bytes, window->pos + window->len - pos);
+      memcpy(dst, window->data.data() + (pos - window->pos), got);
+      aheadSum += bufferedLocked(pos + got);
+      aheadSamples++;
+      break;
+    }
+    if (window != nullptr && window->state == WindowState::FAILED) {
+      break;
+    }
+    if (window == nullptr &&
+        (pos < nextPosition || pos - nextPosition >= windowSize)) {
+      // Nothing planned around pos, the decoder jumped
+      restartLocked(pos);
+    }
+
+    // Moving readPosition may have freed a window for the worker
+    stalled = true;
+    dataReady.notify_all();
+    dataReady.wait_for(lock, std::chrono::milliseconds(100));
+  }
+
+  if (stalled) {
+    counters.stalls++;
+    counters.stallMs += std::chrono::duration_cast<std::chrono::milliseconds>(
+                            std::chrono::steady_clock::now() - waitStart)
+                            .count();
+  }
+  lock.unlock();
+
+  // Let the worker refill the window this read may have finished
+  dataReady.notify_all();
+  return got;
+}
+
+CDNReadAhead::Stats CDNReadAhead::stats() {
+  std::scoped_lock lock(dataMutex);
+  Stats current = counters;
+  current.uptimeMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                         std::chrono::steady_clock::now() - startedAt)
+                         .count();
+  current.avgAhead = aheadSamples ? (size_t)(aheadSum / aheadSamples) : 0;
+  return current;
+}
+
+void CDNReadAhead::runTask() {
+  while (!wantStop) {
+    Window* window = nullptr;
+    size_t pos = 0;
+    size_t len = 0;
+    {
+      std::unique_lock lock(dataMutex);
+      if (nextPosition < end) {
+        for (auto& candidate : windows) {
+          // Free, stale, or fully behind the decoder
+          if (candidate.state != WindowState::LOADING &&
+              (candidate.state == WindowState::EMPTY ||
+               candidate.generation != generation ||
+               candidate.pos + candidate.len <= readPosition)) {
+            window = &candidate;
+            break;
+          }
+        }
+      }
+      if (window == nullptr) {
+        dataReady.wait_for(lock, std::chrono::milliseconds(100));
+        continue;
+      }
+      pos = nextPosition;
+      len = std::min(windowSize, end - pos);
+      window->pos = pos;
+      window->len = len;
+      window->generation = generation;
+      window->state = WindowState::LOADING;
+      nextPosition += len;
+    }
+
+    // Only the worker touches a loading window, grow it outside the lock
+    if (window->data.size() < len) {
+      window->data.resize(len);
+    }
+    auto fetchStart = std::chrono::steady_clock::now();
+    size_t got = fetch(pos, len, window->data.data());
+    uint32_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                      std::chrono::steady_clock::now() - fetchStart)
+                      .count();
+
+    {
+      std::scoped_lock lock(dataMutex);
+      counters.windows++;
+      counters.busyMs += ms;
+      counters.peakWindow = std::max(counters.peakWindow, len);
+      if (window->generation != generation) {
+        counters.cancelled++;
+        window->state = WindowState::EMPTY;
+      } else if (got == 0) {
+        window->state = WindowState::FAILED;
+      } else {
+        window->len = got;
+        window->state = WindowState::READY;
+        // A short window ends early, the next one starts where it stopped
+        nextPosition = pos + got;
+        resizeLocked(got, ms);
+      }
+    }
+    dataReady.notify_all();
+  }
+
+  isRunning = false;
+}
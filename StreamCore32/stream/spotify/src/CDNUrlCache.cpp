@@ -0,0 +1,189 @@
+#include "CDNUrlCache.h"
+
+#include <stdlib.h>  // for strtoul
+#include <string.h>  // for strlen
+#include <ctime>     // for time
+#include <iterator>  // for next
+
+#include "Logger.h"  // for SC32_LOG
+#include "Utils.h"   // for bytesToHexString
+
+using namespace spotify;
+
+namespace {
+// Same validity threshold as the web stream caches (2019-01-01)
+const std::time_t VALID_CLOCK = 1546300800;
+
+// Epoch seconds right after marker in url, 0 if there are none
+unsigned long timestampAfter(const std::string& url, const char* marker) {
+  size_t at = url.find(marker);
+  if (at == std::string::npos) {
+    return 0;
+  }
+  return strtoul(url.c_str() + at + strlen(marker), nullptr, 10);
+}
+}  // namespace
+
+CDNUrlCache& CDNUrlCache::shared() {
+  static CDNUrlCache cache;
+  return cache;
+}
+
+bool CDNUrlCache::secondsLeft(const std::string& url, uint32_t* left) {
+  std::time_t now = std::time(nullptr);
+  if (now < VALID_CLOCK) {
+    return false;
+  }
+  // Akamai tokens, CloudFront signatures, then Fastly's ?<expiry>_<hash>
+  unsigned long expiry = timestampAfter(url, "exp=");
+  if (expiry == 0) {
+    expiry = timestampAfter(url, "Expires=");
+  }
+  if (expiry == 0) {
+    size_t query = url.find('?');
+    if (query != std::string::npos &&
+        url.find('_', query) == query + 11) {
+      expiry = timestampAfter(url, "?");
+    }
+  }
+  if (expiry < (unsigned long)VALID_CLOCK) {
+    return false;
+  }
+  *left = expiry > (unsigned long)now ? expiry - now : 0;
+  return true;
+}
+
+void CDNUrlCache::store(const std::vector<uint8_t>& fileId,
+                        const std::vector<std::string>& urls, uint32_t ttlS,
+                        bool refresh) {
+  auto now = std::chrono::steady_clock::now();
+  Entry entry;
+  entry.lastUsed = now;
+  for (auto& url : urls) {
+    uint32_t left = 0;
+    if (!secondsLeft(url, &left)) {
+      left = ttlS != 0 ? ttlS : DEFAULT_TTL_S;
+    }
+    entry.urls.push_back({url, now + std::chrono::seconds(left)});
+  }
+
+  std::scoped_lock lock(cacheMutex);
+  if (counters.resolves == 0) {
+    firstResolve = now;
+  }
+  counters.resolves++;
+  if (refresh) {
+    counters.refreshes++;
+  }
+  entries[bytesToHexString(fileId)] = std::move(entry);
+  evictLocked();
+
+  auto hours =
+      std::chrono::duration_cast<std::chrono::minutes>(now - firstResolve)
+          .count() /
+      60.0f;
+  // A rate over the first minutes says little, report the count until then
+  counters.resolvesPerHour =
+      hours > 0.25f ? (uint32_t)(counters.resolves / hours) : counters.resolves;
+  SC32_LOG(info,
+           "Storage-resolve: %u calls (%u/h), %u avoided, %u refreshes, "
+           "%u failovers",
+           (unsigned)counters.resolves, (unsigned)counters.resolvesPerHour,
+           (unsigned)counters.reused, (unsigned)counters.refreshes,
+           (unsigned)counters.failovers);
+}
+
+bool CDNUrlCache::load(const std::vector<uint8_t>& fileId, std::string* url) {
+  auto validUntil =
+      std::chrono::steady_clock::now() + std::chrono::seconds(MIN_VALID_S);
+  std::scoped_lock lock(cacheMutex);
+  auto it = entries.find(bytesToHexString(fileId));
+  if (it == entries.end()) {
+    return false;
+  }
+  for (auto& [candidate, expiresAt] : it->second.urls) {
+    if (expiresAt > validUntil) {
+      it->second.lastUsed = std::chrono::steady_clock::now();
+      *url = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool CDNUrlCache::claimRefresh(const std::vector<uint8_t>& fileId) {
+  auto now = std::chrono::steady_clock::now();
+  auto refreshAt = now + std::chrono::seconds(REFRESH_BEFORE_S);
+  std::scoped_lock lock(cacheMutex);
+  auto it = entries.find(bytesToHexString(fileId));
+  if (it == entries.end() ||
+      now - it->second.refreshClaimed <
+          std::chrono::seconds(REFRESH_RETRY_S)) {
+    return false;
+  }
+  for (auto& url : it->second.urls) {
+    if (url.second > refreshAt) {
+      return false;
+    }
+  }
+  // A failed refresh is retried later, not on every idle pass
+  it->second.refreshClaimed = now;
+  return true;
+}
+
+bool CDNUrlCache::failover(const std::vector<uint8_t>& fileId,
+                           const std::string& failedUrl, std::string* next) {
+  auto now = std::chrono::steady_clock::now();
+  std::scoped_lock lock(cacheMutex);
+  auto it = entries.find(bytesToHexString(fileId));
+  if (it == entries.end()) {
+    return false;
+  }
+  auto& urls = it->second.urls;
+  for (auto url = urls.begin(); url != urls.end(); url++) {
+    if (url->first == failedUrl) {
+      urls.erase(url);
+      counters.failovers++;
+      break;
+    }
+  }
+  for (auto& [candidate, expiresAt] : urls) {
+    if (expiresAt > now) {
+      *next = candidate;
+      return true;
+    }
+  }
+  // Nothing left to try, the next play resolves again
+  entries.erase(it);
+  return false;
+}
+
+void CDNUrlCache::noteReused() {
+  std::scoped_lock lock(cacheMutex);
+  counters.reused++;
+}
+
+CDNUrlCache::Stats CDNUrlCache::stats() {
+  std::scoped_lock lock(cacheMutex);
+  return counters;
+}
+
+void CDNUrlCache::evictLocked() {
+  auto now = std::chrono::steady_clock::now();
+  for (auto it = entries.begin(); it != entries.end();) {
+    bool expired = true;
+    for (auto& url : it->second.urls) {
+      expired = expired && url.second <= now;
+    }
+    it = expired ? entries.erase(it) : std::next(it);
+  }
+  while (entries.size() > MAX_ENTRIES) {
+    auto oldest = entries.begin();
+    for (auto it = entries.begin(); it != entries.end(); it++) {
+      if (it->second.lastUsed < oldest->second.lastUsed) {
+        oldest = it;
+      }
+    }
+    entries.erase(oldest);
+  }
+}
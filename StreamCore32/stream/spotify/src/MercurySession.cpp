@@ -1,10 +1,12 @@
 #include "MercurySession.h"
 
 #include <string.h>     // for memcpy
+#include <algorithm>    // for find_if
+#include <chrono>       // for steady_clock
 #include <memory>       // for shared_ptr
 #include <mutex>        // for scoped_lock
 #include <stdexcept>    // for runtime_error
-#include <type_traits>  // for remove_extent_t, __underlying_type_impl<>:...
+#include <type_traits>  // for is_integral
 #include <utility>      // for pair
 #ifndef _WIN32
 #include <arpa/inet.h>  // for htons, ntohs, htonl, ntohl
@@ -22,32 +24,77 @@
 
 using namespace spotify;
 
-template <typename T>
-T extractData(const std::vector<uint8_t>& data, size_t& pos) {
-  static_assert(std::is_integral<T>::value,
-                "extractData only supports integral types");
+namespace {
+// Walks a received Mercury frame in place, parts are handed out as pointers
+// into the packet buffer
+class FrameReader {
+ public:
+  FrameReader(const std::vector<uint8_t>& data) : data(data) {}
+
+  template <typename T>
+  bool read(T* value) {
+    static_assert(std::is_integral<T>::value,
+                  "FrameReader only reads integral types");
+    if (this->pos + sizeof(T) > this->data.size()) {
+      return false;
+    }
+    memcpy(value, &this->data[this->pos], sizeof(T));
+    this->pos += sizeof(T);
+
+    // Convert to host byte order based on the size of T
+    if constexpr (sizeof(T) == 2) {
+      *value = ntohs(*value);
+    } else if constexpr (sizeof(T) == 4) {
+      *value = ntohl(*value);
+    } else if constexpr (sizeof(T) == 8) {
+      *value = hton64(*value);
+    }
+    return true;
+  }
 
-  // Check that we have enough bytes to extract
-  if (pos + sizeof(T) > data.size()) {
-    throw std::out_of_range("Not enough data to extract");
+  bool readPart(const uint8_t** part, uint16_t* partSize) {
+    if (!this->read(partSize) || this->pos + *partSize > this->data.size()) {
+      return false;
+    }
+    *part = this->data.data() + this->pos;
+    this->pos += *partSize;
+    return true;
   }
 
-  T value;
-  memcpy(&value, &data[pos], sizeof(T));
-  pos += sizeof(T);
-
-  // Convert to host byte order based on the size of T
-  if constexpr (sizeof(T) == 2) {
-    return ntohs(value);
-  } else if constexpr (sizeof(T) == 4) {
-    return ntohl(value);
-  } else if constexpr (sizeof(T) == 8) {
-    return hton64(
-        value);  // Assuming you have defined `hton64` similarly to `htonl` for 64-bit values
-  } else {
-    return 0;  //   static_assert(false, "Unsupported type size for extractData");
+  bool atEnd() { return this->pos == this->data.size(); }
+
+ private:
+  const std::vector<uint8_t>& data;
+  size_t pos = 0;
+};
+
+struct RetryPolicy {
+  const char* prefix;
+  uint32_t timeoutMs;
+  uint8_t retries;  // applied to GET requests only
+};
+
+const RetryPolicy RETRY_POLICIES[] = {
+    // Track loading waits on these
+    {"hm://metadata/", 5000, 2},
+    {"hm://context-resolve/", 8000, 1},
+    {"hm://autoplay-enabled/", 8000, 1},
+    {"hm://radio-apollo/", 8000, 1},
+    // The next state put supersedes a lost one
+    {"hm://connect-state/", 8000, 0},
+    {"hm://event-service/", 10000, 0},
+};
+const RetryPolicy DEFAULT_RETRY_POLICY = {"", 10000, 0};
+
+const RetryPolicy& retryPolicy(const std::string& uri) {
+  for (auto& policy : RETRY_POLICIES) {
+    if (uri.rfind(policy.prefix, 0) == 0) {
+      return policy;
+    }
   }
+  return DEFAULT_RETRY_POLICY;
 }
+}  // namespace
 
 MercurySession::MercurySession(std::shared_ptr<TimeProvider> timeProvider)
     : bell::Task("spotify_mercury_session", 8 * 1024, 3,
@@ -86,10 +133,14 @@ bool MercurySession::processPackets() {
       this->lastPingTimestamp = timeProvider->getSyncedTimestamp();
       this->shanConn->sendPacket(0x49, packet.data);
     } else if (packet.data.size()) {
-      std::unique_lock<std::mutex> lock(queueMutex);
-      this->packetQueue.push_back(packet);
+      // Only fills up when the dispatcher stalls, wait for it to catch up
+      while (!this->packetQueue.push(packet)) {
+        if (!isRunning) {
+          return true;
+        }
+        BELL_SLEEP_MS(1);
+      }
       this->lastPingTimestamp = timeProvider->getSyncedTimestamp();
-      lock.unlock();  // Optional, the destructor will unlock it
       this->responseSemaphore->give();
     }
     return true;
@@ -193,14 +244,20 @@ std::string MercurySession::getCountryCode() {
 }
 
 void MercurySession::handlePacket() {
-  if (!this->responseSemaphore->twait(200))
-    return;
-  std::unique_lock<std::mutex> lock(queueMutex);
-  if (!packetQueue.size())
+  // Returns early once a packet is queued, the timeout paces the deadlines
+  this->responseSemaphore->twait(200);
+  this->expireRequests();
+
+  Packet packet;
+  if (!this->packetQueue.pop(packet))
     return;
-  Packet packet = std::move(*packetQueue.begin());
-  packetQueue.pop_front();
-  lock.unlock();  // Optional, the destructor will unlock it
+
+  auto stats = this->packetQueue.stats();
+  if (stats.dispatched % DISPATCH_LOG_EVERY == 0) {
+    SC32_LOG(debug, "Dispatched %u packets, latency avg %uus max %uus, %u full",
+             (unsigned)stats.dispatched, (unsigned)stats.avgLatencyUs,
+             (unsigned)stats.maxLatencyUs, (unsigned)stats.full);
+  }
 
   if (executeEstabilishedCallback && this->connectionReadyCallback != nullptr) {
     executeEstabilishedCallback = false;
@@ -222,10 +279,25 @@ void MercurySession::handlePacket() {
       // First four bytes mark the sequence id
       auto seqId = ntohl(extract<uint32_t>(packet.data, 0));
 
-      if (this->audioKeyCallbacks.count(seqId) > 0) {
+      std::unique_lock<std::mutex> lock(callbackMutex);
+      AudioKeyCallback callbackToExecute = nullptr;
+      auto it = this->audioKeyCallbacks.find(seqId);
+      if (it != this->audioKeyCallbacks.end()) {
+        callbackToExecute = std::move(it->second);
+        this->audioKeyCallbacks.erase(it);
+      } else if (std::find(expiredAudioKeys.begin(), expiredAudioKeys.end(),
+                           seqId) != expiredAudioKeys.end()) {
+        this->timeoutCounters.lateResponses++;
+        SC32_LOG(info, "Audio key %u answered after its deadline",
+                 (unsigned)seqId);
+      }
+      lock.unlock();
+      if (callbackToExecute) {
         auto success = static_cast<RequestType>(packet.command) ==
                        RequestType::AUDIO_KEY_SUCCESS_RESPONSE;
-        this->audioKeyCallbacks[seqId](success, packet.data);
+        callbackToExecute(
+            success ? ResponseError::NONE : ResponseError::FAILED,
+            packet.data);
       }
       break;
     }
@@ -238,9 +310,11 @@ void MercurySession::handlePacket() {
         std::function<void(Response)> callbackToExecute = nullptr;
         auto it = this->callbacks.find(response.sequenceId);
         if (it != this->callbacks.end()) {
-          callbackToExecute =
-              std::move(it->second);  // Move the callback out of the map
+          callbackToExecute = std::move(
+              it->second.callback);   // Move the callback out of the map
           this->callbacks.erase(it);  // Remove the callback entry from the map
+        } else {
+          noteLateLocked(response.sequenceId);
         }
         lock.unlock();
         if (callbackToExecute) {
@@ -286,82 +360,207 @@ void MercurySession::failAllPending() {
   std::scoped_lock<std::mutex> lock(callbackMutex);
   // Fail all callbacks
   for (auto& it : this->callbacks) {
-    it.second(response);
+    response.sequenceId = it.first;
+    it.second.callback(response);
   }
 
   // Remove references
   this->callbacks = {};
 }
 
+void MercurySession::expireRequests() {
+  std::vector<uint64_t> expired;
+  this->requestTimeouts.advance(expired);
+  for (auto key : expired) {
+    std::unique_lock<std::mutex> lock(callbackMutex);
+    auto it = this->callbacks.find((uint16_t)key);
+    if (it == this->callbacks.end()) {
+      continue;  // answered or unregistered in time
+    }
+    auto& request = it->second;
+    if (request.retriesLeft > 0) {
+      request.retriesLeft--;
+      this->timeoutCounters.retries++;
+      SC32_LOG(info, "No answer from %s, sending again",
+               request.uri.c_str());
+      // Same sequence id, whichever answer comes first completes it
+      auto packet = request.retriesLeft > 0 ? request.packet
+                                            : std::move(request.packet);
+      auto command = request.command;
+      this->requestTimeouts.schedule(key, request.timeoutMs);
+      lock.unlock();
+      try {
+        if (!isReconnecting && this->shanConn) {
+          this->shanConn->sendPacket(command, packet);
+        }
+      } catch (...) {
+        // The reconnect fails every pending request
+      }
+      continue;
+    }
+
+    SC32_LOG(error, "Request to %s timed out", request.uri.c_str());
+    auto callbackToExecute = std::move(request.callback);
+    this->callbacks.erase(it);
+    this->timeoutCounters.timeouts++;
+    this->expiredRequests.push_back(key);
+    if (this->expiredRequests.size() > EXPIRED_HISTORY) {
+      this->expiredRequests.pop_front();
+    }
+    lock.unlock();
+
+    Response response;
+    response.sequenceId = key;
+    response.error = ResponseError::TIMEOUT;
+    callbackToExecute(response);
+  }
+
+  expired.clear();
+  this->audioKeyTimeouts.advance(expired);
+  for (auto key : expired) {
+    std::unique_lock<std::mutex> lock(callbackMutex);
+    auto it = this->audioKeyCallbacks.find((uint32_t)key);
+    if (it == this->audioKeyCallbacks.end()) {
+      continue;
+    }
+    SC32_LOG(error, "Audio key %u timed out", (unsigned)key);
+    auto callbackToExecute = std::move(it->second);
+    this->audioKeyCallbacks.erase(it);
+    this->timeoutCounters.audioKeyTimeouts++;
+    this->expiredAudioKeys.push_back(key);
+    if (this->expiredAudioKeys.size() > EXPIRED_HISTORY) {
+      this->expiredAudioKeys.pop_front();
+    }
+    lock.unlock();
+    callbackToExecute(ResponseError::TIMEOUT, {});
+  }
+}
+
+void MercurySession::noteLateLocked(uint16_t sequenceId) {
+  if (std::find(expiredRequests.begin(), expiredRequests.end(), sequenceId) !=
+      expiredRequests.end()) {
+    this->timeoutCounters.lateResponses++;
+    SC32_LOG(info, "Sequence id %u answered after its deadline",
+             (unsigned)sequenceId);
+  }
+}
+
+MercurySession::TimeoutStats MercurySession::timeoutStats() {
+  std::scoped_lock lock(callbackMutex);
+  auto stats = this->timeoutCounters;
+  stats.pending = this->requestTimeouts.size() + this->audioKeyTimeouts.size();
+  return stats;
+}
+
 MercurySession::Response MercurySession::decodeResponse(
-    const std::vector<uint8_t>& data) {
-  size_t pos = 0;
-  auto sequenceLength = extractData<uint16_t>(data, pos);
-  uint64_t sequenceId;
-  uint8_t flag;
+    std::vector<uint8_t>& data) {
+  auto startedAt = std::chrono::steady_clock::now();
+  FrameReader frame(data);
   Response resp;
-  resp.mercuryHeader = Header_init_default;
-  if (sequenceLength == 2)
-    sequenceId = extractData<uint16_t>(data, pos);
-  else if (sequenceLength == 4)
-    sequenceId = extractData<uint32_t>(data, pos);
-  else if (sequenceLength == 8)
-    sequenceId = extractData<uint64_t>(data, pos);
-  else
+  uint16_t sequenceLength = 0;
+  uint64_t sequenceId = 0;
+  uint8_t flag = 0;
+  uint16_t parts = 0;
+
+  bool readSequence = false;
+  if (frame.read(&sequenceLength)) {
+    if (sequenceLength == 2) {
+      uint16_t id;
+      readSequence = frame.read(&id);
+      sequenceId = id;
+    } else if (sequenceLength == 4) {
+      uint32_t id;
+      readSequence = frame.read(&id);
+      sequenceId = id;
+    } else if (sequenceLength == 8) {
+      readSequence = frame.read(&sequenceId);
+    }
+  }
+  if (!readSequence || !frame.read(&flag) || !frame.read(&parts)) {
+    SC32_LOG(error, "Malformed mercury frame of %u bytes",
+             (unsigned)data.size());
     return resp;
+  }
 
-  flag = (uint8_t)data[pos];
-  pos++;
-  uint16_t parts = extractData<uint16_t>(data, pos);
   auto partial = std::find_if(
       partials.begin(), partials.end(),
       [sequenceId](const Response& p) { return p.sequenceId == sequenceId; });
+  // A frame flagged PARTIAL leaves its last part open, the first part of the
+  // next frame with the same sequence continues it
+  bool continued = partial != partials.end() && !partial->parts.empty();
   if (partial == partials.end()) {
-    if (flag == 2)
-      return resp;
     this->partials.push_back(Response());
     partial = partials.end() - 1;
-    partial->parts = {};
     partial->sequenceId = sequenceId;
+  } else {
+    this->decodeCounters.partialFrames++;
   }
-  uint8_t index = 0;
-  while (parts) {
-    if (data.size() <= pos)
-      break;
-    auto partSize = extractData<uint16_t>(data, pos);
-    if (partial->mercuryHeader.uri == NULL) {
-      auto headerBytes = std::vector<uint8_t>(data.begin() + pos,
-                                              data.begin() + pos + partSize);
-      pbDecode(partial->mercuryHeader, Header_fields, headerBytes);
-      pb_istream_t stream =
-          pb_istream_from_buffer(&headerBytes[0], headerBytes.size());
 
-      // Decode the message
+  for (uint16_t index = 0; index < parts; index++) {
+    const uint8_t* part = nullptr;
+    uint16_t partSize = 0;
+    if (!frame.readPart(&part, &partSize)) {
+      SC32_LOG(error, "Truncated mercury frame, sequence id %llu",
+               (unsigned long long)sequenceId);
+      pb_release(Header_fields, &partial->mercuryHeader);
+      partials.erase(partial);
+      return resp;
+    }
+
+    if (partial->mercuryHeader.uri == NULL) {
+      // Decoded straight out of the packet buffer
+      pb_istream_t stream = pb_istream_from_buffer(part, partSize);
       if (pb_decode(&stream, Header_fields, &partial->mercuryHeader) == false) {
         pb_release(Header_fields, &partial->mercuryHeader);
         partials.erase(partial);
         return resp;
       }
+    } else if (continued && index == 0) {
+      partial->parts.back().insert(partial->parts.back().end(), part,
+                                   part + partSize);
+      this->decodeCounters.copiedBytes += partSize;
+    } else if (index + 1 == parts && frame.atEnd()) {
+      // The part runs to the end of the packet, keep the packet buffer
+      // instead of allocating another one
+      data.erase(data.begin(), data.begin() + (part - data.data()));
+      partial->parts.push_back(std::move(data));
+      this->decodeCounters.adoptedBytes += partSize;
+      break;
     } else {
-      if (index >= partial->parts.size())
-        partial->parts.push_back(std::vector<uint8_t>{});
-      partial->parts[index].insert(partial->parts[index].end(),
-                                   data.begin() + pos,
-                                   data.begin() + pos + partSize);
-      index++;
+      partial->parts.emplace_back(part, part + partSize);
+      this->decodeCounters.copiedBytes += partSize;
     }
-    pos += partSize;
-    parts--;
   }
-  if (flag == static_cast<uint8_t>(ResponseFlag::FINAL) &&
-      partial->mercuryHeader.uri != NULL) {
-    resp = std::move(*partial);
+
+  this->decodeCounters.frames++;
+  if (flag == static_cast<uint8_t>(ResponseFlag::FINAL)) {
+    if (partial->mercuryHeader.uri != NULL) {
+      resp = std::move(*partial);
+      resp.fail = false;
+      resp.error = ResponseError::NONE;
+    } else {
+      pb_release(Header_fields, &partial->mercuryHeader);
+    }
     partials.erase(partial);
-    resp.fail = false;
   }
+  this->decodeCounters.decodeUs +=
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - startedAt)
+          .count();
   return resp;
 }
 
+MercurySession::DecodeStats MercurySession::decodeStats() {
+  DecodeStats stats;
+  stats.frames = this->decodeCounters.frames;
+  stats.partialFrames = this->decodeCounters.partialFrames;
+  stats.copiedBytes = this->decodeCounters.copiedBytes;
+  stats.adoptedBytes = this->decodeCounters.adoptedBytes;
+  stats.avgDecodeUs =
+      stats.frames ? this->decodeCounters.decodeUs / stats.frames : 0;
+  return stats;
+}
+
 void MercurySession::addSubscriptionListener(const std::string& uri,
                                              ResponseCallback subscription) {
   this->subscriptions.insert({uri, subscription});
@@ -371,7 +570,8 @@ uint64_t MercurySession::executeSubscription(RequestType method,
                                              const std::string& uri,
                                              ResponseCallback callback,
                                              ResponseCallback subscription,
-                                             DataParts& payload) {
+                                             DataParts& payload,
+                                             const char* contentType) {
   while (isReconnecting)
     BELL_SLEEP_MS(100);
 
@@ -379,6 +579,13 @@ uint64_t MercurySession::executeSubscription(RequestType method,
   pb_release(Header_fields, &tempMercuryHeader);
   tempMercuryHeader.uri = strdup(uri.c_str());
   tempMercuryHeader.method = strdup(RequestTypeMap[method].c_str());
+  if (contentType != nullptr) {
+    tempMercuryHeader.content_type = strdup(contentType);
+  }
+
+  auto& policy = retryPolicy(uri);
+  // Only lookups are safe to send twice
+  uint8_t retries = method == RequestType::GET ? policy.retries : 0;
 
   // Map logical request type to the appropriate wire request type (SEND for POST, GET, PUT)
   if (method == RequestType::GET || method == RequestType::POST ||
@@ -393,16 +600,29 @@ uint64_t MercurySession::executeSubscription(RequestType method,
   auto headerBytes = pbEncode(Header_fields, &tempMercuryHeader);
   pb_release(Header_fields, &tempMercuryHeader);
 
-  {
-    std::unique_lock<std::mutex> lock(callbackMutex);
-    if (callback != nullptr)
-      this->callbacks.insert({sequenceId, callback});
-  }
   // Prepare the data packet structure:
   // [Sequence size] [SequenceId] [0x1] [Payloads number] [Header size] [Header] [Payloads (size + data)]
   auto sequenceIdBytes =
       prepareSequenceIdPayload(sequenceId, headerBytes, payload);
 
+  if (callback != nullptr) {
+    PendingRequest request;
+    request.callback = callback;
+    request.uri = uri;
+    request.command =
+        static_cast<std::underlying_type<RequestType>::type>(method);
+    if (retries > 0) {
+      request.packet = sequenceIdBytes;
+    }
+    request.retriesLeft = retries;
+    request.timeoutMs = policy.timeoutMs;
+    {
+      std::unique_lock<std::mutex> lock(callbackMutex);
+      this->callbacks.insert({sequenceId, std::move(request)});
+    }
+    this->requestTimeouts.schedule(sequenceId, policy.timeoutMs);
+  }
+
   // Bump sequence ID for the next request
   this->sequenceId += 1;
 
@@ -462,6 +682,7 @@ uint32_t MercurySession::requestAudioKey(const std::vector<uint8_t>& trackId,
   // Store callback
   this->audioKeyCallbacks.insert({this->audioKeySequence, audioCallback});
   lock.unlock();
+  this->audioKeyTimeouts.schedule(this->audioKeySequence, AUDIO_KEY_TIMEOUT_MS);
   // Structure: [FILEID] [TRACKID] [4 BYTES SEQUENCE ID] [0x00, 0x00]
   buffer.insert(buffer.end(), trackId.begin(), trackId.end());
   auto audioKeySequenceBuffer = pack<uint32_t>(htonl(this->audioKeySequence));
@@ -0,0 +1,241 @@
+#include "MetadataBatcher.h"
+
+#include <string.h>   // for strncmp
+#include <algorithm>  // for min
+
+#include "Logger.h"               // for SC32_LOG
+#include "MercurySession.h"       // for MercurySession
+#include "NanoPBHelper.h"         // for pbEncode, pbDecode
+#include "pb_decode.h"            // for pb_release
+#include "protobuf/mercury.pb.h"  // for MercuryMultiGetRequest, MercuryReply
+
+using namespace spotify;
+
+namespace {
+const char EPISODE_PREFIX[] = "hm://metadata/3/episode/";
+const char MGET_REQUEST_TYPE[] = "vnd.spotify/mercury-mget-request";
+}  // namespace
+
+MetadataBatcher::MetadataBatcher(std::shared_ptr<MercurySession> session)
+    : session(session) {}
+
+MetadataBatcher::~MetadataBatcher() {
+  std::scoped_lock lock(batchMutex);
+  for (auto sequenceId : pendingRequests) {
+    session->unregister(sequenceId);
+  }
+}
+
+uint32_t MetadataBatcher::request(const std::string& uri, Callback callback) {
+  std::scoped_lock lock(batchMutex);
+  uint32_t id = nextId++;
+  auto sent = inFlight.find(uri);
+  if (sent != inFlight.end()) {
+    sent->second.push_back({id, callback});
+    counters.deduplicated++;
+    return id;
+  }
+  auto& waiters = queued[uri];
+  if (waiters.empty()) {
+    counters.lookups++;
+  } else {
+    counters.deduplicated++;
+  }
+  waiters.push_back({id, callback});
+  return id;
+}
+
+void MetadataBatcher::cancel(uint32_t id) {
+  std::scoped_lock lock(batchMutex);
+  for (auto* lookups : {&queued, &inFlight}) {
+    for (auto it = lookups->begin(); it != lookups->end(); it++) {
+      auto& waiters = it->second;
+      for (auto waiter = waiters.begin(); waiter != waiters.end(); waiter++) {
+        if (waiter->id == id) {
+          waiters.erase(waiter);
+          // Not sent yet, so there is nothing left to ask for
+          if (waiters.empty() && lookups == &queued) {
+            lookups->erase(it);
+          }
+          return;
+        }
+      }
+    }
+  }
+}
+
+void MetadataBatcher::flush() {
+  std::vector<std::string> tracks, episodes;
+  bool single;
+  {
+    std::scoped_lock lock(batchMutex);
+    if (queued.empty()) {
+      return;
+    }
+    for (auto& [uri, waiters] : queued) {
+      if (strncmp(uri.c_str(), EPISODE_PREFIX, sizeof(EPISODE_PREFIX) - 1) ==
+          0) {
+        episodes.push_back(uri);
+      } else {
+        tracks.push_back(uri);
+      }
+      inFlight[uri] = std::move(waiters);
+    }
+    queued.clear();
+    single = batchingRejected;
+  }
+
+  for (auto* uris : {&tracks, &episodes}) {
+    for (size_t i = 0; i < uris->size(); i += MAX_BATCH) {
+      std::vector<std::string> batch(
+          uris->begin() + i,
+          uris->begin() + std::min(uris->size(), i + MAX_BATCH));
+      if (single || batch.size() == 1) {
+        for (auto& uri : batch) {
+          sendSingle(uri);
+        }
+      } else {
+        sendBatch(uris == &tracks ? "hm://metadata/3/tracks"
+                                  : "hm://metadata/3/episodes",
+                  batch);
+      }
+    }
+  }
+
+  auto current = stats();
+  SC32_LOG(info,
+           "Metadata: %u lookups in %u round trips (%u deduplicated, %u "
+           "fallbacks)",
+           (unsigned)current.lookups, (unsigned)current.roundTrips,
+           (unsigned)current.deduplicated, (unsigned)current.fallbacks);
+}
+
+MetadataBatcher::Stats MetadataBatcher::stats() {
+  std::scoped_lock lock(batchMutex);
+  return counters;
+}
+
+void MetadataBatcher::sendSingle(const std::string& uri) {
+  {
+    std::scoped_lock lock(batchMutex);
+    counters.roundTrips++;
+  }
+  auto sequenceId = session->execute(
+      MercurySession::RequestType::GET, uri,
+      [this, uri](MercurySession::Response res) {
+        finishRequest(res.sequenceId);
+        if (res.fail || res.parts.empty()) {
+          deliver(uri, false, {});
+        } else {
+          deliver(uri, true, res.parts[0]);
+        }
+      });
+  trackRequest(sequenceId);
+}
+
+void MetadataBatcher::sendBatch(const std::string& batchUri,
+                                const std::vector<std::string>& uris) {
+  // Points into uris, nothing to release after encoding
+  std::vector<MercuryRequest> requests(uris.size());
+  for (size_t i = 0; i < uris.size(); i++) {
+    requests[i] = MercuryRequest_init_zero;
+    requests[i].uri = (char*)uris[i].c_str();
+  }
+  MercuryMultiGetRequest multiGet = MercuryMultiGetRequest_init_zero;
+  multiGet.request_count = requests.size();
+  multiGet.request = requests.data();
+
+  MercurySession::DataParts parts = {
+      pbEncode(MercuryMultiGetRequest_fields, &multiGet)};
+  {
+    std::scoped_lock lock(batchMutex);
+    counters.roundTrips++;
+  }
+
+  auto sequenceId = session->execute(
+      MercurySession::RequestType::GET, batchUri,
+      [this, uris](MercurySession::Response res) {
+        finishRequest(res.sequenceId);
+
+        if (res.fail) {
+          // Timed out, or the connection was lost and the session is
+          // failing every pending request
+          for (auto& uri : uris) {
+            deliver(uri, false, {});
+          }
+          return;
+        }
+
+        MercuryMultiGetReply reply = MercuryMultiGetReply_init_zero;
+        bool decoded = !res.parts.empty() &&
+                       pbDecode(reply, MercuryMultiGetReply_fields,
+                                res.parts[0]);
+        if (!decoded) {
+          SC32_LOG(info, "Metadata batch rejected, looking up one by one");
+          std::scoped_lock lock(batchMutex);
+          batchingRejected = true;
+        }
+
+        // Replies come in request order
+        for (size_t i = 0; i < uris.size(); i++) {
+          MercuryReply* entry =
+              decoded && i < reply.reply_count ? &reply.reply[i] : nullptr;
+          if (entry != nullptr && entry->status_code == 200 &&
+              entry->body != nullptr) {
+            deliver(uris[i], true,
+                    std::vector<uint8_t>(entry->body->bytes,
+                                         entry->body->bytes +
+                                             entry->body->size));
+          } else {
+            {
+              std::scoped_lock lock(batchMutex);
+              counters.fallbacks++;
+            }
+            sendSingle(uris[i]);
+          }
+        }
+        pb_release(MercuryMultiGetReply_fields, &reply);
+      },
+      parts, MGET_REQUEST_TYPE);
+  trackRequest(sequenceId);
+}
+
+void MetadataBatcher::trackRequest(uint64_t sequenceId) {
+  // The id only exists once execute() returns and the reply can beat us to
+  // the lock; it must not stay behind as a pending request then
+  std::scoped_lock lock(batchMutex);
+  if (answeredEarly.erase(sequenceId) == 0) {
+    pendingRequests.insert(sequenceId);
+  }
+}
+
+void MetadataBatcher::finishRequest(uint64_t sequenceId) {
+  std::scoped_lock lock(batchMutex);
+  if (pendingRequests.erase(sequenceId) == 0) {
+    answeredEarly.insert(sequenceId);
+  }
+}
+
+void MetadataBatcher::deliver(const std::string& uri, bool success,
+                              const std::vector<uint8_t>& data) {
+  while (true) {
+    Waiter waiter;
+    {
+      std::scoped_lock lock(batchMutex);
+      auto it = inFlight.find(uri);
+      if (it == inFlight.end()) {
+        return;
+      }
+      if (it->second.empty()) {
+        inFlight.erase(it);
+        return;
+      }
+      // Taken one at a time, so a cancel() while an earlier callback runs
+      // still holds for the rest. Callers that may go away while their own
+      // callback runs keep themselves alive through it.
+      waiter = std::move(it->second.front());
+      it->second.erase(it->second.begin());
+    }
+    waiter.callback(success, data);
+  }
+}
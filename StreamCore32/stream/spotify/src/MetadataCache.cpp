@@ -0,0 +1,344 @@
+#include "MetadataCache.h"
+
+#include <stdio.h>   // for FILE, fopen, fread, fwrite
+#include <string.h>  // for memcmp, strlen
+
+#include "Logger.h"        // for SC32_LOG
+#include "NanoPBHelper.h"  // for pbArrayToVector
+#include "Utils.h"         // for bytesToHexString
+
+using namespace spotify;
+
+namespace {
+const char CACHE_MAGIC[4] = {'M', 'D', 'C', '2'};
+// Sanity bound for sizes read back from flash
+const uint32_t MAX_FIELD_SIZE = 4 * 1024;
+
+bool writeU32(FILE* f, uint32_t v) {
+  return fwrite(&v, sizeof(v), 1, f) == 1;
+}
+
+bool readU32(FILE* f, uint32_t* v) {
+  return fread(v, sizeof(*v), 1, f) == 1;
+}
+
+template <typename T>
+bool writeBytes(FILE* f, const T& v) {
+  return writeU32(f, v.size()) &&
+         (v.empty() || fwrite(v.data(), 1, v.size(), f) == v.size());
+}
+
+template <typename T>
+bool readBytes(FILE* f, T* v) {
+  uint32_t size = 0;
+  if (!readU32(f, &size) || size > MAX_FIELD_SIZE) {
+    return false;
+  }
+  v->resize(size);
+  return size == 0 || fread(&(*v)[0], 1, size, f) == size;
+}
+
+bool countryListContains(const std::string& countryList, const char* country) {
+  for (size_t x = 0; x + 1 < countryList.size(); x += 2) {
+    if (countryList[x] == country[0] && countryList[x + 1] == country[1]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+template <typename T>
+MetadataCache::Candidate candidateOf(const T& item,
+                                    const std::string& country) {
+  MetadataCache::Candidate candidate;
+  candidate.gid = pbArrayToVector(item.gid);
+  for (int x = 0; x < item.restriction_count; x++) {
+    // Only the first list present counts, see isRestricted(). Whether it
+    // names the country is all that matters for it.
+    auto& restriction = item.restriction[x];
+    bool allowed = restriction.countries_allowed != nullptr;
+    const char* list = allowed ? restriction.countries_allowed
+                               : restriction.countries_forbidden;
+    if (list != nullptr) {
+      bool listed =
+          country.size() == 2 && countryListContains(list, country.c_str());
+      candidate.restrictions.push_back({allowed, listed ? country : ""});
+      break;
+    }
+  }
+  for (int x = 0; x < item.file_count; x++) {
+    candidate.files.push_back(
+        {(uint8_t)item.file[x].format, pbArrayToVector(item.file[x].file_id)});
+  }
+  return candidate;
+}
+
+std::string coverUrl(const ImageGroup& group) {
+  if (group.image_count == 0) {
+    return "";
+  }
+  auto imageId = pbArrayToVector(group.image[group.image_count - 1].file_id);
+  return "https://i.scdn.co/image/" + bytesToHexString(imageId);
+}
+}  // namespace
+
+MetadataCache& MetadataCache::shared() {
+  static MetadataCache cache;
+  return cache;
+}
+
+MetadataCache::Entry MetadataCache::fromTrack(const Track& track,
+                                              const std::string& country) {
+  Entry entry;
+  entry.country = country;
+  entry.name = track.name != nullptr ? track.name : "";
+  if (track.artist_count > 0 && track.artist[0].name != nullptr) {
+    entry.artist = track.artist[0].name;
+  }
+  if (track.has_album) {
+    entry.album = track.album.name != nullptr ? track.album.name : "";
+    if (track.album.has_cover_group) {
+      entry.imageUrl = coverUrl(track.album.cover_group);
+    }
+  }
+  entry.number = track.has_number ? track.number : 0;
+  entry.discNumber = track.has_disc_number ? track.disc_number : 0;
+  entry.duration = track.duration;
+
+  entry.candidates.push_back(candidateOf(track, country));
+  for (int x = 0; x < track.alternative_count; x++) {
+    entry.candidates.push_back(candidateOf(track.alternative[x], country));
+  }
+  return entry;
+}
+
+MetadataCache::Entry MetadataCache::fromEpisode(const Episode& episode,
+                                                const std::string& country) {
+  Entry entry;
+  entry.episode = true;
+  entry.country = country;
+  entry.name = episode.name != nullptr ? episode.name : "";
+  entry.imageUrl = coverUrl(episode.covers);
+  entry.number = episode.has_number ? episode.number : 0;
+  entry.duration = episode.duration;
+  entry.candidates.push_back(candidateOf(episode, country));
+  return entry;
+}
+
+bool MetadataCache::isRestricted(const Candidate& candidate,
+                                 const char* country) {
+  if (candidate.restrictions.empty()) {
+    return false;
+  }
+  auto& first = candidate.restrictions[0];
+  bool listed = countryListContains(first.countries, country);
+  return first.allowed ? !listed : listed;
+}
+
+size_t MetadataCache::sizeOf(const Entry& entry) {
+  size_t size = sizeof(Item) + entry.country.size() + entry.name.size() +
+                entry.artist.size() + entry.album.size() +
+                entry.imageUrl.size();
+  for (auto& candidate : entry.candidates) {
+    size += sizeof(Candidate) + candidate.gid.size();
+    for (auto& restriction : candidate.restrictions) {
+      size += sizeof(Restriction) + restriction.countries.size();
+    }
+    for (auto& file : candidate.files) {
+      size += sizeof(file) + file.second.size();
+    }
+  }
+  return size;
+}
+
+bool MetadataCache::open(const std::string& dir, size_t budget) {
+  std::scoped_lock lock(cacheMutex);
+  this->path = dir + "/metadata";
+  this->budget = budget;
+  readFile();
+  SC32_LOG(info, "Metadata cache: %u entries (%u bytes) from %s",
+           (unsigned)counters.entries, (unsigned)counters.bytes,
+           path.c_str());
+  return true;
+}
+
+bool MetadataCache::load(const std::vector<uint8_t>& gid,
+                         const std::string& country, Entry* out) {
+  std::scoped_lock lock(cacheMutex);
+  auto it = index.find(std::string(gid.begin(), gid.end()));
+  // Restrictions were reduced to another country, look it up again
+  if (it == index.end() || it->second->second.country != country) {
+    counters.misses++;
+    return false;
+  }
+  // Move to the front
+  lru.splice(lru.begin(), lru, it->second);
+  *out = it->second->second;
+  counters.hits++;
+  return true;
+}
+
+void MetadataCache::store(const std::vector<uint8_t>& gid,
+                          const Entry& entry) {
+  std::scoped_lock lock(cacheMutex);
+  insertLocked(std::string(gid.begin(), gid.end()), entry);
+  unsaved++;
+}
+
+void MetadataCache::invalidate(const std::vector<uint8_t>& gid) {
+  std::scoped_lock lock(cacheMutex);
+  if (gid.empty()) {
+    lru.clear();
+    index.clear();
+    counters.entries = 0;
+    counters.bytes = 0;
+  } else {
+    auto it = index.find(std::string(gid.begin(), gid.end()));
+    if (it == index.end()) {
+      return;
+    }
+    eraseLocked(it);
+  }
+  // Must not come back after a reboot, written with the next flush
+  unsaved = SAVE_EVERY;
+}
+
+void MetadataCache::flush(bool force) {
+  std::list<Item> items;
+  {
+    std::scoped_lock lock(cacheMutex);
+    if (path.empty() || unsaved == 0 || (!force && unsaved < SAVE_EVERY)) {
+      return;
+    }
+    unsaved = 0;
+    // Lookups go on while the copy is written
+    items = lru;
+  }
+  writeFile(items);
+}
+
+MetadataCache::Stats MetadataCache::stats() {
+  std::scoped_lock lock(cacheMutex);
+  return counters;
+}
+
+void MetadataCache::insertLocked(const std::string& key, const Entry& entry) {
+  auto existing = index.find(key);
+  if (existing != index.end()) {
+    eraseLocked(existing);
+  }
+  size_t size = sizeOf(entry);
+  if (size > budget) {
+    return;
+  }
+
+  lru.emplace_front(key, entry);
+  index[key] = lru.begin();
+  counters.bytes += size;
+  while (counters.bytes > budget) {
+    eraseLocked(index.find(lru.back().first));
+    counters.evictions++;
+  }
+  counters.entries = lru.size();
+}
+
+void MetadataCache::eraseLocked(
+    std::unordered_map<std::string, std::list<Item>::iterator>::iterator it) {
+  counters.bytes -= sizeOf(it->second->second);
+  lru.erase(it->second);
+  index.erase(it);
+  counters.entries = lru.size();
+}
+
+void MetadataCache::writeFile(const std::list<Item>& items) {
+  std::string tmp = path + ".tmp";
+  FILE* f = fopen(tmp.c_str(), "wb");
+  if (f == nullptr) {
+    return;
+  }
+  bool ok = fwrite(CACHE_MAGIC, 1, 4, f) == 4 && writeU32(f, items.size());
+  // Least recently used first, so reading back keeps the order
+  for (auto item = items.rbegin(); ok && item != items.rend(); item++) {
+    auto& entry = item->second;
+    ok = writeBytes(f, item->first) && writeU32(f, entry.episode) &&
+         writeBytes(f, entry.country) && writeBytes(f, entry.name) &&
+         writeBytes(f, entry.artist) && writeBytes(f, entry.album) &&
+         writeBytes(f, entry.imageUrl) &&
+         writeU32(f, entry.duration) && writeU32(f, entry.number) &&
+         writeU32(f, entry.discNumber) &&
+         writeU32(f, entry.candidates.size());
+    for (auto& candidate : entry.candidates) {
+      ok = ok && writeBytes(f, candidate.gid) &&
+           writeU32(f, candidate.restrictions.size());
+      for (auto& restriction : candidate.restrictions) {
+        ok = ok && writeU32(f, restriction.allowed) &&
+             writeBytes(f, restriction.countries);
+      }
+      ok = ok && writeU32(f, candidate.files.size());
+      for (auto& file : candidate.files) {
+        ok = ok && writeU32(f, file.first) && writeBytes(f, file.second);
+      }
+    }
+  }
+  ok = fclose(f) == 0 && ok;
+
+  if (!ok) {
+    SC32_LOG(error, "Metadata cache: could not write %s", path.c_str());
+    remove(tmp.c_str());
+    return;
+  }
+  remove(path.c_str());
+  rename(tmp.c_str(), path.c_str());
+}
+
+void MetadataCache::readFile() {
+  FILE* f = fopen(path.c_str(), "rb");
+  if (f == nullptr) {
+    return;
+  }
+  char magic[4];
+  uint32_t count = 0;
+  bool ok = fread(magic, 1, 4, f) == 4 && memcmp(magic, CACHE_MAGIC, 4) == 0 &&
+            readU32(f, &count);
+  for (uint32_t i = 0; ok && i < count; i++) {
+    std::string key;
+    Entry entry;
+    uint32_t episode = 0, candidates = 0;
+    ok = readBytes(f, &key) && readU32(f, &episode) &&
+         readBytes(f, &entry.country) && readBytes(f, &entry.name) &&
+         readBytes(f, &entry.artist) && readBytes(f, &entry.album) &&
+         readBytes(f, &entry.imageUrl) &&
+         readU32(f, &entry.duration) && readU32(f, &entry.number) &&
+         readU32(f, &entry.discNumber) && readU32(f, &candidates) &&
+         candidates < MAX_FIELD_SIZE;
+    entry.episode = episode != 0;
+    for (uint32_t c = 0; ok && c < candidates; c++) {
+      Candidate candidate;
+      uint32_t restrictions = 0, files = 0;
+      ok = readBytes(f, &candidate.gid) && readU32(f, &restrictions) &&
+           restrictions < MAX_FIELD_SIZE;
+      for (uint32_t r = 0; ok && r < restrictions; r++) {
+        uint32_t allowed = 0;
+        std::string countries;
+        ok = readU32(f, &allowed) && readBytes(f, &countries);
+        candidate.restrictions.push_back({allowed != 0, countries});
+      }
+      ok = ok && readU32(f, &files) && files < MAX_FIELD_SIZE;
+      for (uint32_t x = 0; ok && x < files; x++) {
+        uint32_t format = 0;
+        std::vector<uint8_t> fileId;
+        ok = readU32(f, &format) && readBytes(f, &fileId);
+        candidate.files.push_back({(uint8_t)format, fileId});
+      }
+      entry.candidates.push_back(candidate);
+    }
+    if (ok) {
+      insertLocked(key, entry);
+    }
+  }
+  fclose(f);
+  if (!ok) {
+    // Keep what was read, the next save rewrites the file
+    SC32_LOG(error, "Metadata cache: %s is truncated", path.c_str());
+  }
+}
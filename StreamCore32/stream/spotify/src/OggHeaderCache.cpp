@@ -0,0 +1,240 @@
+#include "OggHeaderCache.h"
+
+#include <stdio.h>    // for FILE, fopen, fread, fwrite
+#include <string.h>   // for memcmp
+#include <algorithm>  // for find
+
+#include "Logger.h"  // for SC32_LOG
+#include "Utils.h"   // for bytesToHexString
+
+using namespace spotify;
+
+namespace {
+const char CACHE_MAGIC[4] = {'O', 'H', 'C', '2'};
+// SPIFFS file names are limited to 32 characters including the path
+const size_t KEY_LENGTH = 16;
+// Sanity bound for sizes read back from flash
+const uint32_t MAX_BLOB_SIZE = 64 * 1024;
+
+bool writeU32(FILE* f, uint32_t v) {
+  return fwrite(&v, sizeof(v), 1, f) == 1;
+}
+
+bool readU32(FILE* f, uint32_t* v) {
+  return fread(v, sizeof(*v), 1, f) == 1;
+}
+
+bool writeBlob(FILE* f, const std::vector<uint8_t>& v) {
+  return writeU32(f, v.size()) &&
+         (v.empty() || fwrite(v.data(), 1, v.size(), f) == v.size());
+}
+
+bool readBlob(FILE* f, std::vector<uint8_t>* v) {
+  uint32_t size = 0;
+  if (!readU32(f, &size) || size > MAX_BLOB_SIZE) {
+    return false;
+  }
+  v->resize(size);
+  return size == 0 || fread(v->data(), 1, size, f) == size;
+}
+}  // namespace
+
+OggHeaderCache& OggHeaderCache::shared() {
+  static OggHeaderCache cache;
+  return cache;
+}
+
+std::string OggHeaderCache::keyFor(const std::vector<uint8_t>& fileId) {
+  return bytesToHexString(fileId).substr(0, KEY_LENGTH);
+}
+
+std::string OggHeaderCache::pathFor(const std::string& key) {
+  return dir + "/" + key;
+}
+
+bool OggHeaderCache::open(const std::string& dir, size_t maxEntries) {
+  std::scoped_lock lock(cacheMutex);
+  this->dir = dir;
+  this->maxEntries = maxEntries;
+  lru.clear();
+
+  FILE* f = fopen((dir + "/index").c_str(), "r");
+  if (f != nullptr) {
+    char line[KEY_LENGTH + 2];
+    while (fgets(line, sizeof(line), f) != nullptr) {
+      std::string key(line);
+      while (!key.empty() && (key.back() == '\n' || key.back() == '\r')) {
+        key.pop_back();
+      }
+      if (key.size() == KEY_LENGTH) {
+        lru.push_back(key);
+      }
+    }
+    fclose(f);
+  } else {
+    // Make sure the directory is writable before relying on it
+    saveIndexLocked();
+    f = fopen((dir + "/index").c_str(), "r");
+    if (f == nullptr) {
+      SC32_LOG(error, "Header cache: %s is not writable", dir.c_str());
+      this->dir.clear();
+      return false;
+    }
+    fclose(f);
+  }
+  counters.entries = lru.size();
+  SC32_LOG(info, "Header cache: %u entries in %s", (unsigned)lru.size(),
+           dir.c_str());
+  return true;
+}
+
+bool OggHeaderCache::enabled() {
+  std::scoped_lock lock(cacheMutex);
+  return !dir.empty();
+}
+
+void OggHeaderCache::touchLocked(const std::string& key) {
+  auto it = std::find(lru.begin(), lru.end(), key);
+  if (it != lru.end()) {
+    lru.erase(it);
+  }
+  lru.push_front(key);
+
+  while (lru.size() > maxEntries) {
+    remove(pathFor(lru.back()).c_str());
+    lru.pop_back();
+    counters.evictions++;
+    indexDirty = true;
+  }
+  counters.entries = lru.size();
+}
+
+void OggHeaderCache::saveIndexLocked() {
+  std::string tmp = dir + "/index.tmp";
+  FILE* f = fopen(tmp.c_str(), "w");
+  if (f == nullptr) {
+    return;
+  }
+  for (auto& key : lru) {
+    fprintf(f, "%s\n", key.c_str());
+  }
+  fclose(f);
+  std::string path = dir + "/index";
+  remove(path.c_str());
+  rename(tmp.c_str(), path.c_str());
+}
+
+bool OggHeaderCache::load(const std::vector<uint8_t>& fileId, Entry* out) {
+  std::scoped_lock lock(cacheMutex);
+  if (dir.empty() || fileId.empty()) {
+    return false;
+  }
+  std::string key = keyFor(fileId);
+  for (auto& item : pending) {
+    if (item.key == key && item.fileId == fileId) {
+      *out = item.entry;
+      counters.hits++;
+      return true;
+    }
+  }
+  if (std::find(lru.begin(), lru.end(), key) == lru.end()) {
+    counters.misses++;
+    return false;
+  }
+
+  bool ok = false;
+  FILE* f = fopen(pathFor(key).c_str(), "rb");
+  if (f != nullptr) {
+    char magic[4];
+    std::vector<uint8_t> storedId;
+    uint32_t fileSize = 0, footerStart = 0;
+    ok = fread(magic, 1, 4, f) == 4 &&
+         memcmp(magic, CACHE_MAGIC, 4) == 0 && readBlob(f, &storedId) &&
+         storedId == fileId && readU32(f, &fileSize) &&
+         readU32(f, &footerStart) && readBlob(f, &out->header) &&
+         readBlob(f, &out->footer);
+    out->fileSize = fileSize;
+    out->footerStart = footerStart;
+    fclose(f);
+  }
+
+  if (!ok) {
+    // Truncated or colliding entry, forget about it
+    lru.remove(key);
+    remove(pathFor(key).c_str());
+    counters.entries = lru.size();
+    counters.misses++;
+    indexDirty = true;
+    return false;
+  }
+  counters.hits++;
+  // The new order is saved with the next entry written
+  touchLocked(key);
+  return true;
+}
+
+void OggHeaderCache::store(const std::vector<uint8_t>& fileId, Entry entry) {
+  std::scoped_lock lock(cacheMutex);
+  if (dir.empty() || fileId.empty()) {
+    return;
+  }
+  std::string key = keyFor(fileId);
+  pending.remove_if([&](const Pending& item) { return item.key == key; });
+  if (pending.size() >= MAX_PENDING) {
+    pending.pop_front();
+  }
+  pending.push_back({key, fileId, std::move(entry)});
+}
+
+void OggHeaderCache::flush() {
+  while (true) {
+    Pending item;
+    {
+      std::scoped_lock lock(cacheMutex);
+      if (pending.empty()) {
+        if (indexDirty) {
+          indexDirty = false;
+          saveIndexLocked();
+        }
+        return;
+      }
+      item = std::move(pending.front());
+      pending.pop_front();
+    }
+    // Written outside the lock, a track opening meanwhile only misses it
+    if (writeEntry(item)) {
+      std::scoped_lock lock(cacheMutex);
+      touchLocked(item.key);
+      indexDirty = true;
+    }
+  }
+}
+
+bool OggHeaderCache::writeEntry(const Pending& item) {
+  std::string path = pathFor(item.key);
+  std::string tmp = path + ".tmp";
+  FILE* f = fopen(tmp.c_str(), "wb");
+  if (f == nullptr) {
+    return false;
+  }
+  bool ok = fwrite(CACHE_MAGIC, 1, 4, f) == 4 && writeBlob(f, item.fileId) &&
+            writeU32(f, item.entry.fileSize) &&
+            writeU32(f, item.entry.footerStart) &&
+            writeBlob(f, item.entry.header) && writeBlob(f, item.entry.footer);
+  ok = fclose(f) == 0 && ok;
+
+  if (!ok) {
+    // Most likely the partition is full
+    SC32_LOG(error, "Header cache: could not write %s", item.key.c_str());
+    remove(tmp.c_str());
+    return false;
+  }
+  remove(path.c_str());
+  rename(tmp.c_str(), path.c_str());
+  return true;
+}
+
+OggHeaderCache::Stats OggHeaderCache::stats() {
+  std::scoped_lock lock(cacheMutex);
+  return counters;
+}
@@ -0,0 +1,77 @@
+#include "PacketQueue.h"
+
+#include <utility>  // for swap
+
+using namespace spotify;
+
+PacketQueue::PacketQueue() {
+  for (size_t i = 0; i < CAPACITY; i++) {
+    slots[i].sequence.store(i, std::memory_order_relaxed);
+  }
+}
+
+bool PacketQueue::push(Packet& packet) {
+  Slot* slot = nullptr;
+  size_t position = writePosition.load(std::memory_order_relaxed);
+  while (true) {
+    slot = &slots[position & (CAPACITY - 1)];
+    size_t sequence = slot->sequence.load(std::memory_order_acquire);
+    auto diff = (intptr_t)sequence - (intptr_t)position;
+    if (diff == 0) {
+      // Slot free for this lap, claim it
+      if (writePosition.compare_exchange_weak(position, position + 1,
+                                              std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      // The consumer has not freed this slot yet
+      full.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    } else {
+      position = writePosition.load(std::memory_order_relaxed);
+    }
+  }
+
+  slot->packet.command = packet.command;
+  std::swap(slot->packet.data, packet.data);
+  packet.data.clear();
+  slot->queuedAt = std::chrono::steady_clock::now();
+  slot->sequence.store(position + 1, std::memory_order_release);
+  return true;
+}
+
+bool PacketQueue::pop(Packet& out) {
+  Slot* slot = &slots[readPosition & (CAPACITY - 1)];
+  if (slot->sequence.load(std::memory_order_acquire) != readPosition + 1) {
+    return false;
+  }
+
+  out.command = slot->packet.command;
+  std::swap(out.data, slot->packet.data);
+  slot->packet.data.clear();
+  uint32_t us = std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::steady_clock::now() - slot->queuedAt)
+                    .count();
+  // Free for the producers' next lap
+  slot->sequence.store(readPosition + CAPACITY, std::memory_order_release);
+  readPosition++;
+
+  dispatched.fetch_add(1, std::memory_order_relaxed);
+  latencySumUs.fetch_add(us, std::memory_order_relaxed);
+  if (us > maxLatencyUs.load(std::memory_order_relaxed)) {
+    maxLatencyUs.store(us, std::memory_order_relaxed);
+  }
+  return true;
+}
+
+PacketQueue::Stats PacketQueue::stats() {
+  Stats stats;
+  stats.dispatched = dispatched.load(std::memory_order_relaxed);
+  stats.full = full.load(std::memory_order_relaxed);
+  stats.maxLatencyUs = maxLatencyUs.load(std::memory_order_relaxed);
+  stats.avgLatencyUs =
+      stats.dispatched
+          ? latencySumUs.load(std::memory_order_relaxed) / stats.dispatched
+          : 0;
+  return stats;
+}
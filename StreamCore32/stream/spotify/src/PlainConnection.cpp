@@ -6,13 +6,17 @@
 #include <netinet/in.h>   // for IPPROTO_IP, IPPROTO_TCP
 #include <netinet/tcp.h>  // for TCP_NODELAY
 #include <sys/errno.h>    // for EAGAIN, EINTR, ETIMEDOUT, errno
-#include <sys/socket.h>   // for setsockopt, connect, recv, send, shutdown
+#include <sys/socket.h>   // for setsockopt, connect, recv, sendmsg, shutdown
 #include <sys/time.h>     // for timeval
-#include <cstring>        // for memset
+#include <sys/uio.h>      // for iovec
+#include <cstring>        // for memset, memcpy, memmove
 #include <stdexcept>      // for runtime_error
 #else
 #include <ws2tcpip.h>
 #endif
+#include <algorithm>  // for min
+#include <atomic>     // for atomic
+
 #include "BellLogger.h"  // for AbstractLogger
 #include "BellUtils.h"   // for BELL_SLEEP
 #include "Logger.h"      // for SC32_LOG
@@ -21,6 +25,11 @@
 
 using namespace spotify;
 
+namespace {
+std::atomic<uint32_t> recvCalls = 0;
+std::atomic<uint32_t> sendCalls = 0;
+}  // namespace
+
 static int getErrno() {
 #ifdef _WIN32
   int code = WSAGetLastError();
@@ -97,6 +106,9 @@ void PlainConnection::connect(const std::string& apAddress) {
     apSock = -1;
     throw std::runtime_error("Can't connect to spotify servers");
   }
+  this->readBuffer.resize(READ_BUFFER_SIZE);
+  this->readStart = 0;
+  this->readEnd = 0;
 
   freeaddrinfo(airoot);
   SC32_LOG(debug, "Connected to spotify server");
@@ -132,62 +144,152 @@ std::vector<uint8_t> PlainConnection::sendPrefixPacket(
   return sizeRaw;
 }
 size_t PlainConnection::writeBlock(const std::vector<uint8_t>& data) {
-  size_t idx = 0;
+  return this->writeBlocks({{data.data(), data.size()}});
+}
+
+size_t PlainConnection::writeBlocks(std::initializer_list<Block> blocks) {
+  size_t total = 0;
+#ifdef _WIN32
+  // No sendmsg(), the blocks go out one by one
+  for (auto& [data, size] : blocks) {
+    size_t idx = 0;
+    while (idx < size) {
+      int n = ::send(apSock, reinterpret_cast<const char*>(data + idx),
+                     size - idx, 0);
+      if (n > 0) {
+        sendCalls++;
+        idx += static_cast<size_t>(n);
+        continue;
+      }
+      checkWriteError(n);
+    }
+    total += size;
+  }
+#else
+  struct iovec iov[MAX_WRITE_BLOCKS];
+  struct msghdr msg = {};
+  msg.msg_iov = iov;
+  for (auto& [data, size] : blocks) {
+    if (size == 0) {
+      continue;
+    }
+    if ((size_t)msg.msg_iovlen == MAX_WRITE_BLOCKS) {
+      throw std::runtime_error("Too many blocks in one write");
+    }
+    iov[msg.msg_iovlen].iov_base = const_cast<uint8_t*>(data);
+    iov[msg.msg_iovlen].iov_len = size;
+    msg.msg_iovlen++;
+    total += size;
+  }
 
-  while (idx < data.size()) {
-    const size_t toSend = data.size() - idx;  // let the OS split as needed
+  while (msg.msg_iovlen > 0) {
 #ifdef MSG_NOSIGNAL
-    ssize_t n = ::send(apSock, reinterpret_cast<const char*>(&data[idx]),
-                       toSend, MSG_NOSIGNAL);
+    ssize_t n = ::sendmsg(apSock, &msg, MSG_NOSIGNAL);
 #else
-    ssize_t n =
-        ::send(apSock, reinterpret_cast<const char*>(&data[idx]), toSend, 0);
+    ssize_t n = ::sendmsg(apSock, &msg, 0);
 #endif
-    if (n > 0) {
-      idx += static_cast<size_t>(n);
+    if (n <= 0) {
+      checkWriteError(n);
       continue;
     }
-
-    if (n == 0) {
-      SC32_LOG(error, "write: send returned 0 (peer?)");
-      throw std::runtime_error("Peer closed");
+    sendCalls++;
+
+    // Skip what went out, the OS may have split anywhere
+    size_t sent = static_cast<size_t>(n);
+    while (msg.msg_iovlen > 0 && sent >= msg.msg_iov->iov_len) {
+      sent -= msg.msg_iov->iov_len;
+      msg.msg_iov++;
+      msg.msg_iovlen--;
     }
+    if (msg.msg_iovlen > 0) {
+      msg.msg_iov->iov_base =
+          static_cast<uint8_t*>(msg.msg_iov->iov_base) + sent;
+      msg.msg_iov->iov_len -= sent;
+    }
+  }
+#endif
+  return total;
+}
 
-    const int e = getErrno();
-    if (e == EAGAIN
+void PlainConnection::checkWriteError(ssize_t sent) {
+  if (sent == 0) {
+    SC32_LOG(error, "write: send returned 0 (peer?)");
+    throw std::runtime_error("Peer closed");
+  }
+
+  const int e = getErrno();
+  if (e == EAGAIN
 #ifdef EWOULDBLOCK
-        || e == EWOULDBLOCK
+      || e == EWOULDBLOCK
 #endif
-        || e == ETIMEDOUT) {
-      if (timeoutHandler()) {
-        SC32_LOG(error, "write: timeoutHandler() says reconnect");
-        throw std::runtime_error("Reconnection required");
-      }
-      continue;
-    }
-    if (e == EINTR)
-      continue;
-    if (e == EPIPE || e == ECONNRESET) {
-      SC32_LOG(error, "write: connection lost (errno=%d %s)", e, strerror(e));
+      || e == ETIMEDOUT) {
+    if (timeoutHandler()) {
+      SC32_LOG(error, "write: timeoutHandler() says reconnect");
       throw std::runtime_error("Reconnection required");
     }
-
-    SC32_LOG(error, "write: fatal errno=%d (%s)", e, strerror(e));
-    throw std::runtime_error("Error in write");
+    return;
   }
-  return data.size();
+  if (e == EINTR)
+    return;
+  if (e == EPIPE || e == ECONNRESET) {
+    SC32_LOG(error, "write: connection lost (errno=%d %s)", e, strerror(e));
+    throw std::runtime_error("Reconnection required");
+  }
+
+  SC32_LOG(error, "write: fatal errno=%d (%s)", e, strerror(e));
+  throw std::runtime_error("Error in write");
 }
 
 void PlainConnection::readBlock(uint8_t* dst, size_t size) {
-  size_t idx = 0;
+  // Whatever an earlier recv() pulled in comes first
+  size_t idx = std::min(size, this->readEnd - this->readStart);
+  memcpy(dst, this->readBuffer.data() + this->readStart, idx);
+  this->readStart += idx;
 
   while (idx < size) {
-    ssize_t n =
-        ::recv(apSock, reinterpret_cast<char*>(dst + idx), size - idx, 0);
-    if (n > 0) {
-      idx += static_cast<size_t>(n);
+    size_t missing = size - idx;
+    if (missing >= READ_BUFFER_SIZE) {
+      // Large bodies go straight to dst
+      idx += recvSome(dst + idx, missing);
       continue;
     }
+    // The buffer is drained here, refill it with all that is available
+    this->readStart = 0;
+    this->readEnd = recvSome(this->readBuffer.data(), READ_BUFFER_SIZE);
+    size_t n = std::min(missing, this->readEnd);
+    memcpy(dst + idx, this->readBuffer.data(), n);
+    this->readStart = n;
+    idx += n;
+  }
+}
+
+uint8_t* PlainConnection::readSpan(size_t size) {
+  if (size > READ_BUFFER_SIZE) {
+    throw std::runtime_error("Span larger than the read buffer");
+  }
+  if (this->readEnd - this->readStart < size) {
+    // Move the rest to the front and fill up behind it
+    memmove(this->readBuffer.data(), this->readBuffer.data() + this->readStart,
+            this->readEnd - this->readStart);
+    this->readEnd -= this->readStart;
+    this->readStart = 0;
+    while (this->readEnd < size) {
+      this->readEnd += recvSome(this->readBuffer.data() + this->readEnd,
+                                READ_BUFFER_SIZE - this->readEnd);
+    }
+  }
+  uint8_t* span = this->readBuffer.data() + this->readStart;
+  this->readStart += size;
+  return span;
+}
+
+size_t PlainConnection::recvSome(uint8_t* dst, size_t size) {
+  while (true) {
+    ssize_t n = ::recv(apSock, reinterpret_cast<char*>(dst), size, 0);
+    if (n > 0) {
+      recvCalls++;
+      return static_cast<size_t>(n);
+    }
 
     if (n == 0) {
       SC32_LOG(error, "read: peer closed (recv==0)");
@@ -216,6 +318,13 @@ void PlainConnection::readBlock(uint8_t* dst, size_t size) {
   }
 }
 
+PlainConnection::IoStats PlainConnection::ioStats() {
+  IoStats stats;
+  stats.recvCalls = recvCalls.load();
+  stats.sendCalls = sendCalls.load();
+  return stats;
+}
+
 void PlainConnection::close() {
   if (this->apSock < 0)
     return;
@@ -228,4 +337,6 @@ void PlainConnection::close() {
   ::close(this->apSock);
 #endif
   this->apSock = -1;
+  this->readStart = 0;
+  this->readEnd = 0;
 }
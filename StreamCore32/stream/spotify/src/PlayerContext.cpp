@@ -161,6 +161,8 @@ void PlayerContext::autoplayQuery(
       }
       //else
       //return responseFunction((void*)radio_offset);
+      // A failed or timed out query has no parts to read below
+      return;
     }
     std::string resolve_autoplay =
         std::string(res.parts[0].begin(), res.parts[0].end());
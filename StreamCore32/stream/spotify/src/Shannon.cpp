@@ -2,6 +2,7 @@
 
 #include <limits.h>  // for CHAR_BIT
 #include <stddef.h>  // for size_t
+#include <string.h>  // for memcpy
 
 using std::size_t;
 
@@ -35,40 +36,38 @@ uint32_t Shannon::sbox2(uint32_t w) {
 
 void Shannon::cycle() {
   uint32_t t;
-  int i;
 
   /* nonlinear feedback function */
-  t = this->R[12] ^ this->R[13] ^ this->konst;
-  t = Shannon::sbox1(t) ^ rotl(this->R[0], 1);
-  /* shift register */
-  for (i = 1; i < N; ++i)
-    this->R[i - 1] = this->R[i];
-  this->R[N - 1] = t;
-  t = Shannon::sbox2(this->R[2] ^ this->R[15]);
-  this->R[0] ^= t;
-  this->sbuf = t ^ this->R[8] ^ this->R[12];
+  t = this->reg(12) ^ this->reg(13) ^ this->konst;
+  t = Shannon::sbox1(t) ^ rotl(this->reg(0), 1);
+  /* shift register, the slot of word 0 becomes word N - 1 */
+  this->reg(0) = t;
+  this->r = (this->r + 1) & (N - 1);
+  t = Shannon::sbox2(this->reg(2) ^ this->reg(15));
+  this->reg(0) ^= t;
+  this->sbuf = t ^ this->reg(8) ^ this->reg(12);
 }
 
 void Shannon::crcfunc(uint32_t i) {
   uint32_t t;
-  int j;
 
   /* Accumulate CRC of input */
-  t = this->CRC[0] ^ this->CRC[2] ^ this->CRC[15] ^ i;
-  for (j = 1; j < N; ++j)
-    this->CRC[j - 1] = this->CRC[j];
-  this->CRC[N - 1] = t;
+  t = this->crc(0) ^ this->crc(2) ^ this->crc(15) ^ i;
+  this->crc(0) = t;
+  this->c = (this->c + 1) & (N - 1);
 }
 
 void Shannon::macfunc(uint32_t i) {
   this->crcfunc(i);
-  this->R[KEYP] ^= i;
+  this->reg(KEYP) ^= i;
 }
 
 void Shannon::initState() {
   int i;
 
   /* Register initialised to Fibonacci numbers; Counter zeroed. */
+  this->r = 0;
+  this->c = 0;
   this->R[0] = 1;
   this->R[1] = 1;
   for (i = 2; i < N; ++i)
@@ -78,16 +77,16 @@ void Shannon::initState() {
 void Shannon::saveState() {
   int i;
   for (i = 0; i < Shannon::N; ++i)
-    this->initR[i] = this->R[i];
+    this->initR[i] = this->reg(i);
 }
 void Shannon::reloadState() {
   int i;
 
   for (i = 0; i < Shannon::N; ++i)
-    this->R[i] = this->initR[i];
+    this->reg(i) = this->initR[i];
 }
 void Shannon::genkonst() {
-  this->konst = this->R[0];
+  this->konst = this->reg(0);
 }
 void Shannon::diffuse() {
   int i;
@@ -107,33 +106,37 @@ void Shannon::diffuse() {
     (b)[1] = Byte(w, 1); \
     (b)[0] = Byte(w, 0); \
   }
-#define XORWORD(w, b)     \
-  {                       \
-    (b)[3] ^= Byte(w, 3); \
-    (b)[2] ^= Byte(w, 2); \
-    (b)[1] ^= Byte(w, 1); \
-    (b)[0] ^= Byte(w, 0); \
-  }
+/* Whole words, in place. Little-endian targets load them directly, memcpy
+ * keeps unaligned buffers legal and is a single load/store otherwise. */
+static inline uint32_t loadWord(const uint8_t* b) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  uint32_t w;
+  memcpy(&w, b, sizeof(w));
+  return w;
+#else
+  return BYTE2WORD(b);
+#endif
+}
 
-#define XORWORD(w, b)     \
-  {                       \
-    (b)[3] ^= Byte(w, 3); \
-    (b)[2] ^= Byte(w, 2); \
-    (b)[1] ^= Byte(w, 1); \
-    (b)[0] ^= Byte(w, 0); \
-  }
+static inline void storeWord(uint8_t* b, uint32_t w) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  memcpy(b, &w, sizeof(w));
+#else
+  WORD2BYTE(w, b);
+#endif
+}
 
 /* Load key material into the register
  */
-#define ADDKEY(k) this->R[KEYP] ^= (k);
+#define ADDKEY(k) this->reg(KEYP) ^= (k);
 
-void Shannon::loadKey(const std::vector<uint8_t>& key) {
-  int i, j;
+void Shannon::loadKey(const uint8_t* key, size_t keylen) {
+  size_t i;
+  int j;
   uint32_t k;
   uint8_t xtra[4];
-  size_t keylen = key.size();
   /* start folding in key */
-  for (i = 0; i < (keylen & ~0x3); i += 4) {
+  for (i = 0; i < (keylen & ~(size_t)0x3); i += 4) {
     k = BYTE2WORD(&key[i]);
     ADDKEY(k);
     this->cycle();
@@ -156,36 +159,40 @@ void Shannon::loadKey(const std::vector<uint8_t>& key) {
 
   /* save a copy of the register */
   for (i = 0; i < N; ++i)
-    this->CRC[i] = this->R[i];
+    this->crc(i) = this->reg(i);
 
   /* now diffuse */
   this->diffuse();
 
   /* now xor the copy back -- makes key loading irreversible */
   for (i = 0; i < N; ++i)
-    this->R[i] ^= this->CRC[i];
+    this->reg(i) ^= this->crc(i);
 }
 
-void Shannon::key(const std::vector<uint8_t>& key) {
+void Shannon::key(const uint8_t* key, size_t len) {
   this->initState();
-  this->loadKey(key);
+  this->loadKey(key, len);
   this->genkonst(); /* in case we proceed to stream generation */
   this->saveState();
   this->nbuf = 0;
 }
 
-void Shannon::nonce(const std::vector<uint8_t>& nonce) {
+void Shannon::nonce(const uint8_t* nonce, size_t len) {
   this->reloadState();
   this->konst = Shannon::INITKONST;
-  this->loadKey(nonce);
+  this->loadKey(nonce, len);
   this->genkonst();
   this->nbuf = 0;
 }
 
-void Shannon::stream(std::vector<uint8_t>& bufVec) {
+void Shannon::nonce(uint32_t counter) {
+  uint8_t iv[4] = {(uint8_t)(counter >> 24), (uint8_t)(counter >> 16),
+                   (uint8_t)(counter >> 8), (uint8_t)counter};
+  this->nonce(iv, sizeof(iv));
+}
+
+void Shannon::stream(uint8_t* buf, size_t nbytes) {
   uint8_t* endbuf;
-  size_t nbytes = bufVec.size();
-  uint8_t* buf = bufVec.data();
   /* handle any previously buffered bytes */
   while (this->nbuf != 0 && nbytes != 0) {
     *buf++ ^= this->sbuf & 0xFF;
@@ -195,10 +202,10 @@ void Shannon::stream(std::vector<uint8_t>& bufVec) {
   }
 
   /* handle whole words */
-  endbuf = &buf[nbytes & ~((uint32_t)0x03)];
+  endbuf = &buf[nbytes & ~((size_t)0x03)];
   while (buf < endbuf) {
     this->cycle();
-    XORWORD(this->sbuf, buf);
+    storeWord(buf, loadWord(buf) ^ this->sbuf);
     buf += 4;
   }
 
@@ -216,11 +223,8 @@ void Shannon::stream(std::vector<uint8_t>& bufVec) {
   }
 }
 
-void Shannon::maconly(std::vector<uint8_t>& bufVec) {
-  size_t nbytes = bufVec.size();
-  uint8_t* buf = bufVec.data();
-
-  uint8_t* endbuf;
+void Shannon::maconly(const uint8_t* buf, size_t nbytes) {
+  const uint8_t* endbuf;
 
   /* handle any previously buffered bytes */
   if (this->nbuf != 0) {
@@ -236,10 +240,10 @@ void Shannon::maconly(std::vector<uint8_t>& bufVec) {
   }
 
   /* handle whole words */
-  endbuf = &buf[nbytes & ~((uint32_t)0x03)];
+  endbuf = &buf[nbytes & ~((size_t)0x03)];
   while (buf < endbuf) {
     this->cycle();
-    this->macfunc(BYTE2WORD(buf));
+    this->macfunc(loadWord(buf));
     buf += 4;
   }
 
@@ -257,9 +261,7 @@ void Shannon::maconly(std::vector<uint8_t>& bufVec) {
   }
 }
 
-void Shannon::encrypt(std::vector<uint8_t>& bufVec) {
-  size_t nbytes = bufVec.size();
-  uint8_t* buf = bufVec.data();
+void Shannon::encrypt(uint8_t* buf, size_t nbytes) {
   uint8_t* endbuf;
   uint32_t t = 0;
 
@@ -279,13 +281,12 @@ void Shannon::encrypt(std::vector<uint8_t>& bufVec) {
   }
 
   /* handle whole words */
-  endbuf = &buf[nbytes & ~((uint32_t)0x03)];
+  endbuf = &buf[nbytes & ~((size_t)0x03)];
   while (buf < endbuf) {
     this->cycle();
-    t = BYTE2WORD(buf);
+    t = loadWord(buf);
     this->macfunc(t);
-    t ^= this->sbuf;
-    WORD2BYTE(t, buf);
+    storeWord(buf, t ^ this->sbuf);
     buf += 4;
   }
 
@@ -305,9 +306,7 @@ void Shannon::encrypt(std::vector<uint8_t>& bufVec) {
   }
 }
 
-void Shannon::decrypt(std::vector<uint8_t>& bufVec) {
-  size_t nbytes = bufVec.size();
-  uint8_t* buf = bufVec.data();
+void Shannon::decrypt(uint8_t* buf, size_t nbytes) {
   uint8_t* endbuf;
   uint32_t t = 0;
 
@@ -327,12 +326,12 @@ void Shannon::decrypt(std::vector<uint8_t>& bufVec) {
   }
 
   /* handle whole words */
-  endbuf = &buf[nbytes & ~((uint32_t)0x03)];
+  endbuf = &buf[nbytes & ~((size_t)0x03)];
   while (buf < endbuf) {
     this->cycle();
-    t = BYTE2WORD(buf) ^ this->sbuf;
+    t = loadWord(buf) ^ this->sbuf;
     this->macfunc(t);
-    WORD2BYTE(t, buf);
+    storeWord(buf, t);
     buf += 4;
   }
 
@@ -352,10 +351,8 @@ void Shannon::decrypt(std::vector<uint8_t>& bufVec) {
   }
 }
 
-void Shannon::finish(std::vector<uint8_t>& bufVec) {
-  size_t nbytes = bufVec.size();
-  uint8_t* buf = bufVec.data();
-  int i;
+void Shannon::finish(uint8_t* buf, size_t nbytes) {
+  unsigned int i;
 
   /* handle any previously buffered bytes */
   if (this->nbuf != 0) {
@@ -374,14 +371,14 @@ void Shannon::finish(std::vector<uint8_t>& bufVec) {
 
   /* now add the CRC to the stream register and diffuse it */
   for (i = 0; i < N; ++i)
-    this->R[i] ^= this->CRC[i];
+    this->reg(i) ^= this->crc(i);
   this->diffuse();
 
   /* produce output from the stream buffer */
   while (nbytes > 0) {
     this->cycle();
     if (nbytes >= 4) {
-      WORD2BYTE(this->sbuf, buf);
+      storeWord(buf, this->sbuf);
       nbytes -= 4;
       buf += 4;
     } else {
@@ -391,3 +388,8 @@ void Shannon::finish(std::vector<uint8_t>& bufVec) {
     }
   }
 }
+
+void Shannon::seal(uint8_t* buf, size_t len, uint8_t* mac, size_t macLen) {
+  this->encrypt(buf, len);
+  this->finish(mac, macLen);
+}
@@ -1,5 +1,8 @@
 #include "ShannonConnection.h"
 
+#include <string.h>     // for memcmp
+#include <atomic>       // for atomic
+#include <chrono>       // for steady_clock
 #include <type_traits>  // for remove_extent_t
 
 #include "BellLogger.h"       // for AbstractLogger
@@ -7,13 +10,22 @@
 #include "Packet.h"           // for Packet, spotify
 #include "PlainConnection.h"  // for PlainConnection
 #include "Shannon.h"          // for Shannon
-#include "Utils.h"            // for pack, extract
-#ifndef _WIN32
-#include <arpa/inet.h>
-#endif
 
 using namespace spotify;
 
+namespace {
+std::atomic<uint64_t> cipheredBytes = 0;
+std::atomic<uint64_t> cipherBusyUs = 0;
+std::atomic<uint32_t> packetsIn = 0;
+std::atomic<uint32_t> packetsOut = 0;
+
+uint64_t elapsedUs(std::chrono::steady_clock::time_point since) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - since)
+      .count();
+}
+}  // namespace
+
 ShannonConnection::ShannonConnection() {}
 
 ShannonConnection::~ShannonConnection() {
@@ -33,77 +45,84 @@ void ShannonConnection::wrapConnection(
   this->recvCipher->key(recvKey);
 
   // Set initial nonce
-  this->sendCipher->nonce(pack<uint32_t>(htonl(0)));
-  this->recvCipher->nonce(pack<uint32_t>(htonl(0)));
+  this->sendCipher->nonce((uint32_t)0);
+  this->recvCipher->nonce((uint32_t)0);
 }
 
 void ShannonConnection::sendPacket(uint8_t cmd, std::vector<uint8_t>& data) {
   std::scoped_lock lock(this->writeMutex);
-  auto rawPacket = this->cipherPacket(cmd, data);
+  // Packet structure, [Command] [Size] [Raw data] [Mac]
+  uint8_t header[3] = {cmd, uint8_t(data.size() >> 8), uint8_t(data.size())};
+  uint8_t mac[MAC_SIZE];
 
-  // Shannon encrypt the packet and write it to sock
-  this->sendCipher->encrypt(rawPacket);
-  this->conn->writeBlock(rawPacket);
-
-  // Generate mac
-  std::vector<uint8_t> mac(MAC_SIZE);
-  this->sendCipher->finish(mac);
+  // Header and data are one stream for the cipher, data is encrypted in place
+  auto startedAt = std::chrono::steady_clock::now();
+  this->sendCipher->encrypt(header, sizeof(header));
+  this->sendCipher->seal(data.data(), data.size(), mac, MAC_SIZE);
 
   // Update the nonce
   this->sendNonce += 1;
-  this->sendCipher->nonce(pack<uint32_t>(htonl(this->sendNonce)));
+  this->sendCipher->nonce(this->sendNonce);
+  countCipher(sizeof(header) + data.size() + MAC_SIZE, elapsedUs(startedAt));
+  packetsOut++;
 
-  // Write the mac to sock
-  this->conn->writeBlock(mac);
+  this->conn->writeBlocks({{header, sizeof(header)},
+                           {data.data(), data.size()},
+                           {mac, MAC_SIZE}});
 }
 
 spotify::Packet ShannonConnection::recvPacket() {
   std::scoped_lock lock(this->readMutex);
 
-  std::vector<uint8_t> data(3);
   // Receive 3 bytes, cmd + int16 size
-  this->conn->readBlock(data.data(), 3);
-  this->recvCipher->decrypt(data);
+  uint8_t* header = this->conn->readSpan(3);
+  auto startedAt = std::chrono::steady_clock::now();
+  this->recvCipher->decrypt(header, 3);
+  uint64_t busyUs = elapsedUs(startedAt);
 
-  auto readSize = ntohs(extract<uint16_t>(data, 1));
+  uint8_t cmd = header[0];
+  uint16_t readSize = (header[1] << 8) | header[2];
   auto packetData = std::vector<uint8_t>(readSize);
 
   // Read and decode if the packet has an actual body
   if (readSize > 0) {
     this->conn->readBlock(packetData.data(), readSize);
-    this->recvCipher->decrypt(packetData);
+    startedAt = std::chrono::steady_clock::now();
+    this->recvCipher->decrypt(packetData.data(), readSize);
+    busyUs += elapsedUs(startedAt);
   }
 
   // Read mac
-  std::vector<uint8_t> mac(MAC_SIZE);
-  this->conn->readBlock(mac.data(), MAC_SIZE);
+  uint8_t* mac = this->conn->readSpan(MAC_SIZE);
 
   // Generate mac
-  std::vector<uint8_t> mac2(MAC_SIZE);
-  this->recvCipher->finish(mac2);
+  startedAt = std::chrono::steady_clock::now();
+  uint8_t mac2[MAC_SIZE];
+  this->recvCipher->finish(mac2, MAC_SIZE);
 
-  if (mac != mac2) {
+  if (memcmp(mac, mac2, MAC_SIZE) != 0) {
     SC32_LOG(error, "Shannon read: Mac doesn't match");
   }
 
   // Update the nonce
   this->recvNonce += 1;
-  this->recvCipher->nonce(pack<uint32_t>(htonl(this->recvNonce)));
-  uint8_t cmd = 0;
-  if (data.size() > 0) {
-    cmd = data[0];
-  }
-  // data[0] == cmd
-  return Packet{cmd, packetData};
-}
+  this->recvCipher->nonce(this->recvNonce);
+  countCipher(3 + readSize + MAC_SIZE, busyUs + elapsedUs(startedAt));
+  packetsIn++;
 
-std::vector<uint8_t> ShannonConnection::cipherPacket(
-    uint8_t cmd, std::vector<uint8_t>& data) {
-  // Generate packet structure, [Command] [Size] [Raw data]
-  auto sizeRaw = pack<uint16_t>(htons(uint16_t(data.size())));
+  return Packet{cmd, std::move(packetData)};
+}
 
-  sizeRaw.insert(sizeRaw.begin(), cmd);
-  sizeRaw.insert(sizeRaw.end(), data.begin(), data.end());
+void ShannonConnection::countCipher(size_t bytes, uint64_t busyUs) {
+  cipheredBytes.fetch_add(bytes, std::memory_order_relaxed);
+  cipherBusyUs.fetch_add(busyUs, std::memory_order_relaxed);
+}
 
-  return sizeRaw;
+ShannonConnection::CipherStats ShannonConnection::cipherStats() {
+  CipherStats stats;
+  stats.bytes = cipheredBytes.load(std::memory_order_relaxed);
+  stats.busyUs = cipherBusyUs.load(std::memory_order_relaxed);
+  stats.packetsIn = packetsIn.load(std::memory_order_relaxed);
+  stats.packetsOut = packetsOut.load(std::memory_order_relaxed);
+  return stats;
 }
@@ -0,0 +1,47 @@
+#include "TimeoutWheel.h"
+
+using namespace spotify;
+
+TimeoutWheel::TimeoutWheel() {
+  lastTick = std::chrono::steady_clock::now();
+}
+
+void TimeoutWheel::schedule(uint64_t key, uint32_t timeoutMs) {
+  std::scoped_lock lock(wheelMutex);
+  // The current tick is partly over, count it as not started
+  uint32_t ticks = timeoutMs / TICK_MS + 1;
+  slots[(cursor + ticks) & (SLOTS - 1)].push_back(
+      {key, (uint32_t)((ticks - 1) / SLOTS)});
+  timers++;
+}
+
+void TimeoutWheel::advance(std::vector<uint64_t>& expired) {
+  auto now = std::chrono::steady_clock::now();
+  std::scoped_lock lock(wheelMutex);
+  auto ticks = std::chrono::duration_cast<std::chrono::milliseconds>(
+                   now - lastTick)
+                   .count() /
+               TICK_MS;
+  lastTick += std::chrono::milliseconds(ticks * TICK_MS);
+
+  for (; ticks > 0; ticks--) {
+    cursor = (cursor + 1) & (SLOTS - 1);
+    auto& slot = slots[cursor];
+    size_t kept = 0;
+    for (auto& timer : slot) {
+      if (timer.rounds == 0) {
+        expired.push_back(timer.key);
+        timers--;
+      } else {
+        timer.rounds--;
+        slot[kept++] = timer;
+      }
+    }
+    slot.resize(kept);
+  }
+}
+
+size_t TimeoutWheel::size() {
+  std::scoped_lock lock(wheelMutex);
+  return timers;
+}
@@ -0,0 +1,187 @@
+#include "TrackDecoder.h"
+
+#include <string.h>   // for memcpy
+#include <algorithm>  // for min
+#include <chrono>     // for steady_clock, milliseconds
+
+#include "BellUtils.h"  // for BELL_SLEEP_MS
+
+using namespace spotify;
+
+TrackDecoder::TrackDecoder(Decode decode, Seek seek, size_t capacity,
+                           Prepare prepare)
+    : bell::Task("spotify_decode", 1024 * 24, 5, 1),
+      decode(decode),
+      seekDecoder(seek),
+      prepare(prepare),
+      startedAt(std::chrono::steady_clock::now()) {
+  ring.resize(std::max(capacity, CHUNK_SIZE));
+  counters.capacity = ring.size();
+  counters.minDepth = ring.size();
+  isRunning = true;
+  startTask();
+}
+
+TrackDecoder::~TrackDecoder() {
+  wantStop = true;
+  ringChanged.notify_all();
+  // The decoder state belongs to the caller, let the current call return
+  while (isRunning) {
+    BELL_SLEEP_MS(10);
+  }
+}
+
+size_t TrackDecoder::read(uint8_t* dst, size_t len, uint32_t timeoutMs) {
+  auto waitStart = std::chrono::steady_clock::now();
+  std::unique_lock lock(ringMutex);
+  bool underrun = fill == 0 && !done;
+  ringChanged.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this] {
+    return fill > 0 || done || wantStop;
+  });
+
+  if (underrun && primed) {
+    counters.minDepth = 0;
+    counters.stalls++;
+    counters.stallMs += std::chrono::duration_cast<std::chrono::milliseconds>(
+                            std::chrono::steady_clock::now() - waitStart)
+                            .count();
+  }
+  if (fill == 0) {
+    return 0;
+  }
+
+  if (primed) {
+    counters.minDepth = std::min(counters.minDepth, fill);
+  }
+  depthSum += fill;
+  depthSamples++;
+  primed = true;
+
+  size_t got = std::min(len, fill);
+  size_t first = std::min(got, ring.size() - readIndex);
+  memcpy(dst, ring.data() + readIndex, first);
+  memcpy(dst + first, ring.data(), got - first);
+  readIndex = (readIndex + got) % ring.size();
+  fill -= got;
+  lock.unlock();
+
+  ringChanged.notify_all();
+  return got;
+}
+
+void TrackDecoder::seek(size_t ms) {
+  {
+    std::scoped_lock lock(ringMutex);
+    generation++;
+    seekPending = true;
+    seekMs = ms;
+    readIndex = 0;
+    fill = 0;
+    primed = false;
+    // A decoder that failed to prepare has nothing to resume
+    if (!unprepared) {
+      done = false;
+      status = 0;
+    }
+  }
+  ringChanged.notify_all();
+}
+
+bool TrackDecoder::finished() {
+  std::scoped_lock lock(ringMutex);
+  return done && fill == 0 && status == 0;
+}
+
+bool TrackDecoder::failed() {
+  std::scoped_lock lock(ringMutex);
+  return done && fill == 0 && status < 0;
+}
+
+TrackDecoder::Stats TrackDecoder::stats() {
+  std::scoped_lock lock(ringMutex);
+  Stats current = counters;
+  current.uptimeMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+                         std::chrono::steady_clock::now() - startedAt)
+                         .count();
+  current.avgDepth = depthSamples ? (size_t)(depthSum / depthSamples) : 0;
+  if (depthSamples == 0) {
+    current.minDepth = 0;
+  }
+  return current;
+}
+
+void TrackDecoder::runTask() {
+  std::vector<uint8_t> chunk(CHUNK_SIZE);
+
+  if (prepare && !prepare()) {
+    {
+      std::scoped_lock lock(ringMutex);
+      done = true;
+      status = -1;
+      unprepared = true;
+    }
+    ringChanged.notify_all();
+    isRunning = false;
+    return;
+  }
+
+  while (!wantStop) {
+    uint32_t decodeGeneration;
+    bool doSeek = false;
+    size_t ms = 0;
+    {
+      std::unique_lock lock(ringMutex);
+      if (done && !seekPending) {
+        // Nothing left to decode until a seek comes in
+        ringChanged.wait_for(lock, std::chrono::milliseconds(100));
+        continue;
+      }
+      decodeGeneration = generation;
+      doSeek = seekPending;
+      ms = seekMs;
+      seekPending = false;
+    }
+
+    auto decodeStart = std::chrono::steady_clock::now();
+    if (doSeek) {
+      seekDecoder(ms);
+    }
+    long ret = decode(chunk.data(), chunk.size());
+    uint32_t spent = std::chrono::duration_cast<std::chrono::milliseconds>(
+                         std::chrono::steady_clock::now() - decodeStart)
+                         .count();
+
+    std::unique_lock lock(ringMutex);
+    counters.busyMs += spent;
+    if (decodeGeneration != generation) {
+      // A seek came in meanwhile, this PCM is from the old position
+      continue;
+    }
+    if (ret <= 0) {
+      done = true;
+      status = ret;
+      lock.unlock();
+      ringChanged.notify_all();
+      continue;
+    }
+
+    size_t written = 0;
+    while (written < (size_t)ret && !wantStop &&
+           decodeGeneration == generation) {
+      size_t space = ring.size() - fill;
+      if (space == 0) {
+        ringChanged.wait_for(lock, std::chrono::milliseconds(100));
+        continue;
+      }
+      size_t writeIndex = (readIndex + fill) % ring.size();
+      size_t n = std::min({space, (size_t)ret - written,
+                           ring.size() - writeIndex});
+      memcpy(ring.data() + writeIndex, chunk.data() + written, n);
+      fill += n;
+      written += n;
+      ringChanged.notify_all();
+    }
+  }
+
+  isRunning = false;
+}
@@ -1,5 +1,6 @@
 #include "TrackPlayer.h"
 
+#include <chrono>       // for steady_clock, milliseconds
 #include <mutex>        // for mutex, scoped_lock
 #include <string>       // for string
 #include <type_traits>  // for remove_extent_t
@@ -35,22 +36,34 @@ class PlaybackMetrics;
 using namespace spotify;
 
 #ifndef CONFIG_BELL_NOCODEC
+// Each vorbis file reads from its own CDN file, the next track opens early
 static size_t vorbisReadCb(void* ptr, size_t size, size_t nmemb,
-                           TrackPlayer* self) {
-  return self->_vorbisRead(ptr, size, nmemb);
+                           CDNAudioFile* file) {
+  return file->readBytes((uint8_t*)ptr, nmemb * size);
 }
 
-static int vorbisCloseCb(TrackPlayer* self) {
-  return self->_vorbisClose();
+static int vorbisCloseCb(CDNAudioFile* file) {
+  return 0;
 }
 
-static int vorbisSeekCb(TrackPlayer* self, int64_t offset, int whence) {
+static int vorbisSeekCb(CDNAudioFile* file, int64_t offset, int whence) {
+  switch (whence) {
+    case 0:
+      file->seek(offset);  // Spotify header offset
+      break;
+    case 1:
+      file->seek(file->getPosition() + offset);
+      break;
+    case 2:
+      file->seek(file->getSize() + offset);
+      break;
+  }
 
-  return self->_vorbisSeek(offset, whence);
+  return 0;
 }
 
-static long vorbisTellCb(TrackPlayer* self) {
-  return self->_vorbisTell();
+static long vorbisTellCb(CDNAudioFile* file) {
+  return file->getPosition();
 }
 #endif
 
@@ -67,7 +80,6 @@ TrackPlayer::TrackPlayer(std::shared_ptr<spotify::Context> ctx,
 
 #ifndef CONFIG_BELL_NOCODEC
   // Initialize vorbis callbacks
-  vorbisFile = {};
   vorbisCallbacks = {
       (decltype(ov_callbacks::read_func))&vorbisReadCb,
       (decltype(ov_callbacks::seek_func))&vorbisSeekCb,
@@ -134,10 +146,19 @@ void TrackPlayer::runTask() {
   size_t tracksPlayed = 1;
   bool eof = false;
   bool endOfQueueReached = false;
+  // End of the last PCM handed to the sink, to measure track changes
+  auto lastAudioAt = std::chrono::steady_clock::now();
 
   while (isRunning.load()) {
     bool properStream = true;
-    if (this->trackQueue->playableSemaphore->twait(500) != 0) {
+    bool trackEnded = eof;
+#ifndef CONFIG_BELL_NOCODEC
+    // The next track is open already, move on without waiting
+    bool gapless = upcoming != nullptr && !pendingReset;
+#else
+    bool gapless = false;
+#endif
+    if (!gapless && this->trackQueue->playableSemaphore->twait(500) != 0) {
       continue;
     }
 
@@ -146,13 +167,18 @@ void TrackPlayer::runTask() {
       track = nullptr;
       pendingReset = false;
       inFuture = false;
+#ifndef CONFIG_BELL_NOCODEC
+      upcoming.reset();
+#endif
     }
 
     endOfQueueReached = false;
 
     // Wait 800ms. If next reset is requested in meantime, restart the queue.
     // Gets rid of excess actions during rapid queueing
-    BELL_SLEEP_MS(50);
+    if (!gapless) {
+      BELL_SLEEP_MS(50);
+    }
 
     if (pendingReset) {
       continue;
@@ -194,11 +220,37 @@ void TrackPlayer::runTask() {
     {
       std::scoped_lock lock(playbackMutex);
       bool skipped = 0;
+      bool preopened = false;
 
+#ifndef CONFIG_BELL_NOCODEC
+      preopened = upcoming != nullptr && upcoming->track == track;
+      if (preopened && upcoming->decoder->failed()) {
+        // The open on the decoder task failed, a CDN hiccup most likely;
+        // give the track the regular inline open
+        SC32_LOG(info, "Track opened ahead failed, opening it again");
+        preopened = false;
+      }
+      if (preopened) {
+        playing = std::move(upcoming);
+      } else {
+        upcoming.reset();
+        playing = std::make_unique<DecodingTrack>();
+        playing->track = track;
+        playing->file = track->getAudioFile();
+      }
+      currentTrackStream = playing->file;
+#else
       currentTrackStream = track->getAudioFile();
+#endif
+      auto openedAt = std::chrono::steady_clock::now();
+      bool audioStarted = false;
       // Open the stream
 #ifndef CONFIG_BELL_NOCODEC
-      currentTrackStream->openStream();
+      if (!preopened && !openVorbis(playing.get())) {
+        SC32_LOG(error, "Track failed to open, skipping it");
+        this->setState(track, State::FAILED);
+        continue;
+      }
 #else
       ssize_t start_offset = 0;
       uint8_t* headerBuf = currentTrackStream->openStream(start_offset);
@@ -217,10 +269,7 @@ void TrackPlayer::runTask() {
       this->setState(track, State::PLAYING);
       startPaused = false;
 
-#ifndef CONFIG_BELL_NOCODEC
-      int32_t r =
-          ov_open_callbacks(this, &vorbisFile, NULL, 0, vorbisCallbacks);
-#else
+#ifdef CONFIG_BELL_NOCODEC
       size_t toWrite = start_offset;
       while (toWrite) {
         size_t written = dataCallback(headerBuf + (start_offset - toWrite),
@@ -246,15 +295,31 @@ void TrackPlayer::runTask() {
       ctx->playbackMetrics->end_reason = PlaybackMetrics::REMOTE;
 
 #ifndef CONFIG_BELL_NOCODEC
-      if (track->requestedPosition > 0) {
-        VORBIS_SEEK(&vorbisFile, track->requestedPosition);
+      if (preopened) {
+        if (track->requestedPosition > 0) {
+          playing->decoder->seek(track->requestedPosition);
+        }
+      } else {
+        if (track->requestedPosition > 0) {
+          VORBIS_SEEK(&playing->vorbisFile, track->requestedPosition);
+        }
+        // From here on the vorbis state belongs to the decoder task
+        startDecoder(playing.get(), false);
       }
+      size_t playedBytes = 0;
 #else
-      size_t seekPosition =
-          track->requestedPosition * duration_lambda + start_offset;
-      currentTrackStream->seek(seekPosition);
-      if (track->requestedPosition > 0)
+      if (track->requestedPosition > 0) {
+        uint32_t landedMs = 0;
+        if (currentTrackStream->seekMs(track->requestedPosition, &landedMs)) {
+          track->requestedPosition = landedMs;
+        } else {
+          currentTrackStream->seek(
+              track->requestedPosition * duration_lambda + start_offset);
+        }
         skipped = true;
+      } else {
+        currentTrackStream->seek(start_offset);
+      }
 #endif
 
       eof = false;
@@ -267,14 +332,23 @@ void TrackPlayer::runTask() {
 
           // Seek to the new position
 #ifndef CONFIG_BELL_NOCODEC
-          VORBIS_SEEK(&vorbisFile, track->requestedPosition);
+          playing->decoder->seek(track->requestedPosition);
+          playedBytes = 0;
 #else
-          uint32_t seekPosition = track->requestedPosition * duration_lambda +
-                                  headerSize(tracksPlayed);
-          currentTrackStream->seek(seekPosition);
+          // Page exact where possible, the byte estimate lands mid-page
+          uint32_t landedMs = 0;
+          if (currentTrackStream->seekMs(track->requestedPosition,
+                                         &landedMs)) {
+            track->requestedPosition = landedMs;
+          } else {
+            uint32_t seekPosition =
+                track->requestedPosition * duration_lambda +
+                headerSize(tracksPlayed);
+            currentTrackStream->seek(seekPosition);
+          }
           skipped = true;
 #endif
-          track->trackMetrics->newPosition(pendingSeekPositionMs);
+          track->trackMetrics->newPosition(track->requestedPosition);
           // Reset the pending seek position
           pendingSeekPositionMs = 0;
           this->setState(track, State::SEEKING);
@@ -285,10 +359,29 @@ void TrackPlayer::runTask() {
             this->currentTrackStream->readBytes(&pcmBuffer[0],
                                                 pcmBuffer.size());
 #else
-            VORBIS_READ(&vorbisFile, (char*)&pcmBuffer[0], pcmBuffer.size(),
-                        &currentSection);
+            playing->decoder->read(&pcmBuffer[0], pcmBuffer.size(), 100);
+        if (ret == 0 && playing->decoder->failed()) {
+          ret = -1;
+        } else if (ret == 0 && !playing->decoder->finished()) {
+          // Decoder is behind, check for resets and seeks meanwhile
+          continue;
+        }
 #endif
 
+        if (ret > 0 && !audioStarted) {
+          audioStarted = true;
+          auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+              std::chrono::steady_clock::now() - openedAt);
+          SC32_LOG(info, "First audio %u ms after opening the track",
+                   (unsigned)ms.count());
+          if (trackEnded) {
+            ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - lastAudioAt);
+            SC32_LOG(info, "Track change took %u ms (%s)",
+                     (unsigned)ms.count(),
+                     preopened ? "opened ahead" : "opened at the end");
+          }
+        }
         if (ret < 0) {
           SC32_LOG(error, "Track failed to reload, skipping it");
           currentSongPlaying = false;
@@ -320,12 +413,33 @@ void TrackPlayer::runTask() {
               toWrite -= written;
             }
             track->written_bytes += ret;
+            lastAudioAt = std::chrono::steady_clock::now();
+#ifndef CONFIG_BELL_NOCODEC
+            playedBytes += ret;
+            if (upcoming == nullptr && !*repeating_track_ &&
+                track->requestedPosition + playedBytes / PCM_BYTES_PER_MS +
+                        PREOPEN_MS >=
+                    track->trackInfo.duration) {
+              prepareNext(track);
+            }
+#endif
           }
         }
       }
       tracksPlayed++;
 #ifndef CONFIG_BELL_NOCODEC
-      ov_clear(&vorbisFile);
+      auto stats = playing->decoder->stats();
+      playing.reset();
+      SC32_LOG(info,
+               "PCM ring: %u ms, avg %u ms deep (min %u ms), %u stalls "
+               "(%u ms), decoder busy %u%%",
+               (unsigned)(stats.capacity / PCM_BYTES_PER_MS),
+               (unsigned)(stats.avgDepth / PCM_BYTES_PER_MS),
+               (unsigned)(stats.minDepth / PCM_BYTES_PER_MS),
+               (unsigned)stats.stalls, (unsigned)stats.stallMs,
+               stats.uptimeMs ? (unsigned)((uint64_t)stats.busyMs * 100 /
+                                           stats.uptimeMs)
+                              : 0u);
 #endif
 
       // always move back to LOADING (ensure proper seeking after last track has been loaded)
@@ -345,43 +459,59 @@ void TrackPlayer::runTask() {
 }
 
 #ifndef CONFIG_BELL_NOCODEC
-size_t TrackPlayer::_vorbisRead(void* ptr, size_t size, size_t nmemb) {
-  if (this->currentTrackStream == nullptr) {
-    return 0;
+TrackPlayer::DecodingTrack::~DecodingTrack() {
+  // Stop decoding before the vorbis state and the file go away
+  decoder.reset();
+  if (vorbisOpen) {
+    ov_clear(&vorbisFile);
   }
-  return this->currentTrackStream->readBytes((uint8_t*)ptr, nmemb * size);
-}
-
-size_t TrackPlayer::_vorbisClose() {
-  return 0;
 }
 
-int TrackPlayer::_vorbisSeek(int64_t offset, int whence) {
-  if (this->currentTrackStream == nullptr) {
-    return 0;
+bool TrackPlayer::openVorbis(DecodingTrack* stream) {
+  if (stream->file == nullptr || !stream->file->openStream()) {
+    return false;
   }
-  switch (whence) {
-    case 0:
-      this->currentTrackStream->seek(offset);  // Spotify header offset
-      break;
-    case 1:
-      this->currentTrackStream->seek(this->currentTrackStream->getPosition() +
-                                     offset);
-      break;
-    case 2:
-      this->currentTrackStream->seek(this->currentTrackStream->getSize() +
-                                     offset);
-      break;
+  stream->vorbisOpen = ov_open_callbacks(stream->file.get(),
+                                         &stream->vorbisFile, NULL, 0,
+                                         vorbisCallbacks) == 0;
+  if (!stream->vorbisOpen) {
+    // The data arrived but is no Ogg stream, likely a stale key
+    stream->track->dropCachedAudioKey();
   }
+  return stream->vorbisOpen;
+}
 
-  return 0;
+void TrackPlayer::startDecoder(DecodingTrack* stream, bool openFirst) {
+  TrackDecoder::Prepare prepare = nullptr;
+  if (openFirst) {
+    prepare = [this, stream]() { return openVorbis(stream); };
+  }
+  stream->decoder = std::make_unique<TrackDecoder>(
+      [stream](uint8_t* out, size_t len) {
+        return (long)VORBIS_READ(&stream->vorbisFile, (char*)out, len,
+                                 &stream->currentSection);
+      },
+      [stream](size_t ms) { VORBIS_SEEK(&stream->vorbisFile, ms); },
+      PCM_RING_MS * PCM_BYTES_PER_MS, prepare);
 }
 
-long TrackPlayer::_vorbisTell() {
-  if (this->currentTrackStream == nullptr) {
-    return 0;
+void TrackPlayer::prepareNext(std::shared_ptr<QueuedTrack> track) {
+  int offset = 0;
+  auto next = trackQueue->consumeTrack(track, offset);
+  if (next == nullptr || next->state != QueuedTrack::State::READY) {
+    return;
+  }
+  auto file = next->getAudioFile();
+  if (file == nullptr) {
+    return;
   }
-  return this->currentTrackStream->getPosition();
+
+  // Opens and starts buffering on its own decoder task
+  upcoming = std::make_unique<DecodingTrack>();
+  upcoming->track = next;
+  upcoming->file = file;
+  startDecoder(upcoming.get(), true);
+  SC32_LOG(info, "Opening the next track ahead of time");
 }
 #endif
 
@@ -8,11 +8,15 @@
 #include <random>
 
 #include "AccessKeyFetcher.h"
+#include "AudioKeyCache.h"  // for AudioKeyCache
 #include "BellTask.h"
 #include "BellUtils.h"  // for BELL_SLEEP_MS
 #include "CDNAudioFile.h"
+#include "CDNUrlCache.h"  // for CDNUrlCache
 #include "HTTPClient.h"
+#include "HostRateLimiter.h"
 #include "Logger.h"
+#include "OggHeaderCache.h"  // for OggHeaderCache
 #include "SpotifyContext.h"
 #include "Utils.h"
 #include "WrappedSemaphore.h"
@@ -37,21 +41,6 @@ bool countryListContains(char* countryList, const char* country) {
   return false;
 }
 
-bool doRestrictionsApply(Restriction* restrictions, int count,
-                         const char* country) {
-  for (int x = 0; x < count; x++) {
-    if (restrictions[x].countries_allowed != nullptr) {
-      return !countryListContains(restrictions[x].countries_allowed, country);
-    }
-
-    if (restrictions[x].countries_forbidden != nullptr) {
-      return countryListContains(restrictions[x].countries_forbidden, country);
-    }
-  }
-
-  return false;
-}
-
 bool canPlayTrack(Track& trackInfo, int altIndex, const char* country) {
   if (altIndex < 0) {
 
@@ -77,53 +66,18 @@ bool canPlayTrack(Track& trackInfo, int altIndex, const char* country) {
 }
 }  // namespace TrackDataUtils
 
-void TrackInfo::loadPbTrack(Track* pbTrack, const std::vector<uint8_t>& gid) {
+void TrackInfo::loadCached(const MetadataCache::Entry& entry,
+                           const std::vector<uint8_t>& gid) {
   // Generate ID based on GID
   trackId = bytesToHexString(gid);
 
-  name = std::string(pbTrack->name);
-
-  if (pbTrack->artist_count > 0) {
-    // Handle artist data
-    artist = std::string(pbTrack->artist[0].name);
-  }
-
-  if (pbTrack->has_album) {
-    // Handle album data
-    album = std::string(pbTrack->album.name);
-
-    if (pbTrack->album.has_cover_group &&
-        pbTrack->album.cover_group.image_count > 0) {
-      auto imageId =
-          pbArrayToVector(pbTrack->album.cover_group
-                              .image[pbTrack->album.cover_group.image_count - 1]
-                              .file_id);
-      imageUrl = "https://i.scdn.co/image/" + bytesToHexString(imageId);
-    }
-  }
-
-  number = pbTrack->has_number ? pbTrack->number : 0;
-  discNumber = pbTrack->has_disc_number ? pbTrack->disc_number : 0;
-  duration = pbTrack->duration;
-}
-
-void TrackInfo::loadPbEpisode(Episode* pbEpisode,
-                              const std::vector<uint8_t>& gid) {
-  // Generate ID based on GID
-  trackId = bytesToHexString(gid);
-
-  name = std::string(pbEpisode->name);
-
-  if (pbEpisode->covers.image_count > 0) {
-    // Handle episode info
-    auto imageId = pbArrayToVector(
-        pbEpisode->covers.image[pbEpisode->covers.image_count - 1].file_id);
-    imageUrl = "https://i.scdn.co/image/" + bytesToHexString(imageId);
-  }
-
-  number = pbEpisode->has_number ? pbEpisode->number : 0;
-  discNumber = 0;
-  duration = pbEpisode->duration;
+  name = entry.name;
+  artist = entry.artist;
+  album = entry.album;
+  imageUrl = entry.imageUrl;
+  number = entry.number;
+  discNumber = entry.discNumber;
+  duration = entry.duration;
 }
 
 QueuedTrack::QueuedTrack(
@@ -132,6 +86,7 @@ QueuedTrack::QueuedTrack(
     std::shared_ptr<bell::WrappedSemaphore> playableSemaphore,
     int64_t requestedPosition)
     : requestedPosition((uint32_t)requestedPosition), ctx(ctx) {
+  queuedAt = std::chrono::steady_clock::now();
   trackMetrics = std::make_shared<TrackMetrics>(ctx, requestedPosition);
   this->playableSemaphore = playableSemaphore;
   this->ref = ref;
@@ -161,8 +116,8 @@ QueuedTrack::~QueuedTrack() {
   if (state < State::READY)
     state = State::FAILED;
 
-  if (pendingMercuryRequest != 0) {
-    ctx->session->unregister(pendingMercuryRequest);
+  if (pendingMetadataRequest != 0) {
+    metadataBatcher->cancel(pendingMetadataRequest);
   }
 
   if (pendingAudioKeyRequest != 0) {
@@ -187,78 +142,77 @@ std::shared_ptr<spotify::CDNAudioFile> QueuedTrack::getAudioFile() {
     return nullptr;
   }
 
-  return std::make_shared<spotify::CDNAudioFile>(cdnUrl, audioKey);
+  // Renewed in the background since this track was resolved
+  std::string url = cdnUrl;
+  CDNUrlCache::shared().load(fileId, &url);
+  return std::make_shared<spotify::CDNAudioFile>(url, audioKey, fileId);
 }
 
-bool QueuedTrack::stepParseMetadata(Track* pbTrack, Episode* pbEpisode) {
-  int alternativeCount, filesCount = 0;
-  bool canPlay = false;
-  AudioFile* selectedFiles = nullptr;
+void QueuedTrack::dropCachedAudioKey() {
+  AudioKeyCache::shared().invalidate(trackId, fileId);
+}
 
-  const char* countryCode = ctx->session->getCountryCode().c_str();
+bool QueuedTrack::stepParseMetadata(const MetadataCache::Entry& entry) {
+  const MetadataCache::Candidate* selected = nullptr;
 
-  if (gid.first == SpotifyFileType::TRACK) {
+  std::string country = ctx->session->getCountryCode();
+  const char* countryCode = country.c_str();
+
+  if (entry.candidates.empty()) {
+    SC32_LOG(info, "No playable files found");
+    return false;
+  }
+  if (!entry.episode) {
 
     // Check if we can play the track, if not, try alternatives
-    if (TrackDataUtils::doRestrictionsApply(
-            pbTrack->restriction, pbTrack->restriction_count, countryCode)) {
+    if (MetadataCache::isRestricted(entry.candidates[0], countryCode)) {
       // Go through alternatives
-      for (int x = 0; x < pbTrack->alternative_count; x++) {
-        if (!TrackDataUtils::doRestrictionsApply(
-                pbTrack->alternative[x].restriction,
-                pbTrack->alternative[x].restriction_count, countryCode)) {
+      for (size_t x = 1; x < entry.candidates.size(); x++) {
+        if (!MetadataCache::isRestricted(entry.candidates[x], countryCode)) {
           SC32_LOG(info, "Found alternative track");
-          selectedFiles = pbTrack->alternative[x].file;
-          filesCount = pbTrack->alternative[x].file_count;
-          trackId = pbArrayToVector(pbTrack->alternative[x].gid);
+          selected = &entry.candidates[x];
           break;
         }
       }
     } else {
       // We can play the track
-      selectedFiles = pbTrack->file;
-      filesCount = pbTrack->file_count;
-      trackId = pbArrayToVector(pbTrack->gid);
-    }
-
-    if (trackId.size() > 0) {
-      // Load track information
-      trackInfo.loadPbTrack(pbTrack, trackId);
+      selected = &entry.candidates[0];
     }
   } else {
     // Handle episodes
 
     // Check if we can play the episode
-    if (!TrackDataUtils::doRestrictionsApply(pbEpisode->restriction,
-                                             pbEpisode->restriction_count,
-                                             countryCode)) {
-      selectedFiles = pbEpisode->file;
-      filesCount = pbEpisode->file_count;
-      trackId = pbArrayToVector(pbEpisode->gid);
-
-      // Load track information
-      trackInfo.loadPbEpisode(pbEpisode, trackId);
+    if (!MetadataCache::isRestricted(entry.candidates[0], countryCode)) {
+      selected = &entry.candidates[0];
     }
   }
-  if (selectedFiles == nullptr) {
+  if (selected == nullptr) {
     SC32_LOG(info, "No playable files found");
     return false;
   }
-  // Find playable file
-  for (int x = 0; x < filesCount; x++) {
-    if (selectedFiles[x].format == audioFormat) {
-      fileId = pbArrayToVector(selectedFiles[x].file_id);
+  trackId = selected->gid;
+  if (trackId.size() > 0) {
+    // Load track information
+    trackInfo.loadCached(entry, trackId);
+  }
+
+  // Find playable file, a lower format after failed key requests must not
+  // keep the file picked before
+  fileId.clear();
+  identifier.clear();
+  audioKey.clear();
+  for (auto& file : selected->files) {
+    if (file.first == audioFormat) {
+      fileId = file.second;
       break;  // If file found stop searching
     }
 
     // Fallback to OGG Vorbis 96kbps
-    if (fileId.size() == 0 &&
-        selectedFiles[x].format == AudioFormat_OGG_VORBIS_96) {
-      fileId = pbArrayToVector(selectedFiles[x].file_id);
+    if (fileId.size() == 0 && file.first == AudioFormat_OGG_VORBIS_96) {
+      fileId = file.second;
       SC32_LOG(info, "Falling back to OGG Vorbis 96kbps");
     }
   }
-
   // No viable files found for playback
   if (fileId.size() == 0) {
     SC32_LOG(info, "File not available for playback");
@@ -272,31 +226,58 @@ bool QueuedTrack::stepParseMetadata(Track* pbTrack, Episode* pbEpisode) {
 void QueuedTrack::stepLoadAudioFile(
     std::mutex& trackListMutex,
     std::shared_ptr<bell::WrappedSemaphore> updateSemaphore) {
+  // Played before, the key does not change
+  if (AudioKeyCache::shared().load(trackId, fileId, &audioKey)) {
+    state = State::CDN_REQUIRED;
+    updateSemaphore->give();
+    return;
+  }
+
   // Request audio key
   this->pendingAudioKeyRequest = ctx->session->requestAudioKey(
       trackId, fileId,
-      [this, &trackListMutex, updateSemaphore](
-          bool success, const std::vector<uint8_t>& audioKey) {
+      [this, self = weak_from_this(), &trackListMutex, updateSemaphore](
+          MercurySession::ResponseError error,
+          const std::vector<uint8_t>& audioKey) {
+        // Expired requests are answered outside the session lock, the
+        // track may be gone by then
+        auto track = self.lock();
+        if (track == nullptr) {
+          return;
+        }
         std::scoped_lock lock(trackListMutex);
+        // Answered or not, the session holds no callback for it anymore
+        pendingAudioKeyRequest = 0;
 
-        if (success) {
+        if (error == MercurySession::ResponseError::NONE) {
           this->audioKey =
               std::vector<uint8_t>(audioKey.begin() + 4, audioKey.end());
+          AudioKeyCache::shared().store(trackId, fileId, this->audioKey);
 
           state = State::CDN_REQUIRED;
           updateSemaphore->give();
         } else {
-          SC32_LOG(error, "Failed to get audio key");
-          retries++;
-          state = State::KEY_REQUIRED;
-          if (retries > 10) {
-            if (audioFormat > AudioFormat_OGG_VORBIS_96) {
-              audioFormat = (AudioFormat)(audioFormat - 1);
-              state = State::QUEUED;
-              updateSemaphore->give();
-            } else {
-              cancelLoading();
-            }
+          SC32_LOG(error, "Failed to get audio key%s",
+                   error == MercurySession::ResponseError::TIMEOUT
+                       ? ", timed out"
+                       : "");
+          if (++retries < MAX_KEY_RETRIES) {
+            // The queue task asks again once the wait is over
+            state = State::KEY_REQUIRED;
+            retryAt = std::chrono::steady_clock::now() +
+                      std::chrono::milliseconds(KEY_RETRY_BACKOFF_MS
+                                                << retries);
+            updateSemaphore->give();
+          } else if (audioFormat > AudioFormat_OGG_VORBIS_96) {
+            // A lower quality file, with retries of its own
+            retries = 0;
+            audioFormat = (AudioFormat)(audioFormat - 1);
+            state = State::QUEUED;
+            updateSemaphore->give();
+          } else {
+            // The cached file ids may be stale, look them up again
+            MetadataCache::shared().invalidate(gid.second);
+            cancelLoading();
           }
         }
       });
@@ -304,7 +285,64 @@ void QueuedTrack::stepLoadAudioFile(
   state = State::PENDING_KEY;
 }
 
+bool QueuedTrack::resolveCDNUrl(const std::string& accessKey, bool refresh) {
+  std::string requestUrl = string_format(
+      "https://api.spotify.com/v1/storage-resolve/files/audio/interactive/"
+      "%s?alt=json",
+      bytesToHexString(fileId).c_str());
+  // playback waits on a first resolve, so it goes ahead of queued lookups
+  auto permit = HostRateLimiter::shared().acquire(
+      requestUrl, refresh ? HostRateLimiter::Priority::Background
+                          : HostRateLimiter::Priority::Interactive);
+  auto req = bell::HTTPClient::get(
+      requestUrl, {bell::HTTPClient::ValueHeader(
+                      {"Authorization", "Bearer " + accessKey})});
+  HostRateLimiter::shared().observe(requestUrl, *req);
+
+  // Wait for response
+  std::string result = req->body_string();
+  if (result == "") {
+    return false;
+  }
+  std::vector<std::string> urls;
+  uint32_t ttl = 0;
+#ifdef BELL_ONLY_CJSON
+  cJSON* jsonResult = cJSON_Parse(result.data());
+  cJSON* url = NULL;
+  cJSON_ArrayForEach(url, cJSON_GetObjectItem(jsonResult, "cdnurl")) {
+    urls.push_back(url->valuestring);
+  }
+  cJSON* ttlItem = cJSON_GetObjectItem(jsonResult, "ttl");
+  if (cJSON_IsNumber(ttlItem)) {
+    ttl = ttlItem->valueint;
+  }
+  cJSON_Delete(jsonResult);
+#else
+  auto jsonResult = nlohmann::json::parse(result);
+  for (auto& url : jsonResult["cdnurl"]) {
+    urls.push_back(url);
+  }
+  ttl = jsonResult.value("ttl", 0);
+#endif
+  if (urls.empty()) {
+    return false;
+  }
+  CDNUrlCache::shared().store(fileId, urls, ttl, refresh);
+  if (!refresh) {
+    cdnUrl = urls[0];
+  }
+  return true;
+}
+
 void QueuedTrack::stepLoadCDNUrl(const std::string& accessKey) {
+  // Resolved not long ago and still valid
+  if (CDNUrlCache::shared().load(fileId, &cdnUrl)) {
+    CDNUrlCache::shared().noteReused();
+    state = State::READY;
+    playableSemaphore->give();
+    return;
+  }
+
   if (accessKey.size() == 0) {
     // Wait for access key
     return;
@@ -313,34 +351,18 @@ void QueuedTrack::stepLoadCDNUrl(const std::string& accessKey) {
   // Request CDN URL
 
   try {
-
-    std::string requestUrl = string_format(
-        "https://api.spotify.com/v1/storage-resolve/files/audio/interactive/"
-        "%s?alt=json",
-        bytesToHexString(fileId).c_str());
-    auto req = bell::HTTPClient::get(
-        requestUrl, {bell::HTTPClient::ValueHeader(
-                        {"Authorization", "Bearer " + accessKey})});
-
-    // Wait for response
-    std::string result = req->body_string();
-    if (result == "") {
+    if (!resolveCDNUrl(accessKey, false)) {
       state = State::FAILED;
       playableSemaphore->give();
       return;
     }
-#ifdef BELL_ONLY_CJSON
-    cJSON* jsonResult = cJSON_Parse(result.data());
-    cdnUrl = cJSON_GetArrayItem(cJSON_GetObjectItem(jsonResult, "cdnurl"), 0)
-                 ->valuestring;
-    cJSON_Delete(jsonResult);
-#else
-    auto jsonResult = nlohmann::json::parse(result);
-    cdnUrl = jsonResult["cdnurl"][0];
-#endif
 
     // SC32_LOG(info, "Received CDN URL, %s", cdnUrl.c_str());
     state = State::READY;
+    SC32_LOG(info, "Track resolved %u ms after queueing",
+             (unsigned)std::chrono::duration_cast<std::chrono::milliseconds>(
+                 std::chrono::steady_clock::now() - queuedAt)
+                 .count());
   } catch (...) {
     SC32_LOG(error, "Cannot fetch CDN URL");
     state = State::FAILED;
@@ -348,40 +370,70 @@ void QueuedTrack::stepLoadCDNUrl(const std::string& accessKey) {
   playableSemaphore->give();
 }
 
+bool QueuedTrack::refreshCDNUrl(const std::string& accessKey) {
+  if (state != State::READY || accessKey.size() == 0 ||
+      !CDNUrlCache::shared().claimRefresh(fileId)) {
+    return false;
+  }
+  try {
+    resolveCDNUrl(accessKey, true);
+  } catch (...) {
+    SC32_LOG(error, "Cannot refresh CDN URL");
+  }
+  return true;
+}
+
 void QueuedTrack::stepLoadMetadata(
     Track* pbTrack, Episode* pbEpisode, std::mutex& trackListMutex,
-    std::shared_ptr<bell::WrappedSemaphore> updateSemaphore) {
+    std::shared_ptr<bell::WrappedSemaphore> updateSemaphore,
+    std::shared_ptr<MetadataBatcher> batcher) {
   // Prepare request ID
   std::string requestUrl =
       string_format("hm://metadata/3/%s/%s",
                     gid.first == SpotifyFileType::TRACK ? "track" : "episode",
                     bytesToHexString(gid.second).c_str());
 
-  auto responseHandler = [this, pbTrack, pbEpisode, &trackListMutex,
-                          updateSemaphore](MercurySession::Response res) {
+  // The reply may land while the track is being dropped, the callback keeps
+  // it alive until it returns, or skips it once it is gone
+  auto responseHandler = [this, self = weak_from_this(), pbTrack, pbEpisode,
+                          &trackListMutex,
+                          updateSemaphore](bool success,
+                                           const std::vector<uint8_t>& data) {
+    auto track = self.lock();
+    if (track == nullptr) {
+      return;
+    }
     std::scoped_lock lock(trackListMutex);
+    pendingMetadataRequest = 0;
 
-    if (res.parts.size() == 0) {
+    if (!success || data.empty()) {
       SC32_LOG(info, "Invalid Metadata");
       // Invalid metadata, cannot proceed
       cancelLoading();
       return;
     }
     bool ret = false;
+    std::vector<uint8_t> payload = data;
     if (gid.first == SpotifyFileType::TRACK) {
       pb_release(Track_fields, pbTrack);
-      ret = pbDecode(*pbTrack, Track_fields, res.parts[0]);
+      ret = pbDecode(*pbTrack, Track_fields, payload);
     } else {
       pb_release(Episode_fields, pbEpisode);
-      ret = pbDecode(*pbEpisode, Episode_fields, res.parts[0]);
+      ret = pbDecode(*pbEpisode, Episode_fields, payload);
     }
     if (!ret) {
       SC32_LOG(info, "Failed to decode Metadata");
       cancelLoading();
       return;
     }
+    std::string country = ctx->session->getCountryCode();
+    auto entry = gid.first == SpotifyFileType::TRACK
+                     ? MetadataCache::fromTrack(*pbTrack, country)
+                     : MetadataCache::fromEpisode(*pbEpisode, country);
+    MetadataCache::shared().store(gid.second, entry);
+
     // Parse received metadata
-    ret = stepParseMetadata(pbTrack, pbEpisode);
+    ret = stepParseMetadata(entry);
     if (!ret) {
       SC32_LOG(info, "Failed to parse Metadata");
       cancelLoading();
@@ -389,11 +441,26 @@ void QueuedTrack::stepLoadMetadata(
     }
     updateSemaphore->give();
   };
-  // Execute the request
-  if (pbTrack != NULL || pbEpisode != NULL)
-    pendingMercuryRequest = ctx->session->execute(
-        MercurySession::RequestType::GET, requestUrl, responseHandler);
-  else {
+
+  // Seen before, in this session or an earlier one
+  MetadataCache::Entry cached;
+  if (MetadataCache::shared().load(gid.second, ctx->session->getCountryCode(),
+                                  &cached)) {
+    if (!stepParseMetadata(cached)) {
+      SC32_LOG(info, "Failed to parse Metadata");
+      MetadataCache::shared().invalidate(gid.second);
+      cancelLoading();
+      return;
+    }
+    updateSemaphore->give();
+    return;
+  }
+
+  // Goes out with the other lookups of this pass
+  if (pbTrack != NULL || pbEpisode != NULL) {
+    metadataBatcher = batcher;
+    pendingMetadataRequest = batcher->request(requestUrl, responseHandler);
+  } else {
     SC32_LOG(info, "Invalid Metadata");
     // Invalid metadata, cannot proceed
     cancelLoading();
@@ -411,6 +478,7 @@ TrackQueue::TrackQueue(std::shared_ptr<spotify::Context> ctx)
   processSemaphore_ =
       static_cast<bell::WrappedSemaphore*>(processSemaphore.get());
   playableSemaphore = std::make_shared<bell::WrappedSemaphore>();
+  metadataBatcher = std::make_shared<MetadataBatcher>(ctx->session);
 
   // Start the task
   startTask();
@@ -431,6 +499,13 @@ void TrackQueue::runTask() {
 
   while (isRunning) {
     if (processSemaphore->twait(200)) {
+      // Idle, renew CDN urls of queued tracks before they run out and write
+      // back the headers of tracks that finished
+      refreshCDNUrls();
+      OggHeaderCache::shared().flush();
+      if (keyRetryDue()) {
+        processSemaphore->give();
+      }
       continue;
     }
 
@@ -442,12 +517,39 @@ void TrackQueue::runTask() {
       trackQueue = preloadedTracks;
     }
 
+    // Mercury replies arrive on their own, so metadata and key requests for
+    // the upcoming tracks go out together, metadata as one batch per pass.
+    // The storage-resolve call blocks this task and runs for one track per
+    // pass, nearest track first.
+    int inFlight = 0;
     for (auto& track : trackQueue) {
-      if (track) {
-        if (this->processTrack(track))
-          break;
+      if (track && track->state == QueuedTrack::State::PENDING_KEY) {
+        inFlight++;
       }
     }
+
+    std::shared_ptr<QueuedTrack> cdnTrack = nullptr;
+    for (auto& track : trackQueue) {
+      if (!track) {
+        continue;
+      }
+      if (track->state == QueuedTrack::State::CDN_REQUIRED) {
+        if (cdnTrack == nullptr) {
+          cdnTrack = track;
+        }
+        continue;
+      }
+      this->processTrack(track, inFlight);
+    }
+    metadataBatcher->flush();
+    AudioKeyCache::shared().flush();
+    MetadataCache::shared().flush();
+
+    if (cdnTrack != nullptr && this->processTrack(cdnTrack, inFlight) &&
+        cdnTrack->state != QueuedTrack::State::CDN_REQUIRED) {
+      // Further tracks may be waiting for their URL
+      processSemaphore->give();
+    }
   }
 }
 
@@ -483,13 +585,45 @@ std::shared_ptr<QueuedTrack> TrackQueue::consumeTrack(
   return preloadedTracks[offset];
 }
 
-bool TrackQueue::processTrack(std::shared_ptr<QueuedTrack> track) {
+void TrackQueue::refreshCDNUrls() {
+  std::deque<std::shared_ptr<QueuedTrack>> tracks;
+  {
+    std::scoped_lock lock(tracksMutex);
+    tracks = preloadedTracks;
+  }
+  for (auto& track : tracks) {
+    // One per idle spell, new work may be waiting by then
+    if (track && track->refreshCDNUrl(accessKey)) {
+      return;
+    }
+  }
+}
+
+bool TrackQueue::keyRetryDue() {
+  std::scoped_lock lock(tracksMutex);
+  auto now = std::chrono::steady_clock::now();
+  for (auto& track : preloadedTracks) {
+    if (track && track->state == QueuedTrack::State::KEY_REQUIRED &&
+        track->retries > 0 && now >= track->retryAt) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool TrackQueue::processTrack(std::shared_ptr<QueuedTrack> track,
+                              int& inFlight) {
   switch (track->state) {
     case QueuedTrack::State::QUEUED:
       track->stepLoadMetadata(&track->pbTrack, &track->pbEpisode, tracksMutex,
-                              processSemaphore);
+                              processSemaphore, metadataBatcher);
       break;
     case QueuedTrack::State::KEY_REQUIRED:
+      if (inFlight >= MAX_IN_FLIGHT ||
+          std::chrono::steady_clock::now() < track->retryAt) {
+        return false;
+      }
+      inFlight++;
       track->stepLoadAudioFile(tracksMutex, processSemaphore);
       break;
     case QueuedTrack::State::CDN_REQUIRED:
@@ -0,0 +1,290 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+
+#include "UrlOrigin.h"
+
+namespace streamcore::helpers {
+
+// Incremental scanner for Icecast status-json.xsl documents.
+// The body is fed in arbitrary chunks as it arrives from the socket; only
+// icestats.source (a single object or an array of objects) is tracked and no
+// DOM is built. Scanning stops once the source whose listenurl path equals
+// the wanted mount has been closed. Without a mount the first source that
+// carries a title wins, as the old DOM lookup did.
+class IcecastStatusScanner {
+ public:
+  explicit IcecastStatusScanner(std::string mount = std::string())
+      : mount_(std::move(mount)) {
+    if (mount_ == "/")
+      mount_.clear();
+  }
+
+  // Returns false once no further input is needed.
+  bool feed(const char* data, size_t n) {
+    for (size_t i = 0; i < n && !done_; ++i) {
+      ++scanned_;
+      step(data[i]);
+    }
+    return !done_;
+  }
+
+  bool done() const { return done_; }
+  bool matched() const { return found_; }
+  size_t bytesScanned() const { return scanned_; }
+
+  // "artist - title" of the matched source, else of the first titled one.
+  std::string title() const {
+    const Source& s = found_ ? best_ : fallback_;
+    if (!s.artist.empty() && !s.title.empty())
+      return s.artist + " - " + s.title;
+    return s.title;
+  }
+
+ private:
+  enum class Role : uint8_t { Root, Icestats, SourceList, Source, Other };
+  enum class Lex : uint8_t { Structure, String, Escape, Unicode };
+
+  struct Source {
+    std::string listenurl;
+    std::string title;
+    std::string artist;
+    void clear() {
+      listenurl.clear();
+      title.clear();
+      artist.clear();
+    }
+  };
+
+  static constexpr size_t kMaxDepth = 32;
+  static constexpr size_t kMaxKey = 16;
+  static constexpr size_t kMaxValue = 512;
+
+  void step(char c) {
+    switch (lex_) {
+      case Lex::Structure:
+        structure(c);
+        break;
+      case Lex::String:
+        if (c == '"')
+          endString();
+        else if (c == '\\')
+          lex_ = Lex::Escape;
+        else
+          append(c);
+        break;
+      case Lex::Escape:
+        lex_ = Lex::String;
+        switch (c) {
+          case 'u':
+            lex_ = Lex::Unicode;
+            hexDigits_ = 0;
+            hexValue_ = 0;
+            break;
+          case 'n':
+            append('\n');
+            break;
+          case 't':
+            append('\t');
+            break;
+          case 'r':
+            append('\r');
+            break;
+          case 'b':
+            append('\b');
+            break;
+          case 'f':
+            append('\f');
+            break;
+          default:
+            append(c);  // '"', '\\', '/'
+            break;
+        }
+        break;
+      case Lex::Unicode: {
+        int v = hexVal(c);
+        if (v < 0) {
+          lex_ = Lex::String;  // malformed escape, keep going
+          break;
+        }
+        hexValue_ = (hexValue_ << 4) | (uint32_t)v;
+        if (++hexDigits_ == 4) {
+          lex_ = Lex::String;
+          codePoint(hexValue_);
+        }
+      } break;
+    }
+  }
+
+  void structure(char c) {
+    switch (c) {
+      case '{':
+      case '[': {
+        bool obj = (c == '{');
+        if (depth_ >= kMaxDepth) {
+          done_ = true;  // nothing of interest lives this deep
+          return;
+        }
+        Role r = childRole(obj);
+        roles_[depth_] = r;
+        isObj_[depth_] = obj;
+        ++depth_;
+        expectKey_ = obj;
+        if (r == Role::Source)
+          cur_.clear();
+      } break;
+      case '}':
+      case ']':
+        if (depth_ == 0) {
+          done_ = true;
+          return;
+        }
+        --depth_;
+        if (roles_[depth_] == Role::Source)
+          sourceClosed();
+        if (depth_ == 0)
+          done_ = true;
+        expectKey_ = false;
+        break;
+      case ':':
+        expectKey_ = false;
+        break;
+      case ',':
+        expectKey_ = depth_ > 0 && isObj_[depth_ - 1];
+        break;
+      case '"':
+        lex_ = Lex::String;
+        pendingHigh_ = 0;
+        if (depth_ > 0 && isObj_[depth_ - 1] && expectKey_) {
+          inKey_ = true;
+          key_.clear();
+          target_ = &key_;
+          limit_ = kMaxKey;
+        } else {
+          inKey_ = false;
+          target_ = valueTarget();
+          limit_ = kMaxValue;
+          if (target_)
+            target_->clear();
+        }
+        break;
+      default:
+        break;  // whitespace, numbers, true/false/null
+    }
+  }
+
+  Role childRole(bool obj) const {
+    if (depth_ == 0)
+      return obj ? Role::Root : Role::Other;
+    Role parent = roles_[depth_ - 1];
+    if (parent == Role::Root && obj && key_ == "icestats")
+      return Role::Icestats;
+    if (parent == Role::Icestats && key_ == "source")
+      return obj ? Role::Source : Role::SourceList;
+    if (parent == Role::SourceList && obj)
+      return Role::Source;
+    return Role::Other;
+  }
+
+  std::string* valueTarget() {
+    if (depth_ == 0 || roles_[depth_ - 1] != Role::Source)
+      return nullptr;
+    if (key_ == "listenurl")
+      return &cur_.listenurl;
+    if (key_ == "title")
+      return &cur_.title;
+    if (key_ == "artist")
+      return &cur_.artist;
+    return nullptr;
+  }
+
+  void endString() {
+    lex_ = Lex::Structure;
+    target_ = nullptr;
+    if (inKey_) {
+      inKey_ = false;
+      expectKey_ = false;
+    }
+  }
+
+  void sourceClosed() {
+    bool hit = mount_.empty() ? !cur_.title.empty()
+                              : pathOf(cur_.listenurl) == mount_;
+    if (hit) {
+      best_ = cur_;
+      found_ = true;
+      done_ = true;
+    } else if (fallback_.title.empty() && !cur_.title.empty()) {
+      fallback_ = cur_;
+    }
+    cur_.clear();
+  }
+
+  void append(char c) {
+    if (target_ && target_->size() < limit_)
+      target_->push_back(c);
+  }
+
+  void codePoint(uint32_t cp) {
+    if (cp >= 0xD800 && cp <= 0xDBFF) {
+      pendingHigh_ = cp;
+      return;
+    }
+    if (cp >= 0xDC00 && cp <= 0xDFFF) {
+      if (!pendingHigh_)
+        return;
+      cp = 0x10000 + ((pendingHigh_ - 0xD800) << 10) + (cp - 0xDC00);
+    }
+    pendingHigh_ = 0;
+    if (cp < 0x80) {
+      append((char)cp);
+    } else if (cp < 0x800) {
+      append((char)(0xC0 | (cp >> 6)));
+      append((char)(0x80 | (cp & 0x3F)));
+    } else if (cp < 0x10000) {
+      append((char)(0xE0 | (cp >> 12)));
+      append((char)(0x80 | ((cp >> 6) & 0x3F)));
+      append((char)(0x80 | (cp & 0x3F)));
+    } else {
+      append((char)(0xF0 | (cp >> 18)));
+      append((char)(0x80 | ((cp >> 12) & 0x3F)));
+      append((char)(0x80 | ((cp >> 6) & 0x3F)));
+      append((char)(0x80 | (cp & 0x3F)));
+    }
+  }
+
+  static int hexVal(char c) {
+    if (c >= '0' && c <= '9')
+      return c - '0';
+    if (c >= 'a' && c <= 'f')
+      return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+      return c - 'A' + 10;
+    return -1;
+  }
+
+  std::string mount_;
+  Role roles_[kMaxDepth] = {};
+  bool isObj_[kMaxDepth] = {};
+  size_t depth_ = 0;
+  Lex lex_ = Lex::Structure;
+  bool expectKey_ = false;
+  bool inKey_ = false;
+  std::string key_;
+  std::string* target_ = nullptr;
+  size_t limit_ = 0;
+  uint32_t hexValue_ = 0;
+  uint32_t pendingHigh_ = 0;
+  int hexDigits_ = 0;
+
+  Source cur_;
+  Source best_;
+  Source fallback_;
+  bool found_ = false;
+  bool done_ = false;
+  size_t scanned_ = 0;
+};
+
+}  // namespace streamcore::helpers
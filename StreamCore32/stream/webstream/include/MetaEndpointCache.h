@@ -0,0 +1,71 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "StreamCoreFile.h"
+
+// Remembers, per station stream URL, which metadata endpoint worked and
+// which discovery candidates are known to be dead. Everything lives in one
+// record of the injected store so a station rotation costs a single blob.
+class MetaEndpointCache {
+ public:
+  struct Entry {
+    uint8_t kind = 0;      // MetaPoller::Kind of the endpoint
+    std::string url;       // endpoint that produced a title
+    std::string mount;     // stream path it was matched against
+    uint32_t savedAt = 0;  // epoch seconds, 0 if the clock was not set
+    uint8_t failures = 0;  // polls that lost a previously good endpoint
+    // candidates that failed hard, with the time they were seen failing
+    std::vector<std::pair<std::string, uint32_t>> dead;
+  };
+
+  struct Stats {
+    uint32_t hits = 0;           // lookups answered with a live endpoint
+    uint32_t misses = 0;         // lookups that required discovery
+    uint32_t requestsSaved = 0;  // discovery requests not issued
+  };
+
+  static constexpr uint32_t kPositiveTtlSec = 7 * 24 * 3600;
+  static constexpr uint32_t kNegativeTtlSec = 24 * 3600;
+  static constexpr uint8_t kMaxFailures = 3;
+  static constexpr size_t kMaxStations = 24;
+  static constexpr size_t kMaxDead = 16;
+
+  explicit MetaEndpointCache(std::shared_ptr<StreamCoreFile> store)
+      : store_(std::move(store)) {}
+
+  // Fills `out` with a non-expired endpoint for the station.
+  bool lookup(const std::string& station, Entry* out);
+  bool isDead(const std::string& station, const std::string& url);
+
+  void remember(const std::string& station, uint8_t kind,
+                const std::string& url, const std::string& mount);
+  void markFailed(const std::string& station);
+  void markDead(const std::string& station, const std::string& url);
+  void noteSaved(uint32_t requests);
+
+  // Writes pending changes back to the store.
+  void flush();
+  Stats stats();
+
+ private:
+  static constexpr const char* kRecord = "meta_endpoints";
+
+  void loadLocked();
+  void evictLocked();
+  static uint32_t nowSec();
+  static std::string encode(const Entry& e);
+  static bool decode(const std::vector<uint8_t>& raw, Entry* out);
+
+  std::shared_ptr<StreamCoreFile> store_;
+  std::mutex mu_;
+  std::map<std::string, Entry> entries_;
+  bool loaded_ = false;
+  bool dirty_ = false;
+  Stats stats_{};
+};
@@ -1,5 +1,6 @@
 #pragma once
 #include <atomic>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <nlohmann/json.hpp>
@@ -8,7 +9,9 @@
 
 #include "BellTask.h"
 #include "HTTPClient.h"
+#include "IcecastStatusScanner.h"
 #include "Logger.h"
+#include "MetaEndpointCache.h"
 #include "StreamBase.h"
 #include "UrlOrigin.h"
 
@@ -18,7 +21,8 @@ class MetaPoller : public bell::Task {
 
   struct Spec {
     Kind kind = Kind::Auto;
-    std::string url;  // optional explicit endpoint (abs or relative)
+    std::string url;    // optional explicit endpoint (abs or relative)
+    std::string mount;  // stream path, selects the Icecast source
     uint32_t intervalMs = 5000;
     bool enabled = true;
   };
@@ -38,11 +42,21 @@ class MetaPoller : public bell::Task {
   void arm(const std::string& origin, const std::string& station,
            const Spec& spec) {
     std::lock_guard<std::mutex> lk(mu_);
+    std::string key = origin + spec.mount;
+    if (key != stationKey_) {
+      stationKey_ = key;
+      rearmed_ = true;
+    }
     origin_ = origin;
     station_ = station;
     spec_ = spec;
     active_.store(true);
   }
+  // Optional: persists discovered endpoints across restarts
+  void setEndpointCache(std::shared_ptr<MetaEndpointCache> cache) {
+    std::lock_guard<std::mutex> lk(mu_);
+    cache_ = std::move(cache);
+  }
   void disarm() { active_.store(false); }
   void stopTask() { wantStop_.store(true); }
   bool isRunning() const { return isRunning_.load(); }
@@ -56,8 +70,10 @@ class MetaPoller : public bell::Task {
       const std::string& url);
   static int statusFromHeaders(bell::HTTPClient::Response& r);
   static size_t sizeFromHeader(std::string_view sv);
-  static std::string pickIcecastTitle(const json& s);
+  static std::string scanIcecastStatus(bell::HTTPClient::Response& r,
+                                       const std::string& mount);
   static std::string parseShoutcast7(std::string_view);
+  static Kind kindOfUrl(const std::string& url);
   static int toInt(std::string_view sv) {
     int v = 0;
     for (char c : sv)
@@ -74,10 +90,20 @@ class MetaPoller : public bell::Task {
   std::string origin_;
   std::string station_;
   std::string lastTitle_;
+  std::string stationKey_;  // origin + mount, keys the endpoint cache
+  bool rearmed_ = false;
+  std::shared_ptr<MetaEndpointCache> cache_;
 
   // Sticky good endpoint
   std::string lockedUrl_;
-  int lockedFailures_ = 0;  // clear after 3 consecutive bad polls
+  int lockedFailures_ = 0;        // clear after 3 consecutive bad polls
+  bool lockedFromCache_ = false;  // lockedUrl_ was restored, not discovered
+
+  // Candidates that did not answer or answered with an error, by url. A
+  // missing endpoint (404/410, wrong content) is marked dead at once, these
+  // only after kSoftFailuresBeforeDead in a row.
+  static constexpr uint8_t kSoftFailuresBeforeDead = 3;
+  std::map<std::string, uint8_t> softFailures_;
 
   Emit emit_;
   Err err_;
@@ -0,0 +1,78 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "StreamCoreFile.h"
+
+// Per-station stream health history. WebStream fills one Session per
+// connection attempt; the folded Summary is kept per station URL in a single
+// record of the injected store and scored for the WebUI radio list. The
+// record is rewritten every kSaveEvery sessions or kSaveIntervalMs, whichever
+// comes first, and on flush(); a station that keeps failing does not cost a
+// flash write per attempt.
+class StationHealth {
+ public:
+  struct Session {
+    bool connected = false;
+    bool gotMeta = false;        // a title arrived (ICY or poller)
+    bool unexpectedEnd = false;  // ended without a user stop
+    uint32_t connectMs = 0;      // request until response headers
+    uint32_t firstAudioMs = 0;   // request until first byte fed, 0 if none
+    uint32_t underruns = 0;      // reads stalled longer than kStallMs
+    uint32_t durationMs = 0;
+    uint32_t declaredKbps = 0;   // icy-br
+    uint64_t bytes = 0;
+  };
+
+  struct Summary {
+    uint32_t sessions = 0;
+    uint32_t connectFailures = 0;
+    uint32_t reconnects = 0;
+    uint32_t underruns = 0;
+    uint32_t metaSessions = 0;
+    uint32_t listenSec = 0;
+    uint32_t connectMs = 0;      // moving averages
+    uint32_t firstAudioMs = 0;
+    uint32_t throughputPct = 0;  // delivered vs declared bitrate
+    uint32_t lastSeen = 0;       // epoch seconds, 0 if the clock was not set
+
+    // 0..100, higher is more reliable
+    uint8_t score() const;
+  };
+
+  // A read blocking this long has drained a typical sink buffer
+  static constexpr uint32_t kStallMs = 2000;
+  static constexpr size_t kMaxStations = 32;
+  static constexpr uint32_t kSaveEvery = 8;
+  static constexpr uint32_t kSaveIntervalMs = 10 * 60 * 1000;
+
+  explicit StationHealth(std::shared_ptr<StreamCoreFile> store)
+      : store_(std::move(store)) {}
+  ~StationHealth() { flush(); }
+
+  void record(const std::string& station, const Session& s);
+  bool get(const std::string& station, Summary* out);
+  // Writes sessions recorded since the last save back to the store.
+  void flush();
+
+ private:
+  static constexpr const char* kRecord = "station_health";
+
+  void loadLocked();
+  void saveLocked();
+  static std::string encode(const Summary& s);
+  static bool decode(const std::vector<uint8_t>& raw, Summary* out);
+
+  std::shared_ptr<StreamCoreFile> store_;
+  std::mutex mu_;
+  std::map<std::string, Summary> stations_;
+  bool loaded_ = false;
+  uint32_t unsaved_ = 0;  // sessions recorded since the last save
+  std::chrono::steady_clock::time_point savedAt_ =
+      std::chrono::steady_clock::now();
+};
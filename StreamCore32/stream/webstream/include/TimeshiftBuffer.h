@@ -0,0 +1,42 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Circular store of compressed stream bytes, addressed by absolute offsets
+// since the station was tuned. The network side keeps appending (the oldest
+// bytes are overwritten once full) while the play cursor can lag behind or
+// be moved anywhere inside the retained window.
+// Not thread-safe: WebStream's task is the only writer and reader.
+class TimeshiftBuffer {
+ public:
+  // Allocates from PSRAM on ESP32; check valid() afterwards.
+  explicit TimeshiftBuffer(size_t capacity);
+  ~TimeshiftBuffer();
+  TimeshiftBuffer(const TimeshiftBuffer&) = delete;
+  TimeshiftBuffer& operator=(const TimeshiftBuffer&) = delete;
+
+  bool valid() const { return buf_ != nullptr; }
+  size_t capacity() const { return cap_; }
+
+  void clear();
+  void write(const uint8_t* data, size_t n);
+
+  // Contiguous readable bytes at the cursor; consume() what was used.
+  uint8_t* readable(size_t* n);
+  void consume(size_t n);
+
+  // Clamped to [oldest(), head()].
+  void seek(uint64_t pos);
+
+  uint64_t head() const { return head_; }
+  uint64_t oldest() const { return head_ > cap_ ? head_ - cap_ : 0; }
+  uint64_t cursor() const { return cursor_; }
+  size_t behind() const { return (size_t)(head_ - cursor_); }
+  size_t window() const { return (size_t)(head_ - oldest()); }
+
+ private:
+  uint8_t* buf_ = nullptr;
+  size_t cap_ = 0;
+  uint64_t head_ = 0;
+  uint64_t cursor_ = 0;
+};
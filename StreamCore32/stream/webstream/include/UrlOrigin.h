@@ -16,6 +16,17 @@ inline std::string hostOf(const std::string& origin) {
   return origin.substr(
       start, (slash == std::string::npos) ? std::string::npos : slash - start);
 }
+// path without query/fragment (e.g., "/live.mp3"); empty if the url has none
+inline std::string pathOf(const std::string& url) {
+  auto p = url.find("://");
+  size_t start = (p == std::string::npos) ? 0 : p + 3;
+  size_t slash = url.find('/', start);
+  if (slash == std::string::npos)
+    return std::string();
+  size_t end = url.find_first_of("?#", slash);
+  return url.substr(
+      slash, (end == std::string::npos) ? std::string::npos : end - slash);
+}
 
 static std::vector<std::string> genOriginVariants(const std::string& origin) {
   std::vector<std::string> out;
@@ -15,6 +15,8 @@
 #include "HTTPClient.h"
 #include "Logger.h"
 #include "MetaPoller.h"  // your existing poller helper
+#include "StationHealth.h"
+#include "TimeshiftBuffer.h"
 
 class WebStream : public StreamBase {
  public:
@@ -36,6 +38,8 @@ class WebStream : public StreamBase {
     // metadata poller (idles until armed)
     poller_ = std::make_shared<MetaPoller>(
         [this](const std::string& s, const std::string& t) {
+          if (!t.empty())
+            sessionMeta_.store(true);
           if (onMeta_)
             onMeta_(s, t);
         },
@@ -66,6 +70,37 @@ class WebStream : public StreamBase {
     std::lock_guard<std::mutex> lk(mu_);
     metaSpec_ = s;
   }
+  void setEndpointCache(std::shared_ptr<MetaEndpointCache> cache) {
+    if (poller_)
+      poller_->setEndpointCache(std::move(cache));
+  }
+  void setStationHealth(std::shared_ptr<StationHealth> health) {
+    std::lock_guard<std::mutex> lk(mu_);
+    health_ = std::move(health);
+  }
+  // Compressed audio kept for pause and seek-back, 0 disables.
+  // Takes effect with the next station.
+  void setTimeshift(size_t bytes) { tsCapacity_.store(bytes); }
+
+  // ---- timeshift ----
+  struct TimeshiftStatus {
+    uint32_t behindMs = 0;  // play cursor behind the live edge
+    uint32_t windowMs = 0;  // retained history, 0 if timeshift is off
+  };
+  TimeshiftStatus timeshiftStatus() const {
+    return {tsBehindMs_.load(), tsWindowMs_.load()};
+  }
+  // Applied by the stream task; 0 returns to the live edge.
+  void timeshiftSeek(uint32_t behindMs) {
+    tsSeekMs_.store((int32_t)std::min<uint32_t>(behindMs, INT32_MAX));
+    tsBehindMs_.store(std::min(behindMs, tsWindowMs_.load()));
+  }
+  // 0 is the oldest retained audio, 100 the live edge
+  void timeshiftSeekPercent(uint8_t pct) {
+    uint32_t window = tsWindowMs_.load();
+    pct = std::min<uint8_t>(pct, 100);
+    timeshiftSeek(window - (uint32_t)((uint64_t)window * pct / 100));
+  }
 
   // ---- control ----
   // Can be called while playing — causes a seamless restart to new URI
@@ -107,6 +142,8 @@ class WebStream : public StreamBase {
     feed_->state_callback = [this](uint8_t s) {
       state = s;
     };
+    uint32_t tid = 0;
+    bool reconnecting = false;
     while (isRunning_.load()) {
       if (!wantRestart_.load()) {
         vTaskDelay(pdMS_TO_TICKS(25));
@@ -114,40 +151,73 @@ class WebStream : public StreamBase {
       }
 
       std::string name;
+      std::shared_ptr<StationHealth> health;
       {
         std::lock_guard<std::mutex> lk(mu_);
+        // a play() during the reconnect wait wins over the reconnect
+        if (resolvedUri_ != targetUri_)
+          reconnecting = false;
         resolvedUri_ = targetUri_;
         name = displayName_;
+        health = health_;
       }
       wantRestart_.store(false);
       if (resolvedUri_.empty()) {
         vTaskDelay(pdMS_TO_TICKS(100));
         continue;
       }
+      // A reconnect keeps the track id so the sink plays out what it has
+      // buffered instead of being cut; a new station is a fresh stream.
+      if (!reconnecting || tid == 0) {
+        tid = audio_->makeUniqueTrackId();
+        resumeAt_ = 0;
+        totalSize_ = 0;
+        reconnect_.reset();
+        resetTimeshift();
+      }
+      trackId_ = tid;
+      reconnecting = false;
 
       // Resolve possible playlists
       auto resolved = resolveIfPlaylist(resolvedUri_);
       if (!resolved) {
         reportError("resolve failed");
-        vTaskDelay(pdMS_TO_TICKS(1000));
         wantRestart_.store(true);
+        reconnecting =
+            waitReconnect(reconnect_.next(nowMs(), false), resolvedUri_);
         continue;
       } else
         SC32_LOG(info, "Resolved to %s", (*resolved).c_str());
       wantRestart_.store(true);
-      // bump track id so the sink treats it as new
-      const uint32_t tid = audio_->makeUniqueTrackId();
       if (onState_)
         onState_(true);
+      StationHealth::Session hs;
+      sessionMeta_.store(false);
+      const uint32_t t0 = nowMs();
       auto resp = open(*resolved, name, tid);
-      if (resp == nullptr)
-        continue;
-      wantStop_.store(false);
+      hs.connectMs = nowMs() - t0;
+      if (resp != nullptr && resumeAt_ > 0 && resp->status() != 206) {
+        // range ignored; the file would replay from the start
+        if (feed_)
+          feed_->feedCommand(AudioControl::SKIP, 0);
+        tid = audio_->makeUniqueTrackId();
+        trackId_ = tid;
+        resumeAt_ = 0;
+        resetTimeshift();
+      }
+      hs.connected = resp != nullptr;
+      hs.declaredKbps = H.bitrateKbps;
+      uint32_t tAudio = 0;
+      if (resp != nullptr)
+        wantStop_.store(false);
       const size_t CHUNK = 1024;
       uint8_t buf[CHUNK];
-      int ret = 0;
-      while (!wantStop_.load()) {
+      int ret = -1;
+      while (resp != nullptr && !wantStop_.load()) {
+        const uint32_t tRead = nowMs();
         ret = read(resp.get(), buf, CHUNK, tid);
+        if (nowMs() - tRead > StationHealth::kStallMs)
+          hs.underruns++;
         if (ret < 0)
           break;
         if (ret == 0) {
@@ -156,6 +226,20 @@ class WebStream : public StreamBase {
           wantStop_.store(true);
           break;
         }
+        if (ret > 0 && hs.bytes == 0) {
+          tAudio = nowMs();
+          hs.firstAudioMs = tAudio - t0;
+        }
+        hs.bytes += (uint32_t)ret;
+        reconnect_.streaming(nowMs());
+        if (resumable_)
+          resumeAt_ += (size_t)ret;
+        if (ts_ && isLive_) {
+          // never blocks on the sink, so a paused player keeps recording
+          ts_->write(buf, (size_t)ret);
+          pumpTimeshift();
+          continue;
+        }
         uint16_t written = 0;
         while (written < ret && !wantStop_.load()) {
           uint16_t ret_ =
@@ -169,24 +253,48 @@ class WebStream : public StreamBase {
       //const bool cleanEnd = streamOnce(*resolvedUri_, name, tid);
       if (onState_)
         onState_(false);
+      bool stopped = wantStop_.load() && !wantRestart_.load();
+      // the whole file arrived; a clean close short of it is a drop
+      const bool complete =
+          ret == 0 && totalSize_ > 0 && resumeAt_ >= totalSize_;
+      if (health) {
+        hs.durationMs = tAudio ? nowMs() - tAudio : 0;
+        hs.gotMeta = sessionMeta_.load();
+        hs.unexpectedEnd = !stopped && !complete;
+        health->record(resolvedUri_, hs);
+      }
+      if (complete) {
+        // the sink plays out its buffer; idle until the next play()
+        if (feed_)
+          feed_->feedCommand(AudioControl::SKIP, 0);
+        if (poller_)
+          poller_->disarm();
+        wantRestart_.store(false);
+        wantStop_.store(false);
+        continue;
+      }
 
-      if (wantStop_.load() && !wantRestart_.load()) {
+      if (!stopped) {
+        // the sink keeps playing its buffer while we wait and reopen
+        if (poller_)
+          poller_->disarm();
+        const uint32_t delay = reconnect_.next(nowMs(), ret == 0);
+        SC32_LOG(info, "reconnect %u in %u ms", (unsigned)reconnect_.attempts(),
+                 (unsigned)delay);
+        reconnecting = waitReconnect(delay, resolvedUri_);
+        stopped = !reconnecting;
+      }
+      if (stopped) {
         if (feed_) {
           feed_->feedCommand(AudioControl::FLUSH, 0);
           feed_->feedCommand(AudioControl::DISC, 0);
         }
         if (poller_)
           poller_->disarm();
+        ts_.reset();
+        tsWindowMs_.store(0);
         wantStop_.store(false);
         isRunning_.store(false);
-      } else {
-        if (feed_)
-          feed_->feedCommand(AudioControl::SKIP, 0);
-        if (poller_)
-          poller_->disarm();
-        vTaskDelay(pdMS_TO_TICKS(reconnectDelayMs_));
-        // reconnect if unexpected end or user queued another play
-        wantRestart_.store(true);
       }
     }
     while (state != 7)
@@ -201,12 +309,20 @@ class WebStream : public StreamBase {
 
     bell::HTTPClient::Headers hdrs = {{"Icy-MetaData", "1"},
                                       {"User-Agent", ua_}};
+    if (resumeAt_ > 0)
+      hdrs.push_back(bell::HTTPClient::RangeHeader::open(resumeAt_));
     auto resp = bell::HTTPClient::get(url, hdrs, 32);
     if (!resp) {
       reportError("HTTP connect failed");
       return nullptr;
     }
+    // an error body is no audio; a range past the end answers 416
+    if (resp->status() >= 400) {
+      reportError("HTTP " + std::to_string(resp->status()));
+      return nullptr;
+    }
     isChunked_ = false;
+    bool acceptsRanges = resp->status() == 206;
     auto h = resp->headers();
     for (auto& header : h) {
       std::string lh = toLower(header.first);
@@ -258,19 +374,32 @@ class WebStream : public StreamBase {
       } else if (lh == "transfer-encoding" &&
                  header.second.find("chunked") != std::string::npos) {
         isChunked_ = true;
+      } else if (lh == "accept-ranges" &&
+                 toLower(header.second).find("bytes") != std::string::npos) {
+        acceptsRanges = true;
       }
     }
+    // live sources resume at their live edge; only plain files get a Range
+    resumable_ = acceptsRanges && H.metaInt <= 0 && resp->contentLength() > 0;
+    // files keep their socket backpressure; only endless streams are recorded
+    isLive_ = resp->contentLength() == 0;
+    // a 206 carries what is left from resumeAt_
+    if (resp->contentLength() > 0)
+      totalSize_ = resp->contentLength() +
+                   (resp->status() == 206 ? resumeAt_ : 0);
     if (H.stationName.empty())
       H.stationName = station;
     SC32_LOG(info, "headers: %s %d %s", H.contentType.c_str(), H.metaInt,
              H.stationName.c_str());
 
     hadNonEmptyICY_ = false;
+    streamPath_ = streamcore::helpers::pathOf(url);
     if (poller_ && metaSpec_.enabled &&
         metaSpec_.kind != MetaPoller::Kind::Disabled) {
       MetaPoller::Spec ps;
       ps.kind = (MetaPoller::Kind)metaSpec_.kind;
       ps.url = metaSpec_.url;
+      ps.mount = streamPath_;
       ps.intervalMs = metaSpec_.intervalMs;
       ps.enabled = metaSpec_.enabled;
       if (H.metaInt <= 0)
@@ -284,6 +413,72 @@ class WebStream : public StreamBase {
         (H.metaInt > 0) ? H.metaInt : std::numeric_limits<int>::max();
     return resp;
   }
+  // Sleeps out a reconnect delay. False if stop() was called meanwhile; a
+  // play() of another station cuts the wait short.
+  bool waitReconnect(uint32_t ms, const std::string& uri) {
+    for (;;) {
+      if (!wantRestart_.load())
+        return false;
+      {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (targetUri_ != uri)
+          return true;
+      }
+      if (ms == 0)
+        return true;
+      pumpTimeshift();  // buffered history bridges the outage
+      uint32_t s = std::min<uint32_t>(ms, 50);
+      vTaskDelay(pdMS_TO_TICKS(s));
+      ms -= s;
+    }
+  }
+  void resetTimeshift() {
+    const size_t cap = tsCapacity_.load();
+    tsSeekMs_.store(-1);
+    tsBehindMs_.store(0);
+    tsWindowMs_.store(0);
+    if (cap == 0) {
+      ts_.reset();
+      return;
+    }
+    if (!ts_ || ts_->capacity() != cap) {
+      ts_.reset();  // release the old block before asking for a new one
+      ts_ = std::make_unique<TimeshiftBuffer>(cap);
+      if (!ts_->valid()) {
+        SC32_LOG(error, "timeshift: cannot allocate %u bytes", (unsigned)cap);
+        ts_.reset();
+        return;
+      }
+    }
+    ts_->clear();
+  }
+  // Moves bytes from the play cursor into the sink as far as it accepts
+  // them. A paused sink takes nothing and the buffer keeps filling.
+  void pumpTimeshift() {
+    if (!ts_ || !feed_)
+      return;
+    // bytes <-> ms through the declared bitrate; kbit/s == bit/ms
+    const uint32_t kbps = H.bitrateKbps ? H.bitrateKbps : 128;
+    const int32_t seekMs = tsSeekMs_.exchange(-1);
+    if (seekMs >= 0) {
+      uint64_t back = (uint64_t)seekMs * kbps / 8;
+      ts_->seek(ts_->head() > back ? ts_->head() - back : 0);
+      // what the sink holds belongs to the old position
+      feed_->feedCommand(AudioControl::FLUSH, 0);
+    }
+    size_t n = 0;
+    uint8_t* p = ts_->readable(&n);
+    while (n > 0) {
+      size_t fed = feed_->feedData(p, n, trackId_, false);
+      if (fed == 0)
+        break;
+      ts_->consume(fed);
+      p = ts_->readable(&n);
+    }
+    // the sink's own buffer is not counted
+    tsBehindMs_.store((uint32_t)((uint64_t)ts_->behind() * 8 / kbps));
+    tsWindowMs_.store((uint32_t)((uint64_t)ts_->window() * 8 / kbps));
+  }
   int read(bell::HTTPClient::Response* stream, uint8_t* buffer,
            size_t chunk_size, size_t trackId) {
 
@@ -331,6 +526,7 @@ class WebStream : public StreamBase {
         MetaPoller::Spec ps;
         ps.kind = MetaPoller::Kind::Auto;
         ps.url = metaSpec_.url;
+        ps.mount = streamPath_;
         ps.intervalMs = metaSpec_.intervalMs;
         ps.enabled = metaSpec_.enabled;
         poller_->arm(originFromUrl(resolvedUri_), H.stationName, ps);
@@ -552,6 +748,7 @@ class WebStream : public StreamBase {
     auto title = parseStreamTitle(raw);
     if (!title.empty()) {
       hadNonEmptyICY_ = true;
+      sessionMeta_.store(true);
       if (onMeta_)
         onMeta_(station, title);
       if (poller_ && metaSpec_.autoDisarmOnICY)
@@ -694,18 +891,28 @@ class WebStream : public StreamBase {
   std::mutex mu_;
   std::string targetUri_;
   std::string resolvedUri_;
+  std::string streamPath_;  // mount of the opened stream, for the poller
   std::string displayName_;
   uint32_t trackId_ = 0;
 
   MetaSpec metaSpec_{};
   IcyHeaders H{};
   bool hadNonEmptyICY_ = false;
+  std::atomic<bool> sessionMeta_{false};  // a title arrived this session
+  std::shared_ptr<StationHealth> health_;
+  std::unique_ptr<TimeshiftBuffer> ts_;
+  std::atomic<size_t> tsCapacity_{0};
+  std::atomic<int32_t> tsSeekMs_{-1};  // pending seek, ms behind live
+  std::atomic<uint32_t> tsBehindMs_{0};
+  std::atomic<uint32_t> tsWindowMs_{0};
   int bytesUntilMeta = std::numeric_limits<int>::max();
   // callbacks
   MetaCb onMeta_;
   ErrorCb onError_;
   StateCb onState_;
 
-  const uint32_t reconnectDelayMs_ = 1500;
+  bool resumable_ = false;  // finite body that honours byte ranges
+  bool isLive_ = true;      // no Content-Length, eligible for timeshift
+  size_t totalSize_ = 0;    // whole file, 0 for live streams
   static constexpr const char* ua_ = "StreamCore32/WebStream (ESP32)";
 };
@@ -0,0 +1,202 @@
+#include "MetaEndpointCache.h"
+#include <algorithm>
+#include <ctime>
+#include <nlohmann/json.hpp>
+
+#include "Logger.h"
+
+namespace {
+bool expired(uint32_t now, uint32_t since, uint32_t ttl) {
+  // without a valid clock entries never expire
+  if (now == 0 || since == 0)
+    return false;
+  return now > since && now - since > ttl;
+}
+uint32_t lastSeen(const MetaEndpointCache::Entry& e) {
+  uint32_t t = e.savedAt;
+  for (auto& d : e.dead)
+    t = std::max(t, d.second);
+  return t;
+}
+}  // namespace
+
+uint32_t MetaEndpointCache::nowSec() {
+  // same validity threshold as timesync::wait_until_valid (2019-01-01)
+  std::time_t t = std::time(nullptr);
+  return (t >= 1546300800) ? (uint32_t)t : 0;
+}
+
+bool MetaEndpointCache::lookup(const std::string& station, Entry* out) {
+  std::lock_guard<std::mutex> lk(mu_);
+  loadLocked();
+  auto it = entries_.find(station);
+  if (it == entries_.end() || it->second.url.empty() ||
+      expired(nowSec(), it->second.savedAt, kPositiveTtlSec)) {
+    stats_.misses++;
+    return false;
+  }
+  stats_.hits++;
+  if (out)
+    *out = it->second;
+  return true;
+}
+
+bool MetaEndpointCache::isDead(const std::string& station,
+                               const std::string& url) {
+  std::lock_guard<std::mutex> lk(mu_);
+  loadLocked();
+  auto it = entries_.find(station);
+  if (it == entries_.end())
+    return false;
+  uint32_t now = nowSec();
+  for (auto& d : it->second.dead) {
+    if (d.first == url)
+      return !expired(now, d.second, kNegativeTtlSec);
+  }
+  return false;
+}
+
+void MetaEndpointCache::remember(const std::string& station, uint8_t kind,
+                                 const std::string& url,
+                                 const std::string& mount) {
+  std::lock_guard<std::mutex> lk(mu_);
+  loadLocked();
+  auto& e = entries_[station];
+  e.kind = kind;
+  e.url = url;
+  e.mount = mount;
+  e.savedAt = nowSec();
+  e.failures = 0;
+  e.dead.erase(std::remove_if(e.dead.begin(), e.dead.end(),
+                              [&](const std::pair<std::string, uint32_t>& d) {
+                                return d.first == url;
+                              }),
+               e.dead.end());
+  evictLocked();
+  dirty_ = true;
+}
+
+void MetaEndpointCache::markFailed(const std::string& station) {
+  std::lock_guard<std::mutex> lk(mu_);
+  loadLocked();
+  auto it = entries_.find(station);
+  if (it == entries_.end() || it->second.url.empty())
+    return;
+  if (++it->second.failures >= kMaxFailures) {
+    SC32_LOG(info, "meta endpoint %s dropped after %u failures",
+             it->second.url.c_str(), (unsigned)it->second.failures);
+    it->second.url.clear();
+    it->second.failures = 0;
+  }
+  dirty_ = true;
+}
+
+void MetaEndpointCache::markDead(const std::string& station,
+                                 const std::string& url) {
+  std::lock_guard<std::mutex> lk(mu_);
+  loadLocked();
+  auto& e = entries_[station];
+  if (e.url == url)
+    return;
+  uint32_t now = nowSec();
+  for (auto& d : e.dead) {
+    if (d.first == url) {
+      if (d.second != now) {
+        d.second = now;
+        dirty_ = true;
+      }
+      return;
+    }
+  }
+  if (e.dead.size() >= kMaxDead)
+    e.dead.erase(std::min_element(
+        e.dead.begin(), e.dead.end(),
+        [](const std::pair<std::string, uint32_t>& a,
+           const std::pair<std::string, uint32_t>& b) {
+          return a.second < b.second;
+        }));
+  e.dead.push_back({url, now});
+  evictLocked();
+  dirty_ = true;
+}
+
+void MetaEndpointCache::noteSaved(uint32_t requests) {
+  std::lock_guard<std::mutex> lk(mu_);
+  stats_.requestsSaved += requests;
+}
+
+MetaEndpointCache::Stats MetaEndpointCache::stats() {
+  std::lock_guard<std::mutex> lk(mu_);
+  return stats_;
+}
+
+void MetaEndpointCache::flush() {
+  std::lock_guard<std::mutex> lk(mu_);
+  if (!dirty_ || !store_)
+    return;
+  Record r;
+  r.userkey = kRecord;
+  for (auto& [station, e] : entries_)
+    r.fields.push_back(Field(station, encode(e)));
+  if (store_->save(r, true) != 0)
+    SC32_LOG(error, "meta endpoint cache: save failed");
+  dirty_ = false;
+}
+
+void MetaEndpointCache::loadLocked() {
+  if (loaded_)
+    return;
+  loaded_ = true;
+  if (!store_)
+    return;
+  Record r;
+  if (store_->load(kRecord, &r) != 0)
+    return;
+  for (auto& f : r.fields) {
+    Entry e;
+    if (decode(f.value, &e))
+      entries_[f.name] = std::move(e);
+  }
+}
+
+void MetaEndpointCache::evictLocked() {
+  while (entries_.size() > kMaxStations) {
+    auto oldest = std::min_element(
+        entries_.begin(), entries_.end(), [](const auto& a, const auto& b) {
+          return lastSeen(a.second) < lastSeen(b.second);
+        });
+    entries_.erase(oldest);
+  }
+}
+
+std::string MetaEndpointCache::encode(const Entry& e) {
+  nlohmann::json j;
+  j["k"] = e.kind;
+  j["u"] = e.url;
+  j["m"] = e.mount;
+  j["t"] = e.savedAt;
+  j["f"] = e.failures;
+  j["d"] = nlohmann::json::array();
+  for (auto& d : e.dead)
+    j["d"].push_back({d.first, d.second});
+  return j.dump();
+}
+
+bool MetaEndpointCache::decode(const std::vector<uint8_t>& raw, Entry* out) {
+  auto j = nlohmann::json::parse(raw.begin(), raw.end(), nullptr, false);
+  if (j.is_discarded() || !j.is_object())
+    return false;
+  out->kind = j.value("k", 0);
+  out->url = j.value("u", std::string());
+  out->mount = j.value("m", std::string());
+  out->savedAt = j.value("t", 0u);
+  out->failures = j.value("f", 0);
+  if (j.contains("d") && j["d"].is_array()) {
+    for (auto& d : j["d"]) {
+      if (d.is_array() && d.size() == 2 && d[0].is_string() &&
+          d[1].is_number_unsigned())
+        out->dead.push_back({d[0].get<std::string>(), d[1].get<uint32_t>()});
+    }
+  }
+  return true;
+}
@@ -1,5 +1,6 @@
 #include "MetaPoller.h"
 #include <set>
+#include "HostRateLimiter.h"
 #include "UrlOrigin.h"
 
 void MetaPoller::runTask() {
@@ -22,11 +23,32 @@ void MetaPoller::runTask() {
     Spec spec;
     std::string origin;
     std::string station;
+    std::string key;
+    bool rearmed = false;
+    std::shared_ptr<MetaEndpointCache> cache;
     {
       std::lock_guard<std::mutex> lk(mu_);
       spec = spec_;
       origin = origin_;
       station = station_;
+      key = stationKey_;
+      cache = cache_;
+      rearmed = rearmed_;
+      rearmed_ = false;
+    }
+
+    // New station: start from the persisted endpoint instead of discovery
+    if (rearmed) {
+      lockedUrl_.clear();
+      lockedFailures_ = 0;
+      lockedFromCache_ = false;
+      softFailures_.clear();
+      MetaEndpointCache::Entry e;
+      if (cache && cache->lookup(key, &e) &&
+          (spec.kind == Kind::Auto || (uint8_t)spec.kind == e.kind)) {
+        lockedUrl_ = e.url;
+        lockedFromCache_ = true;
+      }
     }
 
     std::vector<std::string> urls;
@@ -38,46 +60,85 @@ void MetaPoller::runTask() {
       }
     };
 
-    if (!lockedUrl_.empty())
+    std::vector<std::string> candidates;
+    if (!spec.url.empty()) {
+      if (StreamBase::startsWith(spec.url, "http://") ||
+          StreamBase::startsWith(spec.url, "https://"))
+        candidates.push_back(spec.url);
+      else
+        candidates.push_back(origin + (spec.url[0] == '/' ? "" : "/") +
+                             spec.url);
+    }
+    for (const auto& o : genOriginVariants(origin)) {
+      if (spec.kind == Kind::Auto || spec.kind == Kind::IcecastJSON)
+        candidates.push_back(o + "/status-json.xsl");
+      if (spec.kind == Kind::Auto || spec.kind == Kind::ShoutcastJSON)
+        candidates.push_back(o + "/stats?json=1");
+      if (spec.kind == Kind::Auto || spec.kind == Kind::Shoutcast7)
+        candidates.push_back(o + "/7.html");
+      // generic site JSON now-playing
+      candidates.push_back(o + "/tracklist/currentlyplaying.json");
+    }
+
+    if (!lockedUrl_.empty()) {
       push(lockedUrl_);
-    else {
-      if (!spec.url.empty()) {
-        if (StreamBase::startsWith(spec.url, "http://") ||
-            StreamBase::startsWith(spec.url, "https://"))
-          push(spec.url);
-        else
-          push(origin + (spec.url[0] == '/' ? "" : "/") + spec.url);
-      }
-      for (const auto& o : genOriginVariants(origin)) {
-        if (spec.kind == Kind::Auto || spec.kind == Kind::IcecastJSON)
-          push(o + "/status-json.xsl");
-        if (spec.kind == Kind::Auto || spec.kind == Kind::ShoutcastJSON)
-          push(o + "/stats?json=1");
-        if (spec.kind == Kind::Auto || spec.kind == Kind::Shoutcast7)
-          push(o + "/7.html");
-        // generic site JSON now-playing
-        push(o + "/tracklist/currentlyplaying.json");
+    } else {
+      uint32_t skipped = 0;
+      for (const auto& c : candidates) {
+        if (cache && cache->isDead(key, c)) {
+          ++skipped;
+          continue;
+        }
+        push(c);
       }
+      if (cache && skipped)
+        cache->noteSaved(skipped);
     }
+    // marks a candidate that failed hard so later starts skip it
+    auto dead = [&](const std::string& u) {
+      softFailures_.erase(u);
+      if (cache && u != lockedUrl_)
+        cache->markDead(key, u);
+    };
+    // no answer or a server error may be transient, only a run of them
+    // counts as dead
+    auto failed = [&](const std::string& u) {
+      if (++softFailures_[u] >= kSoftFailuresBeforeDead)
+        dead(u);
+    };
 
     std::string title;
     size_t tried = 0;
     for (auto& u : urls) {
       if (++tried > kMaxUrlsPerCycle)
         break;
+      auto permit = HostRateLimiter::shared().acquire(
+          u, HostRateLimiter::Priority::Background);
+      if (!permit)
+        break;  // host busy or backing off; the next cycle tries again
       auto resp = httpGetSimple(u);
       if (!resp) {
+        failed(u);
         StreamBase::sleepMs(50);
         continue;
       }
+      HostRateLimiter::shared().observe(u, *resp);
       int code = statusFromHeaders(*resp);
+      if (code == 429 || code == 503)
+        break;  // throttled, not dead
       if (code < 200 || code >= 300) {
         if (u == lockedUrl_) {
           if (++lockedFailures_ >= 3) {
             lockedUrl_.clear();
             lockedFailures_ = 0;
+            if (cache)
+              cache->markFailed(key);
           }
         }
+        if (code == 404 || code == 410)
+          dead(u);
+        else
+          failed(u);
         StreamBase::sleepMs(25);
         continue;
       }
@@ -85,12 +146,15 @@ void MetaPoller::runTask() {
       std::string ctL = "";
       if (!ctsv.empty())
         ctL = StreamBase::toLower(StreamBase::svToString(ctsv));
+      auto ul = StreamBase::toLower(u);
+      // status-json.xsl is scanned as it streams in, so its size is not capped
+      bool isIcecast = StreamBase::endsWith(ul, "status-json.xsl");
       size_t clen = sizeFromHeader(resp->header("content-length"));
-      if (clen > kMaxAcceptBody) {
+      if (!isIcecast && clen > kMaxAcceptBody) {
+        dead(u);
         StreamBase::sleepMs(25);
         continue;
       }
-      auto ul = StreamBase::toLower(u);
       bool expectJson = (StreamBase::endsWith(ul, "status-json.xsl") ||
                          ul.find("stats?json") != std::string::npos ||
                          StreamBase::endsWith(ul, ".json"));
@@ -98,37 +162,27 @@ void MetaPoller::runTask() {
                          ul.find("/7.html?") != std::string::npos);
       if (expectJson &&
           (!ctL.empty() && ctL.find("json") == std::string::npos)) {
+        dead(u);
         StreamBase::sleepMs(10);
         continue;
       }
       if (expectText &&
           (!ctL.empty() && ctL.find("text") == std::string::npos)) {
+        dead(u);
         StreamBase::sleepMs(10);
         continue;
       }
-      auto body_sv = resp->body();
-      if (body_sv.size() > kMaxAcceptBody) {
-        StreamBase::sleepMs(10);
-        continue;
+      std::string_view body_sv;
+      if (!isIcecast) {
+        body_sv = resp->body();
+        if (body_sv.size() > kMaxAcceptBody) {
+          StreamBase::sleepMs(10);
+          continue;
+        }
       }
 
-      if (StreamBase::endsWith(ul, "status-json.xsl")) {
-        nlohmann::json j = nlohmann::json::parse(body_sv, nullptr, false);
-        if (!j.is_discarded() && j.contains("icestats")) {
-          const auto& ic = j["icestats"];
-          if (ic.contains("source")) {
-            const auto& src = ic["source"];
-            if (src.is_array()) {
-              for (const auto& s : src) {
-                if (!title.empty())
-                  break;
-                title = pickIcecastTitle(s);
-              }
-            } else if (src.is_object()) {
-              title = pickIcecastTitle(src);
-            }
-          }
-        }
+      if (isIcecast) {
+        title = scanIcecastStatus(*resp, spec.mount);
       } else if (ul.find("stats?json") != std::string::npos) {
         nlohmann::json j = nlohmann::json::parse(body_sv, nullptr, false);
         if (!j.is_discarded()) {
@@ -154,12 +208,29 @@ void MetaPoller::runTask() {
       }
 
       if (!title.empty()) {
+        softFailures_.erase(u);
+        if (u != lockedUrl_) {
+          SC32_LOG(info, "meta endpoint for %s: %s after %u requests",
+                   key.c_str(), u.c_str(), (unsigned)tried);
+          if (cache)
+            cache->remember(key, (uint8_t)kindOfUrl(u), u, spec.mount);
+        } else if (cache && lockedFromCache_) {
+          // requests discovery would have issued before reaching this url
+          auto it = std::find(candidates.begin(), candidates.end(), u);
+          if (it != candidates.end())
+            cache->noteSaved((uint32_t)(it - candidates.begin()));
+          SC32_LOG(info, "meta endpoint for %s from cache, %u saved in total",
+                   key.c_str(), (unsigned)cache->stats().requestsSaved);
+        }
+        lockedFromCache_ = false;
         lockedUrl_ = u;
         lockedFailures_ = 0;
         break;
       }
       StreamBase::sleepMs(25);
     }
+    if (cache)
+      cache->flush();
     if (title.empty() && lockedUrl_.empty()) {
       active_.store(false);
       lastTitle_.clear();
@@ -213,12 +284,44 @@ size_t MetaPoller::sizeFromHeader(std::string_view sv) {
   }
   return v;
 }
-std::string MetaPoller::pickIcecastTitle(const json& s) {
-  std::string title = s.value("title", std::string());
-  std::string artist = s.value("artist", std::string());
-  if (!artist.empty() && !title.empty())
-    return artist + " - " + title;
-  return title;
+std::string MetaPoller::scanIcecastStatus(bell::HTTPClient::Response& r,
+                                          const std::string& mount) {
+  constexpr size_t kMaxScanBody = 256 * 1024;
+  streamcore::helpers::IcecastStatusScanner scan(mount);
+  auto te = StreamBase::toLower(
+      StreamBase::svToString(r.header("transfer-encoding")));
+  if (te.find("chunked") != std::string::npos) {
+    // chunk framing is only undone by body(); scan the assembled buffer
+    auto body_sv = r.body();
+    if (body_sv.size() <= kMaxScanBody)
+      scan.feed(body_sv.data(), body_sv.size());
+  } else {
+    size_t clen = sizeFromHeader(r.header("content-length"));
+    size_t left = clen ? std::min(clen, kMaxScanBody) : kMaxScanBody;
+    uint8_t buf[1024];
+    while (left) {
+      int got = r.read(buf, std::min(left, sizeof(buf)));
+      if (got <= 0)
+        break;
+      left -= (size_t)got;
+      if (!scan.feed(reinterpret_cast<const char*>(buf), (size_t)got))
+        break;
+    }
+  }
+  SC32_LOG(debug, "status-json: scanned %u bytes, mount %s %s",
+           (unsigned)scan.bytesScanned(), mount.c_str(),
+           scan.matched() ? "matched" : "not matched");
+  return scan.title();
+}
+MetaPoller::Kind MetaPoller::kindOfUrl(const std::string& url) {
+  auto ul = StreamBase::toLower(url);
+  if (StreamBase::endsWith(ul, "status-json.xsl"))
+    return Kind::IcecastJSON;
+  if (ul.find("stats?json") != std::string::npos)
+    return Kind::ShoutcastJSON;
+  if (ul.find("/7.html") != std::string::npos)
+    return Kind::Shoutcast7;
+  return Kind::Auto;
 }
 std::string MetaPoller::parseShoutcast7(const std::string_view sv) {
   size_t start = 0;
@@ -0,0 +1,161 @@
+#include "StationHealth.h"
+#include <algorithm>
+#include <ctime>
+#include <nlohmann/json.hpp>
+
+#include "Logger.h"
+
+namespace {
+uint32_t nowSec() {
+  // same validity threshold as timesync::wait_until_valid (2019-01-01)
+  std::time_t t = std::time(nullptr);
+  return (t >= 1546300800) ? (uint32_t)t : 0;
+}
+// moving average weighting the newest sample 1/4
+uint32_t ewma(uint32_t avg, uint32_t sample) {
+  return avg ? (avg * 3 + sample) / 4 : sample;
+}
+}  // namespace
+
+uint8_t StationHealth::Summary::score() const {
+  if (sessions == 0)
+    return 0;
+  int s = 100;
+  // stations that do not answer are the worst offenders
+  s -= (int)(50 * connectFailures / sessions);
+  // drops and stalls per listened hour; at least a minute to damp noise
+  uint32_t listened = std::max<uint32_t>(listenSec, 60);
+  s -= (int)std::min<uint32_t>(30, 10 * reconnects * 3600 / listened);
+  s -= (int)std::min<uint32_t>(20, 4 * underruns * 3600 / listened);
+  if (throughputPct && throughputPct < 90)
+    s -= (int)std::min<uint32_t>(10, (90 - throughputPct) / 3);
+  if (connectMs > 3000)
+    s -= 5;
+  if (metaSessions == 0 && sessions > connectFailures + 2)
+    s -= 5;
+  return (uint8_t)std::max(0, s);
+}
+
+void StationHealth::record(const std::string& station, const Session& s) {
+  if (station.empty())
+    return;
+  std::lock_guard<std::mutex> lk(mu_);
+  loadLocked();
+  auto& h = stations_[station];
+  h.sessions++;
+  h.lastSeen = nowSec();
+  if (!s.connected) {
+    h.connectFailures++;
+  } else {
+    h.connectMs = ewma(h.connectMs, s.connectMs);
+    if (s.firstAudioMs)
+      h.firstAudioMs = ewma(h.firstAudioMs, s.firstAudioMs);
+    h.underruns += s.underruns;
+    h.listenSec += s.durationMs / 1000;
+    if (s.unexpectedEnd)
+      h.reconnects++;
+    if (s.gotMeta)
+      h.metaSessions++;
+    // short sessions say more about buffering than about the stream rate
+    if (s.declaredKbps && s.durationMs >= 10000) {
+      uint64_t kbps = s.bytes * 8 / s.durationMs;
+      uint32_t pct = (uint32_t)std::min<uint64_t>(
+          999, kbps * 100 / s.declaredKbps);
+      h.throughputPct = ewma(h.throughputPct, pct);
+    }
+  }
+  SC32_LOG(debug,
+           "health %s: connect %ums, first audio %ums, %u underruns, "
+           "%ums, score %u",
+           station.c_str(), (unsigned)s.connectMs, (unsigned)s.firstAudioMs,
+           (unsigned)s.underruns, (unsigned)s.durationMs,
+           (unsigned)h.score());
+
+  while (stations_.size() > kMaxStations) {
+    auto oldest = std::min_element(
+        stations_.begin(), stations_.end(), [](const auto& a, const auto& b) {
+          return a.second.lastSeen < b.second.lastSeen;
+        });
+    stations_.erase(oldest);
+  }
+  unsaved_++;
+  if (unsaved_ >= kSaveEvery ||
+      std::chrono::steady_clock::now() - savedAt_ >=
+          std::chrono::milliseconds(kSaveIntervalMs))
+    saveLocked();
+}
+
+void StationHealth::flush() {
+  std::lock_guard<std::mutex> lk(mu_);
+  if (unsaved_)
+    saveLocked();
+}
+
+bool StationHealth::get(const std::string& station, Summary* out) {
+  std::lock_guard<std::mutex> lk(mu_);
+  loadLocked();
+  auto it = stations_.find(station);
+  if (it == stations_.end())
+    return false;
+  if (out)
+    *out = it->second;
+  return true;
+}
+
+void StationHealth::loadLocked() {
+  if (loaded_)
+    return;
+  loaded_ = true;
+  if (!store_)
+    return;
+  Record r;
+  if (store_->load(kRecord, &r) != 0)
+    return;
+  for (auto& f : r.fields) {
+    Summary s;
+    if (decode(f.value, &s))
+      stations_[f.name] = s;
+  }
+}
+
+void StationHealth::saveLocked() {
+  unsaved_ = 0;
+  savedAt_ = std::chrono::steady_clock::now();
+  if (!store_)
+    return;
+  Record r;
+  r.userkey = kRecord;
+  for (auto& [station, s] : stations_)
+    r.fields.push_back(Field(station, encode(s)));
+  if (store_->save(r, true) != 0)
+    SC32_LOG(error, "station health: save failed");
+}
+
+std::string StationHealth::encode(const Summary& s) {
+  nlohmann::json j = {s.sessions,     s.connectFailures, s.reconnects,
+                      s.underruns,    s.metaSessions,    s.listenSec,
+                      s.connectMs,    s.firstAudioMs,    s.throughputPct,
+                      s.lastSeen};
+  return j.dump();
+}
+
+bool StationHealth::decode(const std::vector<uint8_t>& raw, Summary* out) {
+  auto j = nlohmann::json::parse(raw.begin(), raw.end(), nullptr, false);
+  if (j.is_discarded() || !j.is_array() || j.size() < 10)
+    return false;
+  for (auto& v : j) {
+    if (!v.is_number_unsigned())
+      return false;
+  }
+  out->sessions = j[0].get<uint32_t>();
+  out->connectFailures = j[1].get<uint32_t>();
+  out->reconnects = j[2].get<uint32_t>();
+  out->underruns = j[3].get<uint32_t>();
+  out->metaSessions = j[4].get<uint32_t>();
+  out->listenSec = j[5].get<uint32_t>();
+  out->connectMs = j[6].get<uint32_t>();
+  out->firstAudioMs = j[7].get<uint32_t>();
+  out->throughputPct = j[8].get<uint32_t>();
+  out->lastSeen = j[9].get<uint32_t>();
+  return true;
+}
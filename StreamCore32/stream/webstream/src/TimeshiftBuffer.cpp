@@ -0,0 +1,64 @@
+#include "TimeshiftBuffer.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef ESP_PLATFORM
+#include "esp_heap_caps.h"
+#endif
+
+TimeshiftBuffer::TimeshiftBuffer(size_t capacity) {
+#ifdef ESP_PLATFORM
+  buf_ = static_cast<uint8_t*>(
+      heap_caps_malloc(capacity, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT));
+#else
+  buf_ = static_cast<uint8_t*>(std::malloc(capacity));
+#endif
+  cap_ = buf_ ? capacity : 0;
+}
+
+TimeshiftBuffer::~TimeshiftBuffer() {
+#ifdef ESP_PLATFORM
+  heap_caps_free(buf_);
+#else
+  std::free(buf_);
+#endif
+}
+
+void TimeshiftBuffer::clear() {
+  head_ = 0;
+  cursor_ = 0;
+}
+
+void TimeshiftBuffer::write(const uint8_t* data, size_t n) {
+  if (!buf_ || n == 0)
+    return;
+  // only the newest cap_ bytes of an oversized write can survive
+  if (n > cap_) {
+    head_ += n - cap_;
+    data += n - cap_;
+    n = cap_;
+  }
+  size_t at = (size_t)(head_ % cap_);
+  size_t first = std::min(n, cap_ - at);
+  std::memcpy(buf_ + at, data, first);
+  std::memcpy(buf_, data + first, n - first);
+  head_ += n;
+  // paused for longer than the buffer holds: play from the oldest byte
+  if (cursor_ < oldest())
+    cursor_ = oldest();
+}
+
+uint8_t* TimeshiftBuffer::readable(size_t* n) {
+  size_t at = cap_ ? (size_t)(cursor_ % cap_) : 0;
+  *n = std::min(behind(), cap_ - at);
+  return buf_ + at;
+}
+
+void TimeshiftBuffer::consume(size_t n) {
+  cursor_ = std::min<uint64_t>(cursor_ + n, head_);
+}
+
+void TimeshiftBuffer::seek(uint64_t pos) {
+  cursor_ = std::max(oldest(), std::min(pos, head_));
+}
@@ -12,6 +12,7 @@
 #include "BellTask.h"
 #include "WrappedSemaphore.h"
 #include "esp_event.h"
+#include "esp_spiffs.h"
 #include "esp_system.h"
 #include "esp_wifi.h"
 #include "freertos/FreeRTOS.h"
@@ -24,7 +25,11 @@
 #include "ZeroConf.h"
 #define StreamCoreFile SecureStore
 
+#include "AccessKeyFetcher.h"
+#include "AudioKeyCache.h"
+#include "PlainConnection.h"
 #include "SecureKeyHelper.h"
+#include "ShannonConnection.h"
 #include "SpotifyStream.h"
 #include "WebStream.h"
 
@@ -33,8 +38,12 @@
 #include <SpotifyContext.h>
 #include <inttypes.h>
 #include "BellUtils.h"
+#include "CDNUrlCache.h"
 #include "DeviceStateHandler.h"
+#include "HostRateLimiter.h"
 #include "Logger.h"
+#include "MetadataCache.h"
+#include "OggHeaderCache.h"
 #include "ZeroConfServer.h"
 #include "esp_log.h"
 
@@ -68,6 +77,8 @@ std::shared_ptr<QobuzStream> qobuz_app;
 std::shared_ptr<AudioControl> audioControl;
 std::shared_ptr<AudioControl::FeedControl> feedControl;
 std::shared_ptr<WebStream> radio;
+std::shared_ptr<MetaEndpointCache> radioMetaCache;
+std::shared_ptr<StationHealth> radioHealth;
 std::shared_ptr<bell::BellHTTPServer> httpServer;
 
 static void event_handler(void* arg, esp_event_base_t event_base,
@@ -151,11 +162,29 @@ static void sendPlaybackState(mg_connection* conn = nullptr) {
       "{"
       "\"type\":\"playback\","
       "\"volume\":" +
-      std::to_string(vol) + "}";
+      std::to_string(vol);
+  if (radio && current_streaming_service == STREAMING_SERVICE_RADIO) {
+    auto ts = radio->timeshiftStatus();
+    if (ts.windowMs > 0) {
+      uint32_t behind = std::min(ts.behindMs, ts.windowMs);
+      json += ",\"timeshift\":{\"behind_ms\":" + std::to_string(behind) +
+              ",\"window_ms\":" + std::to_string(ts.windowMs) +
+              "},\"position_ms\":" + std::to_string(ts.windowMs - behind) +
+              ",\"duration_ms\":" + std::to_string(ts.windowMs);
+    }
+  }
+  json += "}";
 
   WebUI::wsSendJson(json, conn);
 }
 Store radioStore("radio");
+
+static std::shared_ptr<StationHealth> getRadioHealth() {
+  if (!radioHealth)
+    radioHealth = std::make_shared<StationHealth>(
+        std::make_shared<SecureStore>("radio_health"));
+  return radioHealth;
+}
 static void readWebUIJson(struct mg_connection* conn, char* data, size_t len) {
   if (!len)
     return sendPlaybackState(conn);
@@ -181,6 +210,8 @@ static void readWebUIJson(struct mg_connection* conn, char* data, size_t len) {
                                  j["value"].get<uint8_t>(),
                                  std::optional<uint8_t>(100));
     } else if (j["cmd"] == "seek_percent") {
+      if (radio && current_streaming_service == STREAMING_SERVICE_RADIO)
+        radio->timeshiftSeekPercent(j["value"].get<uint8_t>());
       //if(feedControl) feedControl->feedCommand(AudioControl::CommandType::SEEK_PERCENT, j["value"].get<uint8_t>());
     }
     sendPlaybackState();
@@ -194,9 +225,17 @@ static void readWebUIJson(struct mg_connection* conn, char* data, size_t len) {
       onEndOfStream = []() {
         radio->stop();
         radio = nullptr;
+        if (radioHealth)
+          radioHealth->flush();
         current_streaming_service = STREAMING_SERVICE_NONE;
       };
       radio = std::make_shared<WebStream>(audioControl);
+      if (!radioMetaCache)
+        radioMetaCache = std::make_shared<MetaEndpointCache>(
+            std::make_shared<SecureStore>("radio_meta"));
+      radio->setEndpointCache(radioMetaCache);
+      radio->setStationHealth(getRadioHealth());
+      radio->setTimeshift((size_t)CONFIG_RADIO_TIMESHIFT_KB * 1024);
       radio->onMetadata([](auto st, auto t) {
         nlohmann::json j;
         j["type"] = "playback";
@@ -266,10 +305,23 @@ static void readWebUIJson(struct mg_connection* conn, char* data, size_t len) {
       Record stations;
       radioStore.load("stations", &stations);
       j["stations"] = {};
+      auto health = getRadioHealth();
       for (auto& s : stations.fields) {
-        j["stations"].push_back(
-            {{"name", s.name},
-             {"url", std::string(s.value.begin(), s.value.end())}});
+        std::string url(s.value.begin(), s.value.end());
+        nlohmann::json st = {{"name", s.name}, {"url", url}};
+        StationHealth::Summary h;
+        if (health->get(url, &h) && h.sessions > 0) {
+          st["health"] = {{"score", h.score()},
+                          {"sessions", h.sessions},
+                          {"failures", h.connectFailures},
+                          {"reconnects", h.reconnects},
+                          {"underruns", h.underruns},
+                          {"connectMs", h.connectMs},
+                          {"firstAudioMs", h.firstAudioMs},
+                          {"throughput", h.throughputPct},
+                          {"minutes", h.listenSec / 60}};
+        }
+        j["stations"].push_back(st);
       }
       WebUI::wsSendJson(j.dump());
     } else if (j["page"] == "page-debug") {
@@ -295,12 +347,102 @@ static void readWebUIJson(struct mg_connection* conn, char* data, size_t len) {
                                 {"stack", tasks[i].usStackHighWaterMark}});
         }
       }
+      auto rl = HostRateLimiter::shared().stats();
+      j["http"] = {{"granted", rl.granted},
+                   {"throttled", rl.throttled},
+                   {"deferred", rl.deferred},
+                   {"learned", rl.learned}};
+      auto hc = spotify::OggHeaderCache::shared().stats();
+      j["header_cache"] = {{"hits", hc.hits},
+                           {"misses", hc.misses},
+                           {"evictions", hc.evictions},
+                           {"entries", hc.entries}};
+      auto ak = spotify::AudioKeyCache::shared().stats();
+      j["audio_keys"] = {{"avoided", ak.fetchesAvoided},
+                         {"fetched", ak.fetches},
+                         {"evictions", ak.evictions},
+                         {"entries", ak.entries}};
+      auto spotifyHandler = spotify_app ? spotify_app->handler : nullptr;
+      if (spotifyHandler && spotifyHandler->trackQueue) {
+        auto tk = spotifyHandler->trackQueue->accessKeyFetcher->stats();
+        j["access_token"] = {{"refreshes", tk.refreshes},
+                             {"failures", tk.failures},
+                             {"waits", tk.waits},
+                             {"last_ms", tk.lastLatencyMs},
+                             {"max_ms", tk.maxLatencyMs}};
+      }
+      if (spotifyHandler && spotifyHandler->ctx &&
+          spotifyHandler->ctx->session) {
+        auto pq = spotifyHandler->ctx->session->dispatchStats();
+        j["mercury_dispatch"] = {{"packets", pq.dispatched},
+                                 {"full", pq.full},
+                                 {"avg_us", pq.avgLatencyUs},
+                                 {"max_us", pq.maxLatencyUs}};
+        auto md = spotifyHandler->ctx->session->decodeStats();
+        j["mercury_decode"] = {{"frames", md.frames},
+                               {"partial_frames", md.partialFrames},
+                               {"copied_bytes", md.copiedBytes},
+                               {"adopted_bytes", md.adoptedBytes},
+                               {"avg_us", md.avgDecodeUs}};
+        auto mt = spotifyHandler->ctx->session->timeoutStats();
+        j["mercury_timeouts"] = {{"timeouts", mt.timeouts},
+                                 {"retries", mt.retries},
+                                 {"late", mt.lateResponses},
+                                 {"audio_key_timeouts", mt.audioKeyTimeouts},
+                                 {"pending", mt.pending}};
+      }
+      auto sc = spotify::ShannonConnection::cipherStats();
+      j["shannon"] = {
+          {"bytes", sc.bytes},
+          {"busy_us", sc.busyUs},
+          {"mb_per_s", sc.busyUs ? (double)sc.bytes / sc.busyUs : 0.0},
+          {"cycles_per_byte",
+           sc.bytes ? (double)sc.busyUs * CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ /
+                          sc.bytes
+                    : 0.0}};
+      auto io = spotify::PlainConnection::ioStats();
+      j["socket"] = {
+          {"recv_calls", io.recvCalls},
+          {"send_calls", io.sendCalls},
+          {"recv_per_packet",
+           sc.packetsIn ? (double)io.recvCalls / sc.packetsIn : 0.0},
+          {"send_per_packet",
+           sc.packetsOut ? (double)io.sendCalls / sc.packetsOut : 0.0}};
+      auto cu = spotify::CDNUrlCache::shared().stats();
+      j["cdn_urls"] = {{"resolves", cu.resolves},
+                       {"per_hour", cu.resolvesPerHour},
+                       {"reused", cu.reused},
+                       {"refreshes", cu.refreshes},
+                       {"failovers", cu.failovers}};
+      auto mc = spotify::MetadataCache::shared().stats();
+      j["metadata_cache"] = {{"hits", mc.hits},
+                             {"misses", mc.misses},
+                             {"evictions", mc.evictions},
+                             {"entries", mc.entries},
+                             {"bytes", mc.bytes}};
       WebUI::wsSendJson(j.dump());
     }
   }
 }
+static void init_header_cache() {
+  esp_vfs_spiffs_conf_t conf = {};
+  conf.base_path = "/cache";
+  conf.partition_label = "cache";
+  conf.max_files = 4;
+  conf.format_if_mount_failed = true;
+  esp_err_t err = esp_vfs_spiffs_register(&conf);
+  if (err != ESP_OK) {
+    ESP_LOGW("MAIN", "Header cache unavailable: %s", esp_err_to_name(err));
+    return;
+  }
+  spotify::OggHeaderCache::shared().open("/cache");
+  spotify::MetadataCache::shared().open("/cache");
+}
 void app_main(void) {
   init_nvs();
+  spotify::AudioKeyCache::shared().open(
+      std::make_shared<SecureStore>("spotify_keys"));
+  init_header_cache();
   esp_err_t ret;
   // SPI SETUP
   spi_bus_config_t bus_cfg;